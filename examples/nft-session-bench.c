@@ -0,0 +1,114 @@
+/* gcc nft-session-bench.c -o nft-session-bench -lnftables */
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <nftables/libnftables.h>
+
+/* Add elements one command at a time, like a controller reacting to events
+ * would do, and report how many commands per second go through, first with
+ * plain calls, then within a session. Then do the same with commands that
+ * are only parsed, each one defines a variable holding 64 addresses, which
+ * shows the parse time per command.
+ */
+
+static const char setup[] =
+	"add table ip bench;"
+	"add set ip bench s { type ipv4_addr; size 1000000; };";
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_element_cmd(char *cmd, size_t size, unsigned int i)
+{
+	snprintf(cmd, size, "add element ip bench s { 10.%u.%u.%u }",
+		 (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+}
+
+static void define_cmd(char *cmd, size_t size, unsigned int i)
+{
+	unsigned int j;
+	int len;
+
+	len = snprintf(cmd, size, "define addrs = { ");
+	for (j = 0; j < 64; j++)
+		len += snprintf(cmd + len, size - len, "%s10.%u.%u.%u",
+				j ? ", " : "", (i >> 8) & 0xff, i & 0xff, j);
+	snprintf(cmd + len, size - len, " }");
+}
+
+static int run(struct nft_ctx *ctx, unsigned int count, const char *mode,
+	       void (*build)(char *cmd, size_t size, unsigned int i))
+{
+	char cmd[1024];
+	unsigned int i;
+	double start;
+
+	if (nft_run_cmd_from_buffer(ctx, "flush set ip bench s") < 0)
+		return -1;
+
+	start = now();
+	for (i = 0; i < count; i++) {
+		build(cmd, sizeof(cmd), i);
+		if (nft_run_cmd_from_buffer(ctx, cmd) < 0) {
+			fprintf(stderr, "%s", nft_ctx_get_error_buffer(ctx));
+			return -1;
+		}
+	}
+	printf("%-16s %u commands, %.0f commands/s\n",
+	       mode, count, count / (now() - start));
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int count = 10000;
+	struct nft_ctx *ctx;
+	int err;
+
+	if (argc > 1)
+		count = strtoul(argv[1], NULL, 0);
+
+	ctx = nft_ctx_new(0);
+	if (!ctx) {
+		perror("cannot allocate nft context");
+		return EXIT_FAILURE;
+	}
+	nft_ctx_buffer_error(ctx);
+
+	err = nft_run_cmd_from_buffer(ctx, setup);
+	if (err < 0) {
+		fprintf(stderr, "%s", nft_ctx_get_error_buffer(ctx));
+		goto out;
+	}
+
+	err = run(ctx, count, "add plain", add_element_cmd);
+	if (err < 0)
+		goto out_delete;
+
+	nft_ctx_session_begin(ctx);
+	err = run(ctx, count, "add session", add_element_cmd);
+	nft_ctx_session_end(ctx);
+	if (err < 0)
+		goto out_delete;
+
+	err = run(ctx, count, "parse plain", define_cmd);
+	if (err < 0)
+		goto out_delete;
+
+	nft_ctx_session_begin(ctx);
+	err = run(ctx, count, "parse session", define_cmd);
+	nft_ctx_session_end(ctx);
+
+out_delete:
+	nft_run_cmd_from_buffer(ctx, "delete table ip bench");
+out:
+	nft_ctx_free(ctx);
+
+	return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
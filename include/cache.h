@@ -34,6 +34,7 @@ enum cache_level_flags {
 				  NFT_CACHE_CHAIN_BIT |
 				  NFT_CACHE_RULE_BIT,
 	NFT_CACHE_FULL		= __NFT_CACHE_MAX_BIT - 1,
+	NFT_CACHE_SETELEM_NEIGH	= (1 << 26),
 	NFT_CACHE_TERSE		= (1 << 27),
 	NFT_CACHE_SETELEM_MAYBE	= (1 << 28),
 	NFT_CACHE_REFRESH	= (1 << 29),
@@ -46,6 +47,7 @@ struct nft_filter_obj {
 	uint32_t	family;
 	const char	*table;
 	const char	*set;
+	unsigned int	num_cmds;
 };
 
 #define NFT_CACHE_HSIZE	8192
@@ -63,6 +65,11 @@ struct nft_cache_filter {
 	struct {
 		struct list_head head;
 	} obj[NFT_CACHE_HSIZE];
+
+	/* commands per set, see cache_filter_set_count(). */
+	struct {
+		struct list_head head;
+	} set[NFT_CACHE_HSIZE];
 };
 
 struct nft_cache;
@@ -77,6 +84,8 @@ int nft_cache_update(struct nft_ctx *ctx, unsigned int flags,
 		     const struct nft_cache_filter *filter);
 bool nft_cache_needs_update(struct nft_cache *cache);
 void nft_cache_release(struct nft_cache *cache);
+void nft_cache_mark_stale(struct nft_cache *cache, const struct list_head *cmds);
+void nft_cache_events_close(struct nft_cache *cache);
 
 static inline uint32_t djb_hash(const char *key)
 {
@@ -136,11 +145,25 @@ void ft_cache_add(struct flowtable *ft, struct table *table);
 void ft_cache_del(struct flowtable *ft);
 struct flowtable *ft_cache_find(const struct table *table, const char *name);
 
+struct mnl_socket;
+
+/**
+ * struct nft_cache - ruleset cache
+ *
+ * @genid:	ruleset generation this cache reflects
+ * @table_cache: tables and their objects
+ * @seqnum:	netlink sequence number for cache dumps
+ * @flags:	cache level, see enum cache_level_flags
+ * @mode:	NFT_CTX_CACHE_* flags, set via nft_ctx_cache_set_flags()
+ * @evsock:	NFNLGRP_NFTABLES subscription for incremental updates
+ */
 struct nft_cache {
 	uint32_t		genid;
 	struct cache		table_cache;
 	uint32_t		seqnum;
 	uint32_t		flags;
+	uint32_t		mode;
+	struct mnl_socket	*evsock;
 };
 
 struct netlink_ctx;
@@ -1,7 +1,11 @@
 #ifndef _NFT_CMD_H_
 #define _NFT_CMD_H_
 
-void cmd_add_loc(struct cmd *cmd, uint16_t offset, const struct location *loc);
+struct mnl_err;
+struct nlmsghdr;
+
+void cmd_add_loc(struct cmd *cmd, const struct nlmsghdr *nlh,
+		 const struct location *loc);
 void nft_cmd_error(struct netlink_ctx *ctx, struct cmd *cmd,
 		   struct mnl_err *err);
 
@@ -9,5 +13,23 @@ void nft_cmd_expand(struct cmd *cmd);
 void nft_cmd_post_expand(struct cmd *cmd);
 bool nft_cmd_collapse(struct list_head *cmds);
 void nft_cmd_uncollapse(struct list_head *cmds);
+void nft_cmd_append(struct nft_ctx *nft, struct list_head *cmds,
+		    struct cmd *cmd);
+void nft_cmd_release_elems(struct cmd *cmd);
+
+/* Elements per command that are evaluated and added to the batch while the
+ * input is still being parsed.
+ */
+#define NFT_STREAM_ELEMS	8192
+
+bool nft_stream_started(const struct nft_ctx *nft);
+void nft_stream_elems_begin(struct nft_ctx *nft, enum cmd_ops op,
+			    const struct handle *h,
+			    const struct location *loc);
+void nft_stream_elems(struct nft_ctx *nft, struct list_head *cmds,
+		      struct expr *set);
+void nft_stream_elems_end(struct nft_ctx *nft);
+void nft_stream_cmds(struct nft_ctx *nft, struct list_head *cmds);
+void nft_stream_cancel(struct nft_ctx *nft);
 
 #endif
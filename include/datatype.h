@@ -231,13 +231,20 @@ enum base {
  * struct symbol_table - type construction from symbolic values
  *
  * @base:	base of symbols representation
+ * @index:	hash index of the symbols by name and value (optional)
  * @symbols:	the symbols
  */
 struct symbol_table {
 	enum base 			base;
+	struct symbol_table_index	*index;
 	struct symbolic_constant	symbols[];
 };
 
+extern const struct symbolic_constant *
+symbol_table_lookup(const struct symbol_table *tbl, const char *identifier);
+extern const struct symbolic_constant *
+symbol_table_lookup_value(const struct symbol_table *tbl, uint64_t value);
+
 extern struct error_record *symbolic_constant_parse(struct parse_ctx *ctx,
 						    const struct expr *sym,
 						    const struct symbol_table *tbl,
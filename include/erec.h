@@ -61,6 +61,7 @@ static inline void erec_queue(struct error_record *erec,
 
 extern void erec_print(struct output_ctx *octx, const struct error_record *erec,
 		       unsigned int debug_mask);
+extern void erec_free_list(struct list_head *list);
 extern void erec_print_list(struct output_ctx *octx, struct list_head *list,
 			    unsigned int debug_mask);
 
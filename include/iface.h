@@ -9,10 +9,16 @@ struct iface {
 	uint32_t		ifindex;
 };
 
-unsigned int nft_if_nametoindex(const char *name);
-char *nft_if_indextoname(unsigned int ifindex, char *name);
+struct iface_cache;
 
-void iface_cache_update(void);
-void iface_cache_release(void);
+unsigned int nft_if_nametoindex(struct iface_cache *cache, const char *name);
+char *nft_if_indextoname(struct iface_cache *cache, unsigned int ifindex,
+			 char *name);
+
+struct iface_cache *iface_cache_alloc(void);
+void iface_cache_update(struct iface_cache *cache);
+void iface_cache_release(struct iface_cache *cache);
+void iface_cache_expire(struct iface_cache *cache);
+void iface_cache_free(struct iface_cache *cache);
 
 #endif
@@ -8,4 +8,7 @@ int set_delete(struct list_head *msgs, struct cmd *cmd, struct set *set,
 int set_overlap(struct list_head *msgs, struct set *set, struct expr *init);
 int set_to_intervals(const struct set *set, struct expr *init, bool add);
 
+struct interval_runs *interval_runs_alloc(const struct set *set);
+void interval_runs_free(struct interval_runs *runs);
+
 #endif
@@ -115,11 +115,15 @@ void monitor_print_obj_json(struct netlink_mon_handler *monh,
 			    const char *cmd, struct obj *o);
 void monitor_print_rule_json(struct netlink_mon_handler *monh,
 			     const char *cmd, struct rule *r);
+void monitor_print_lost_json(struct netlink_mon_handler *monh);
+void monitor_print_resync_json(struct netlink_mon_handler *monh,
+			       uint32_t genid);
 
 int json_events_cb(const struct nlmsghdr *nlh,
 		   struct netlink_mon_handler *monh);
 void json_alloc_echo(struct nft_ctx *ctx);
 void json_print_echo(struct nft_ctx *ctx);
+void json_parse_state_free(struct nft_ctx *ctx);
 
 #else /* ! HAVE_LIBJANSSON */
 
@@ -260,6 +264,17 @@ static inline void monitor_print_rule_json(struct netlink_mon_handler *monh,
 	/* empty */
 }
 
+static inline void monitor_print_lost_json(struct netlink_mon_handler *monh)
+{
+	/* empty */
+}
+
+static inline void monitor_print_resync_json(struct netlink_mon_handler *monh,
+					     uint32_t genid)
+{
+	/* empty */
+}
+
 static inline int json_events_cb(const struct nlmsghdr *nlh,
                                  struct netlink_mon_handler *monh)
 {
@@ -276,6 +291,11 @@ static inline void json_print_echo(struct nft_ctx *ctx)
 	/* empty */
 }
 
+static inline void json_parse_state_free(struct nft_ctx *ctx)
+{
+	/* empty */
+}
+
 #endif /* HAVE_LIBJANSSON */
 
 #endif /* NFTABLES_JSON_H */
@@ -7,6 +7,7 @@
 #include <libmnl/libmnl.h>
 
 struct mnl_socket *nft_mnl_socket_open(void);
+struct mnl_socket *mnl_nft_monitor_socket_open(void);
 
 uint32_t mnl_seqnum_alloc(uint32_t *seqnum);
 uint32_t mnl_genid_get(struct netlink_ctx *ctx);
@@ -25,8 +26,7 @@ bool mnl_batch_ready(struct nftnl_batch *batch);
 void mnl_batch_reset(struct nftnl_batch *batch);
 uint32_t mnl_batch_begin(struct nftnl_batch *batch, uint32_t seqnum);
 void mnl_batch_end(struct nftnl_batch *batch, uint32_t seqnum);
-int mnl_batch_talk(struct netlink_ctx *ctx, struct list_head *err_list,
-		   uint32_t num_cmds);
+int mnl_batch_talk(struct netlink_ctx *ctx, struct list_head *err_list);
 
 int mnl_nft_rule_add(struct netlink_ctx *ctx, struct cmd *cmd,
 		     unsigned int flags);
@@ -96,8 +96,38 @@ int mnl_nft_dump_nf_hooks(struct netlink_ctx *ctx, int family, int hook,
 int mnl_nft_event_listener(struct mnl_socket *nf_sock, unsigned int debug_mask,
 			   struct output_ctx *octx,
 			   int (*cb)(const struct nlmsghdr *nlh, void *data),
+			   int (*lost_cb)(void *data),
 			   void *cb_data);
 
+struct mnl_dump {
+	struct list_head	list;
+	struct nlmsghdr		*nlh;
+	int			(*cb)(const struct nlmsghdr *nlh, void *data);
+	void			*data;
+	void			(*free_data)(void *data);
+	int			err;
+};
+
+struct mnl_dump *mnl_nft_setelem_dump_add(struct list_head *dumps,
+					  uint32_t seqnum,
+					  struct nftnl_set *nls);
+struct mnl_dump *mnl_nft_obj_dump_add(struct list_head *dumps,
+				      uint32_t seqnum, int family,
+				      const char *table);
+struct mnl_dump *mnl_nft_rule_dump_add(struct list_head *dumps,
+				       uint32_t seqnum, int family,
+				       const char *table);
+int mnl_nft_dump_run(struct netlink_ctx *ctx, struct list_head *dumps,
+		     unsigned int max_workers);
+void mnl_dump_workers_init(struct nft_ctx *nft);
+void mnl_dump_workers_free(struct nft_ctx *nft);
+void mnl_nft_dump_free(struct list_head *dumps);
+
+struct mnl_socket *mnl_nft_event_socket_open(void);
+int mnl_nft_event_drain(struct mnl_socket *nf_sock,
+			int (*cb)(const struct nlmsghdr *nlh, void *data),
+			void *cb_data);
+
 int nft_mnl_talk(struct netlink_ctx *ctx, const void *data, unsigned int len,
 		 int (*cb)(const struct nlmsghdr *nlh, void *data),
 		 void *cb_data);
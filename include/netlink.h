@@ -165,12 +165,17 @@ extern struct stmt *netlink_parse_set_expr(const struct set *set,
 					   const struct nft_cache *cache,
 					   const struct nftnl_expr *nle);
 
+extern struct nftnl_set *netlink_setelems_alloc(const struct handle *h);
+extern void netlink_setelems_init(struct netlink_ctx *ctx, struct set *set,
+				  struct nftnl_set *nls);
 extern int netlink_list_setelems(struct netlink_ctx *ctx,
 				 const struct handle *h, struct set *set,
 				 bool reset);
 extern int netlink_get_setelem(struct netlink_ctx *ctx, const struct handle *h,
 			       const struct location *loc, struct set *cache_set,
 			       struct set *set, struct expr *init, bool reset);
+extern int netlink_get_setelem_interval(struct netlink_ctx *ctx,
+					struct set *set, const mpz_t value);
 extern int netlink_delinearize_setelem(struct nftnl_set_elem *nlse,
 				       struct set *set,
 				       struct nft_cache *cache);
@@ -216,10 +221,16 @@ struct netlink_mon_handler {
 	const struct location	*loc;
 	unsigned int		debug_mask;
 	struct nft_cache	*cache;
+	struct netlink_trace_cache *trace;
+	uint32_t		genid;
+	uint32_t		resync_genid;
 };
 
-extern int netlink_monitor(struct netlink_mon_handler *monhandler,
-			    struct mnl_socket *nf_sock);
+struct netlink_trace_cache *netlink_trace_cache_alloc(void);
+void netlink_trace_cache_flush(struct netlink_trace_cache *cache);
+void netlink_trace_cache_free(struct netlink_trace_cache *cache);
+
+extern int netlink_monitor(struct netlink_mon_handler *monhandler);
 struct netlink_cb_data {
 	struct netlink_ctx	*nl_ctx;
 	struct list_head	*err_list;
@@ -235,6 +246,9 @@ struct nftnl_parse_ctx;
 
 int netlink_events_trace_cb(const struct nlmsghdr *nlh, int type,
 			    struct netlink_mon_handler *monh);
+int netlink_events_cache_sync(struct netlink_ctx *ctx,
+			      const struct nlmsghdr *nlh);
+int netlink_events_genid(const struct nlmsghdr *nlh, uint32_t *genid);
 
 enum nft_data_types dtype_map_to_kernel(const struct datatype *dtype);
 
@@ -15,11 +15,19 @@ struct cookie {
 	size_t pos;
 };
 
+struct nft_netdb;
+struct nft_dns_cache;
+struct iface_cache;
+struct json_parse_state;
+
 struct symbol_tables {
 	const struct symbol_table	*mark;
 	const struct symbol_table	*devgroup;
 	const struct symbol_table	*ct_label;
 	const struct symbol_table	*realm;
+	struct nft_netdb		*netdb;
+	struct nft_dns_cache		*dns;
+	struct iface_cache		*iface;
 };
 
 struct input_ctx {
@@ -36,6 +44,11 @@ static inline bool nft_input_json(const struct input_ctx *ictx)
 	return ictx->flags & NFT_CTX_INPUT_JSON;
 }
 
+static inline bool nft_input_stream(const struct input_ctx *ictx)
+{
+	return ictx->flags & NFT_CTX_INPUT_STREAM;
+}
+
 struct output_ctx {
 	unsigned int flags;
 	union {
@@ -120,8 +133,19 @@ struct nft_vars {
 
 #define MAX_INCLUDE_DEPTH	16
 
+struct mnl_recv_buf;
+struct mnl_dump_worker;
+
 struct nft_ctx {
 	struct mnl_socket	*nf_sock;
+	struct mnl_recv_buf	*nl_rxbuf;
+	struct mnl_dump_worker	*dump_workers;
+	unsigned int		num_dump_workers;
+	struct {
+		dev_t		dev;
+		ino_t		ino;
+	} netns;
+	uint32_t		nf_genid;
 	char			**include_paths;
 	unsigned int		num_include_paths;
 	struct nft_vars		*vars;
@@ -143,7 +167,15 @@ struct nft_ctx {
 	struct scope		*top_scope;
 	void			*json_root;
 	json_t			*json_echo;
+	struct json_parse_state	*json_state;
 	const char		*stdin_buf;
+	struct nft_stream	*stream;
+	struct {
+		bool		active;
+		unsigned int	cache_mode;
+		char		*buf;
+		size_t		buflen;
+	} session;
 };
 
 enum nftables_exit_codes {
@@ -153,14 +185,18 @@ enum nftables_exit_codes {
 	NFT_EXIT_NONL		= 3,
 };
 
+/* Every expression and statement embeds a location, keep it small. The
+ * offset of the line saturates at LOCATION_OFFSET_MAX, the line is not
+ * shown in error messages past that point.
+ */
+#define LOCATION_OFFSET_MAX	UINT32_MAX
+
 struct input_descriptor;
 struct location {
 	const struct input_descriptor		*indesc;
 	union {
 		struct {
-			off_t			token_offset;
-			off_t			line_offset;
-
+			uint32_t		line_offset;
 			unsigned int		first_line;
 			unsigned int		last_line;
 			unsigned int		first_column;
@@ -236,6 +272,7 @@ void realm_table_rt_exit(struct nft_ctx *ctx);
 int nft_print(struct output_ctx *octx, const char *fmt, ...)
 	__attribute__((format(printf, 2, 3)));
 int nft_gmp_print(struct output_ctx *octx, const char *fmt, ...);
+void nft_print_flush(struct output_ctx *octx);
 
 int nft_optimize(struct nft_ctx *nft, struct list_head *cmds);
 
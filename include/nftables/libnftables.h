@@ -50,11 +50,20 @@ void nft_ctx_set_optimize(struct nft_ctx *ctx, uint32_t flags);
 enum {
 	NFT_CTX_INPUT_NO_DNS		= (1 << 0),
 	NFT_CTX_INPUT_JSON		= (1 << 1),
+	NFT_CTX_INPUT_STREAM		= (1 << 2),
 };
 
 unsigned int nft_ctx_input_get_flags(struct nft_ctx *ctx);
 unsigned int nft_ctx_input_set_flags(struct nft_ctx *ctx, unsigned int flags);
 
+enum {
+	NFT_CTX_CACHE_INCREMENTAL	= (1 << 0),
+	NFT_CTX_CACHE_PARALLEL		= (1 << 1),
+};
+
+unsigned int nft_ctx_cache_get_flags(struct nft_ctx *ctx);
+unsigned int nft_ctx_cache_set_flags(struct nft_ctx *ctx, unsigned int flags);
+
 enum {
 	NFT_CTX_OUTPUT_REVERSEDNS	= (1 << 0),
 	NFT_CTX_OUTPUT_SERVICE		= (1 << 1),
@@ -96,6 +105,11 @@ void nft_ctx_clear_include_paths(struct nft_ctx *ctx);
 int nft_ctx_add_var(struct nft_ctx *ctx, const char *var);
 void nft_ctx_clear_vars(struct nft_ctx *ctx);
 
+void nft_ctx_netdb_refresh(struct nft_ctx *ctx);
+
+int nft_ctx_session_begin(struct nft_ctx *ctx);
+void nft_ctx_session_end(struct nft_ctx *ctx);
+
 int nft_run_cmd_from_buffer(struct nft_ctx *nft, const char *buf);
 int nft_run_cmd_from_filename(struct nft_ctx *nft, const char *filename);
 
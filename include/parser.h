@@ -13,23 +13,6 @@
 
 #define SCOPE_NEST_MAX			4
 
-struct parser_state {
-	struct input_descriptor		*indesc;
-	struct list_head		indesc_list;
-
-	struct list_head		*msgs;
-	unsigned int			nerrs;
-
-	struct scope			*scopes[SCOPE_NEST_MAX];
-	unsigned int			scope;
-	bool				scope_err;
-
-	unsigned int			flex_state_pop;
-	unsigned int			startcond_type;
-	struct list_head		*cmds;
-	unsigned int			*startcond_active;
-};
-
 enum startcond_type {
 	PARSER_SC_BEGIN,
 	PARSER_SC_ARP,
@@ -91,6 +74,23 @@ enum startcond_type {
 	__SC_MAX
 };
 
+struct parser_state {
+	struct input_descriptor		*indesc;
+	struct list_head		indesc_list;
+
+	struct list_head		*msgs;
+	unsigned int			nerrs;
+
+	struct scope			*scopes[SCOPE_NEST_MAX];
+	unsigned int			scope;
+	bool				scope_err;
+
+	unsigned int			flex_state_pop;
+	unsigned int			startcond_type;
+	struct list_head		*cmds;
+	unsigned int			startcond_active[__SC_MAX];
+};
+
 struct mnl_socket;
 
 extern void parser_init(struct nft_ctx *nft, struct parser_state *state,
@@ -0,0 +1,21 @@
+#ifndef _NFTABLES_RESOLVE_H_
+#define _NFTABLES_RESOLVE_H_
+
+struct nft_dns_cache;
+
+struct nft_dns_cache *nft_dns_cache_alloc(void);
+void nft_dns_cache_flush(struct nft_dns_cache *dns);
+void nft_dns_cache_free(struct nft_dns_cache *dns);
+
+void nft_dns_queue_name(struct nft_dns_cache *dns, int family,
+			const char *name);
+void nft_dns_queue_addr(struct nft_dns_cache *dns, int family,
+			const void *addr);
+void nft_dns_run(struct nft_dns_cache *dns);
+
+int nft_dns_getaddr(struct nft_dns_cache *dns, int family, const char *name,
+		    void *addr, unsigned int *naddrs);
+const char *nft_dns_getname(struct nft_dns_cache *dns, int family,
+			    const void *addr);
+
+#endif
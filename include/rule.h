@@ -92,27 +92,37 @@ extern void handle_free(struct handle *h);
  *
  * @parent:	pointer to parent scope
  * @symbols:	symbols bound in the scope
+ * @hash:	symbols hashed by identifier, allocated on first bind
+ * @hsize:	number of hash buckets
+ * @nsymbols:	number of symbols in the hash
  */
 struct scope {
 	const struct scope	*parent;
 	struct list_head	symbols;
+	struct hlist_head	*hash;
+	uint32_t		hsize;
+	uint32_t		nsymbols;
 };
 
 extern struct scope *scope_alloc(void);
 extern struct scope *scope_init(struct scope *scope, const struct scope *parent);
-extern void scope_release(const struct scope *scope);
+extern void scope_release(struct scope *scope);
 extern void scope_free(struct scope *scope);
 
 /**
  * struct symbol
  *
  * @list:	scope symbol list node
+ * @hnode:	scope symbol hash node
+ * @hash:	hash of @identifier
  * @identifier:	identifier
  * @expr:	initializer
  * @refcnt:	reference counter
  */
 struct symbol {
 	struct list_head	list;
+	struct hlist_node	hnode;
+	uint32_t		hash;
 	const char		*identifier;
 	struct expr		*expr;
 	int			refcnt;
@@ -120,7 +130,7 @@ struct symbol {
 
 extern void symbol_bind(struct scope *scope, const char *identifier,
 			struct expr *expr);
-extern int symbol_unbind(const struct scope *scope, const char *identifier);
+extern int symbol_unbind(struct scope *scope, const char *identifier);
 extern struct symbol *symbol_lookup(const struct scope *scope,
 				    const char *identifier);
 struct symbol *symbol_lookup_fuzzy(const struct scope *scope,
@@ -149,6 +159,7 @@ unsigned int parse_table_flag(const char *name);
  * @flowtables:	flow tables contained in the table
  * @flags:	table flags
  * @refcnt:	table reference counter
+ * @stale:	cached content needs to be fetched again from the kernel
  */
 struct table {
 	struct list_head	list;
@@ -170,6 +181,7 @@ struct table {
 	uint32_t		owner;
 	const char		*comment;
 	bool			has_xt_stmts;
+	bool			stale;
 };
 
 extern struct table *table_alloc(void);
@@ -219,6 +231,23 @@ struct chain_type_spec {
 	const char	*str;
 };
 
+/**
+ * struct rule_node - order statistics tree node
+ *
+ * @parent:	parent node
+ * @child:	left and right child nodes
+ * @size:	number of nodes in the subtree rooted at this node
+ * @prio:	random heap priority
+ */
+struct rule_node {
+	struct rule_node	*parent;
+	struct rule_node	*child[2];
+	uint32_t		size;
+	uint32_t		prio;
+};
+
+struct rule_index;
+
 /**
  * struct chain - nftables chain
  *
@@ -234,6 +263,7 @@ struct chain_type_spec {
  * @type:	chain type
  * @dev:	device (if any)
  * @rules:	rules contained in the chain
+ * @rule_index:	handle and position index of @rules, built on first lookup
  */
 struct chain {
 	struct list_head	list;
@@ -255,6 +285,7 @@ struct chain {
 	};
 	struct scope		scope;
 	struct list_head	rules;
+	struct rule_index	*rule_index;
 };
 
 #define STD_PRIO_BUFSIZE 100
@@ -289,6 +320,8 @@ extern void chain_rules_print(const struct chain *chain,
  * @num_stmts:	number of statements in stmts list
  * @comment:	comment
  * @refcnt:	rule reference counter
+ * @hnode:	node in the handle hash of the chain rule index
+ * @node:	node in the position tree of the chain rule index
  */
 struct rule {
 	struct list_head	list;
@@ -298,6 +331,8 @@ struct rule {
 	unsigned int		num_stmts;
 	const char		*comment;
 	unsigned int		refcnt;
+	struct hlist_node	hnode;
+	struct rule_node	node;
 };
 
 extern struct rule *rule_alloc(const struct location *loc,
@@ -305,9 +340,13 @@ extern struct rule *rule_alloc(const struct location *loc,
 extern struct rule *rule_get(struct rule *rule);
 extern void rule_free(struct rule *rule);
 extern void rule_print(const struct rule *rule, struct output_ctx *octx);
-extern struct rule *rule_lookup(const struct chain *chain, uint64_t handle);
-extern struct rule *rule_lookup_by_index(const struct chain *chain,
-					 uint64_t index);
+extern struct rule *rule_lookup(struct chain *chain, uint64_t handle);
+extern struct rule *rule_lookup_by_index(struct chain *chain, uint64_t index);
+extern void chain_rule_add(struct chain *chain, struct rule *rule,
+			   struct list_head *head);
+extern void chain_rule_add_tail(struct chain *chain, struct rule *rule,
+				struct list_head *head);
+extern void chain_rule_del(struct chain *chain, struct rule *rule);
 void rule_stmt_append(struct rule *rule, struct stmt *stmt);
 void rule_stmt_insert_at(struct rule *rule, struct stmt *nstmt,
 			 struct stmt *stmt);
@@ -327,11 +366,13 @@ void rule_stmt_insert_at(struct rule *rule, struct stmt *nstmt,
  * @objtype:	mapping object type
  * @existing_set: reference to existing set in the kernel
  * @init:	initializer
+ * @runs:	intervals of elements released while the input is parsed
  * @rg_cache:	cached range element (left)
  * @policy:	set mechanism policy
  * @automerge:	merge adjacents and overlapping elements, if possible
  * @comment:	comment
  * @errors:	expr evaluation errors seen
+ * @stale:	cached elements need to be fetched again from the kernel
  * @desc.size:		count of set elements
  * @desc.field_len:	length of single concatenated fields, bytes
  * @desc.field_count:	count of concatenated fields
@@ -350,6 +391,7 @@ struct set {
 	uint32_t		objtype;
 	struct set		*existing_set;
 	struct expr		*init;
+	struct interval_runs	*runs;
 	struct expr		*rg_cache;
 	uint32_t		policy;
 	struct list_head	stmt_list;
@@ -357,6 +399,7 @@ struct set {
 	bool			automerge;
 	bool			key_typeof_valid;
 	bool			errors;
+	bool			stale;
 	const char		*comment;
 	struct {
 		uint32_t	size;
@@ -695,10 +738,21 @@ void monitor_free(struct monitor *m);
 #define NFT_NLATTR_LOC_MAX 32
 
 struct nlerr_loc {
+	uint32_t		seqnum;
 	uint16_t		offset;
 	const struct location	*location;
 };
 
+/* Position of an element whose expression was released after adding it to
+ * the batch, in the input the command was read from. Zero line if unknown.
+ */
+struct nlerr_elem_loc {
+	uint32_t		line_offset;
+	uint32_t		line;
+	uint16_t		first_column;
+	uint16_t		last_column;
+};
+
 /**
  * struct cmd - command statement
  *
@@ -708,7 +762,11 @@ struct nlerr_loc {
  * @obj:	object type to perform operation on
  * @handle:	handle for operations working without full objects
  * @seqnum:	sequence number to match netlink errors
+ * @seqnum_last: sequence number of the last message, if the command spans
+ *		several of them
  * @union:	object
+ * @attr:	location of netlink attributes, to match netlink errors
+ * @elem_loc:	location of released elements, same index as @attr
  * @arg:	argument data
  */
 struct cmd {
@@ -718,6 +776,7 @@ struct cmd {
 	enum cmd_obj		obj;
 	struct handle		handle;
 	uint32_t		seqnum;
+	uint32_t		seqnum_last;
 	struct list_head	collapse_list;
 	union {
 		void		*data;
@@ -736,6 +795,7 @@ struct cmd {
 		struct obj	*object;
 	};
 	struct nlerr_loc	*attr;
+	struct nlerr_elem_loc	*elem_loc;
 	uint32_t		attr_array_len;
 	uint32_t		num_attrs;
 	const void		*arg;
@@ -770,9 +830,27 @@ extern void cmd_free(struct cmd *cmd);
  * @_pctx:	payload contexts
  * @inner_desc: inner header description
  */
+/**
+ * struct set_intern - anonymous interval sets evaluated in a transaction
+ *
+ * @hash:	interned sets, hashed by their elements before evaluation
+ * @hsize:	number of hash buckets
+ * @nelems:	number of interned sets
+ * @hits:	number of sets that reused the elements of an interned set
+ */
+struct set_intern {
+	struct hlist_head	*hash;
+	unsigned int		hsize;
+	unsigned int		nelems;
+	unsigned int		hits;
+};
+
+extern void set_intern_release(struct set_intern *si);
+
 struct eval_ctx {
 	struct nft_ctx		*nft;
 	struct list_head	*msgs;
+	struct set_intern	*set_intern;
 	struct cmd		*cmd;
 	struct table		*table;
 	struct rule		*rule;
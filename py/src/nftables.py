@@ -40,6 +40,12 @@ class Nftables:
     input_flags = {
         "no-dns": 0x1,
         "json": 0x2,
+        "stream": 0x4,
+    }
+
+    cache_flags = {
+        "incremental": 0x1,
+        "parallel":    0x2,
     }
 
     debug_flags = {
@@ -97,6 +103,14 @@ class Nftables:
         self.nft_ctx_input_set_flags.restype = c_uint
         self.nft_ctx_input_set_flags.argtypes = [c_void_p, c_uint]
 
+        self.nft_ctx_cache_get_flags = lib.nft_ctx_cache_get_flags
+        self.nft_ctx_cache_get_flags.restype = c_uint
+        self.nft_ctx_cache_get_flags.argtypes = [c_void_p]
+
+        self.nft_ctx_cache_set_flags = lib.nft_ctx_cache_set_flags
+        self.nft_ctx_cache_set_flags.restype = c_uint
+        self.nft_ctx_cache_set_flags.argtypes = [c_void_p, c_uint]
+
         self.nft_ctx_output_get_flags = lib.nft_ctx_output_get_flags
         self.nft_ctx_output_get_flags.restype = c_uint
         self.nft_ctx_output_get_flags.argtypes = [c_void_p]
@@ -217,9 +231,12 @@ class Nftables:
         -----------------------
         "no-dns"  | 0x1
         "json"    | 0x2
+        "stream"  | 0x4
 
         "no-dns" disables blocking address lookup.
         "json" enables JSON mode for input.
+        "stream" adds large element commands to the batch while a file is
+        parsed.
 
         Returns a set of previously active input flags, as returned by
         get_input_flags() method.
@@ -228,6 +245,36 @@ class Nftables:
         old = self.nft_ctx_input_set_flags(self.__ctx, val)
         return self._flags_from_numeric(self.input_flags, old)
 
+    def get_cache_flags(self):
+        """Get currently active cache flags.
+
+        Returns a set of flag names. See set_cache_flags() for details.
+        """
+        val = self.nft_ctx_cache_get_flags(self.__ctx)
+        return self._flags_from_numeric(self.cache_flags, val)
+
+    def set_cache_flags(self, values):
+        """Set cache flags.
+
+        Resets all cache flags to values. Accepts either a single flag or a list
+        of flags. Each flag might be given either as string or integer value as
+        shown in the following table:
+
+        Name          | Value (hex)
+        ---------------------------
+        "incremental" | 0x1
+        "parallel"    | 0x2
+
+        "incremental" updates the cache from ruleset notifications.
+        "parallel" fetches and parses the ruleset over several sockets.
+
+        Returns a set of previously active cache flags, as returned by
+        get_cache_flags() method.
+        """
+        val = self._flags_to_numeric(self.cache_flags, values)
+        old = self.nft_ctx_cache_set_flags(self.__ctx, val)
+        return self._flags_from_numeric(self.cache_flags, old)
+
     def __get_output_flag(self, name):
         flag = self.output_flags[name]
         return (self.nft_ctx_output_get_flags(self.__ctx) & flag) != 0
@@ -8,6 +8,8 @@
 
 #include <nft.h>
 
+#include <pthread.h>
+
 #include <expression.h>
 #include <statement.h>
 #include <rule.h>
@@ -19,6 +21,7 @@
 #include <libnftnl/chain.h>
 #include <linux/netfilter.h>
 #include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nfnetlink.h>
 
 static unsigned int evaluate_cache_add(struct cmd *cmd, unsigned int flags)
 {
@@ -57,7 +60,7 @@ static unsigned int evaluate_cache_add(struct cmd *cmd, unsigned int flags)
 			 NFT_CACHE_CHAIN |
 			 NFT_CACHE_SET |
 			 NFT_CACHE_OBJECT |
-			 NFT_CACHE_SETELEM_MAYBE;
+			 NFT_CACHE_SETELEM_NEIGH;
 		break;
 	case CMD_OBJ_RULE:
 		flags |= NFT_CACHE_TABLE |
@@ -81,7 +84,7 @@ static unsigned int evaluate_cache_del(struct cmd *cmd, unsigned int flags)
 {
 	switch (cmd->obj) {
 	case CMD_OBJ_ELEMENTS:
-		flags |= NFT_CACHE_SETELEM_MAYBE;
+		flags |= NFT_CACHE_SETELEM_NEIGH;
 		break;
 	default:
 		break;
@@ -112,8 +115,10 @@ struct nft_cache_filter *nft_cache_filter_init(void)
 
 	filter = xzalloc(sizeof(struct nft_cache_filter));
 	memset(&filter->list, 0, sizeof(filter->list));
-	for (i = 0; i < NFT_CACHE_HSIZE; i++)
+	for (i = 0; i < NFT_CACHE_HSIZE; i++) {
 		init_list_head(&filter->obj[i].head);
+		init_list_head(&filter->set[i].head);
+	}
 
 	return filter;
 }
@@ -127,6 +132,8 @@ void nft_cache_filter_fini(struct nft_cache_filter *filter)
 
 		list_for_each_entry_safe(obj, next, &filter->obj[i].head, list)
 			free(obj);
+		list_for_each_entry_safe(obj, next, &filter->set[i].head, list)
+			free(obj);
 	}
 	free(filter);
 }
@@ -164,6 +171,78 @@ static bool cache_filter_find(const struct nft_cache_filter *filter,
 	return false;
 }
 
+/* Element updates only fetch the kernel intervals around the elements they
+ * add or delete, see setelem_evaluate(). This does not work if the set is
+ * updated by more than one command in this batch, since the elements that
+ * were fetched for the first one are already modified when evaluating the
+ * next one. Count the commands that refer to each set to find out.
+ */
+static unsigned int cache_filter_set_count(struct nft_cache_filter *filter,
+					   uint32_t family, const char *table,
+					   const char *set)
+{
+	struct nft_filter_obj *obj;
+	uint32_t hash;
+
+	hash = djb_hash(set) % NFT_CACHE_HSIZE;
+
+	list_for_each_entry(obj, &filter->set[hash].head, list) {
+		if (obj->family == family &&
+		    !strcmp(obj->table, table) &&
+		    !strcmp(obj->set, set))
+			return ++obj->num_cmds;
+	}
+
+	obj = xmalloc(sizeof(struct nft_filter_obj));
+	obj->family = family;
+	obj->table = table;
+	obj->set = set;
+	obj->num_cmds = 1;
+	list_add_tail(&obj->list, &filter->set[hash].head);
+
+	return obj->num_cmds;
+}
+
+static bool cache_filter_set_shared(struct nft_cache_filter *filter,
+				    const struct cmd *cmd)
+{
+	const struct set *set;
+	bool shared = false;
+
+	if (!cmd->handle.table.name)
+		return false;
+
+	switch (cmd->obj) {
+	case CMD_OBJ_TABLE:
+		if (!cmd->table)
+			break;
+
+		list_for_each_entry(set, &cmd->table->sets, list) {
+			if (cache_filter_set_count(filter, cmd->handle.family,
+						   cmd->handle.table.name,
+						   set->handle.set.name) > 1)
+				shared = true;
+		}
+		break;
+	case CMD_OBJ_SET:
+	case CMD_OBJ_MAP:
+	case CMD_OBJ_METER:
+	case CMD_OBJ_ELEMENTS:
+		if (!cmd->handle.set.name)
+			break;
+
+		if (cache_filter_set_count(filter, cmd->handle.family,
+					   cmd->handle.table.name,
+					   cmd->handle.set.name) > 1)
+			shared = true;
+		break;
+	default:
+		break;
+	}
+
+	return shared;
+}
+
 static unsigned int evaluate_cache_flush(struct cmd *cmd, unsigned int flags,
 					 struct nft_cache_filter *filter)
 {
@@ -412,12 +491,16 @@ int nft_cache_evaluate(struct nft_ctx *nft, struct list_head *cmds,
 		       unsigned int *pflags)
 {
 	unsigned int flags = NFT_CACHE_EMPTY;
+	bool shared = false;
 	struct cmd *cmd;
 
 	list_for_each_entry(cmd, cmds, list) {
 		if (nft_handle_validate(cmd, msgs) < 0)
 			return -1;
 
+		if (cache_filter_set_shared(filter, cmd))
+			shared = true;
+
 		if (filter->list.table && cmd->op != CMD_LIST)
 			memset(&filter->list, 0, sizeof(filter->list));
 
@@ -468,6 +551,9 @@ int nft_cache_evaluate(struct nft_ctx *nft, struct list_head *cmds,
 			break;
 		}
 	}
+	if (shared && flags & NFT_CACHE_SETELEM_NEIGH)
+		flags |= NFT_CACHE_SETELEM_MAYBE;
+
 	*pflags = flags;
 
 	return 0;
@@ -622,21 +708,28 @@ struct chain *chain_cache_find(const struct table *table, const char *name)
 	return NULL;
 }
 
-static int list_rule_cb(struct nftnl_rule *nlr, void *data)
+static bool rule_cache_match(const struct handle *h,
+			     const struct nftnl_rule *nlr)
 {
-	struct netlink_ctx *ctx = data;
-	const struct handle *h = ctx->data;
 	const char *table, *chain;
-	struct rule *rule;
 	uint32_t family;
 
 	family = nftnl_rule_get_u32(nlr, NFTNL_RULE_FAMILY);
 	table  = nftnl_rule_get_str(nlr, NFTNL_RULE_TABLE);
 	chain  = nftnl_rule_get_str(nlr, NFTNL_RULE_CHAIN);
 
-	if ((h->family != NFPROTO_UNSPEC && h->family != family) ||
-	    (h->table.name && strcmp(table, h->table.name) != 0) ||
-	    (h->chain.name && strcmp(chain, h->chain.name) != 0))
+	return (h->family == NFPROTO_UNSPEC || h->family == family) &&
+	       (!h->table.name || !strcmp(table, h->table.name)) &&
+	       (!h->chain.name || !strcmp(chain, h->chain.name));
+}
+
+static int list_rule_cb(struct nftnl_rule *nlr, void *data)
+{
+	struct netlink_ctx *ctx = data;
+	const struct handle *h = ctx->data;
+	struct rule *rule;
+
+	if (!rule_cache_match(h, nlr))
 		return 0;
 
 	netlink_dump_rule(nlr, ctx);
@@ -647,6 +740,137 @@ static int list_rule_cb(struct nftnl_rule *nlr, void *data)
 	return 0;
 }
 
+/* Number of extra threads to delinearize rules with, see
+ * NFT_CTX_CACHE_PARALLEL.
+ */
+#define NFT_CACHE_RULE_WORKERS	3
+/* Rules per thread below which a thread costs more than it saves. */
+#define NFT_CACHE_RULE_BATCH	64
+
+struct rule_cache_job {
+	struct nftnl_rule	*nlr;
+	struct rule		*rule;
+	struct list_head	msgs;
+};
+
+struct rule_cache_pool {
+	pthread_mutex_t		lock;
+	struct netlink_ctx	*ctx;
+	const struct handle	*h;
+	struct rule_cache_job	*jobs;
+	unsigned int		num_jobs;
+	unsigned int		size;
+	unsigned int		next;
+};
+
+static int rule_cache_job_add(struct nftnl_rule *nlr, void *data)
+{
+	struct rule_cache_pool *pool = data;
+	struct rule_cache_job *job;
+
+	if (!rule_cache_match(pool->h, nlr))
+		return 0;
+
+	netlink_dump_rule(nlr, pool->ctx);
+
+	if (pool->num_jobs == pool->size) {
+		pool->size = pool->size ? pool->size * 2 : 256;
+		pool->jobs = xrealloc(pool->jobs,
+				      pool->size * sizeof(*pool->jobs));
+	}
+	job = &pool->jobs[pool->num_jobs++];
+	job->nlr = nlr;
+	job->rule = NULL;
+	init_list_head(&job->msgs);
+
+	return 0;
+}
+
+static void *rule_cache_worker(void *arg)
+{
+	struct rule_cache_pool *pool = arg;
+	struct rule_cache_job *job;
+	struct netlink_ctx ctx = {
+		.nft	= pool->ctx->nft,
+		.seqnum	= pool->ctx->seqnum,
+	};
+
+	init_list_head(&ctx.list);
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		job = pool->next < pool->num_jobs ? &pool->jobs[pool->next++] :
+						    NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (!job)
+			break;
+
+		/* errors are queued per rule, then reported in dump order. */
+		ctx.msgs = &job->msgs;
+		job->rule = netlink_delinearize_rule(&ctx, job->nlr);
+	}
+
+	return NULL;
+}
+
+/* Rules are independent from each other once the table, chain, set and object
+ * caches are populated: delinearization only reads them, except for the set
+ * and datatype reference counters and the table has_xt_stmts flag, which are
+ * updated atomically. Rules are parsed by a few threads and added to
+ * @ctx->list in dump order. Chains are expected to be in the cache already,
+ * since a missing chain binding would be fetched from the kernel while
+ * parsing.
+ */
+static void rule_cache_delinearize(struct netlink_ctx *ctx,
+				   const struct handle *h,
+				   struct nftnl_rule_list *rule_cache)
+{
+	struct rule_cache_pool pool = {
+		.lock	= PTHREAD_MUTEX_INITIALIZER,
+		.ctx	= ctx,
+		.h	= h,
+	};
+	pthread_t workers[NFT_CACHE_RULE_WORKERS];
+	unsigned int i, num_workers = 0;
+	struct rule_cache_job *job;
+
+	nftnl_rule_list_foreach(rule_cache, rule_cache_job_add, &pool);
+
+	for (i = 0; i < NFT_CACHE_RULE_WORKERS &&
+		    (i + 1) * NFT_CACHE_RULE_BATCH < pool.num_jobs; i++) {
+		if (pthread_create(&workers[num_workers], NULL,
+				   rule_cache_worker, &pool))
+			break;
+		num_workers++;
+	}
+	rule_cache_worker(&pool);
+
+	for (i = 0; i < num_workers; i++)
+		pthread_join(workers[i], NULL);
+
+	for (i = 0; i < pool.num_jobs; i++) {
+		job = &pool.jobs[i];
+		list_splice_tail(&job->msgs, ctx->msgs);
+		assert(job->rule);
+		list_add_tail(&job->rule->list, &ctx->list);
+	}
+	free(pool.jobs);
+}
+
+static void rule_cache_init(struct netlink_ctx *ctx, const struct handle *h,
+			    struct nftnl_rule_list *rule_cache, bool parallel)
+{
+	/* keep debugging output in order. */
+	if (parallel && ctx->nft->cache.mode & NFT_CTX_CACHE_PARALLEL &&
+	    !ctx->nft->debug_mask) {
+		rule_cache_delinearize(ctx, h, rule_cache);
+		return;
+	}
+
+	ctx->data = h;
+	nftnl_rule_list_foreach(rule_cache, list_rule_cb, ctx);
+}
+
 int rule_cache_dump(struct netlink_ctx *ctx, const struct handle *h,
 		    const struct nft_cache_filter *filter,
 		    bool dump, bool reset)
@@ -661,6 +885,9 @@ int rule_cache_dump(struct netlink_ctx *ctx, const struct handle *h,
 		chain = filter->list.chain;
 		rule_handle = filter->list.rule_handle;
 	}
+	/* do not dump rules of every table just to keep those in @h. */
+	if (!table)
+		table = h->table.name;
 
 	rule_cache = mnl_nft_rule_dump(ctx, h->family,
 				       table, chain, rule_handle, dump, reset);
@@ -671,8 +898,8 @@ int rule_cache_dump(struct netlink_ctx *ctx, const struct handle *h,
 		return 0;
 	}
 
-	ctx->data = h;
-	nftnl_rule_list_foreach(rule_cache, list_rule_cb, ctx);
+	/* 'list chain' may pull in chain bindings while parsing. */
+	rule_cache_init(ctx, h, rule_cache, !chain);
 	nftnl_rule_list_free(rule_cache);
 	return 0;
 }
@@ -988,14 +1215,11 @@ static int cache_init_tables(struct netlink_ctx *ctx, struct handle *h,
 	return 0;
 }
 
-static int rule_init_cache(struct netlink_ctx *ctx, struct table *table,
-			   const struct nft_cache_filter *filter)
+/* Move rules in ctx->list to their chains in @table. */
+static int rule_cache_move(struct netlink_ctx *ctx, struct table *table)
 {
 	struct rule *rule, *nrule;
 	struct chain *chain;
-	int ret;
-
-	ret = rule_cache_dump(ctx, &table->handle, filter, true, false);
 
 	list_for_each_entry_safe(rule, nrule, &ctx->list, list) {
 		chain = chain_cache_find(table, rule->handle.chain.name);
@@ -1005,10 +1229,11 @@ static int rule_init_cache(struct netlink_ctx *ctx, struct table *table,
 		if (!chain)
 			goto err_ctx_list;
 
-		list_move_tail(&rule->list, &chain->rules);
+		list_del(&rule->list);
+		chain_rule_add_tail(chain, rule, &chain->rules);
 	}
 
-	return ret;
+	return 0;
 
 err_ctx_list:
 	list_for_each_entry_safe(rule, nrule, &ctx->list, list) {
@@ -1020,6 +1245,18 @@ err_ctx_list:
 	return -1;
 }
 
+static int rule_init_cache(struct netlink_ctx *ctx, struct table *table,
+			   const struct nft_cache_filter *filter)
+{
+	int ret;
+
+	ret = rule_cache_dump(ctx, &table->handle, filter, true, false);
+	if (rule_cache_move(ctx, table) < 0)
+		return -1;
+
+	return ret;
+}
+
 static int implicit_chain_cache(struct netlink_ctx *ctx, struct table *table,
 				const char *chain_name)
 {
@@ -1038,106 +1275,270 @@ static int implicit_chain_cache(struct netlink_ctx *ctx, struct table *table,
 	return ret;
 }
 
-static int cache_init_objects(struct netlink_ctx *ctx, unsigned int flags,
-			      const struct nft_cache_filter *filter)
+static bool cache_needs_setelems(struct set *set, unsigned int flags)
+{
+	if (flags & NFT_CACHE_SETELEM_BIT)
+		return set_is_anonymous(set->flags) ||
+		       !(flags & NFT_CACHE_TERSE);
+	if (flags & NFT_CACHE_SETELEM_MAYBE)
+		return set_is_non_concat_range(set);
+
+	return false;
+}
+
+static int cache_init_table_objects(struct netlink_ctx *ctx,
+				    struct table *table, unsigned int flags,
+				    const struct nft_cache_filter *filter,
+				    struct nftnl_chain_list *chain_list,
+				    struct nftnl_set_list *set_list,
+				    struct nftnl_flowtable_list *ft_list)
 {
-	struct nftnl_flowtable_list *ft_list = NULL;
-	struct nftnl_chain_list *chain_list = NULL;
-	struct nftnl_set_list *set_list = NULL;
 	struct nftnl_obj_list *obj_list;
-	struct table *table;
 	struct set *set;
-	int ret = 0;
+	int ret;
 
+	if (flags & NFT_CACHE_SET_BIT) {
+		ret = set_cache_init(ctx, table, set_list);
+		if (ret < 0)
+			return ret;
+	}
+	list_for_each_entry(set, &table->set_cache.list, cache.list) {
+		if (cache_filter_find(filter, &set->handle))
+			continue;
+		if (!cache_needs_setelems(set, flags))
+			continue;
+
+		ret = netlink_list_setelems(ctx, &set->handle, set, false);
+		if (ret < 0)
+			return ret;
+	}
 	if (flags & NFT_CACHE_CHAIN_BIT) {
-		chain_list = chain_cache_dump(ctx, filter, &ret);
-		if (!chain_list)
+		ret = chain_cache_init(ctx, table, chain_list);
+		if (ret < 0)
+			return ret;
+	}
+	if (flags & NFT_CACHE_FLOWTABLE_BIT) {
+		ret = ft_cache_init(ctx, table, ft_list);
+		if (ret < 0)
+			return ret;
+	}
+	if (flags & NFT_CACHE_OBJECT_BIT) {
+		obj_list = obj_cache_dump(ctx, table);
+		if (!obj_list)
 			return -1;
+
+		ret = obj_cache_init(ctx, table, obj_list);
+
+		nftnl_obj_list_free(obj_list);
+
+		if (ret < 0)
+			return ret;
 	}
-	if (flags & NFT_CACHE_SET_BIT) {
-		set_list = set_cache_dump(ctx, filter, &ret);
-		if (!set_list) {
-			ret = -1;
-			goto cache_fails;
+
+	if (flags & NFT_CACHE_RULE_BIT) {
+		ret = rule_init_cache(ctx, table, filter);
+		if (ret < 0)
+			return ret;
+
+		if (filter && filter->list.table && filter->list.chain) {
+			ret = implicit_chain_cache(ctx, table, filter->list.chain);
+			if (ret < 0)
+				return ret;
 		}
 	}
-	if (flags & NFT_CACHE_FLOWTABLE_BIT) {
-		ft_list = ft_cache_dump(ctx, filter);
-		if (!ft_list) {
-			ret = -1;
-			goto cache_fails;
-		}
+
+	return 0;
+}
+
+/* Number of extra sockets to fetch per-table objects with, see
+ * NFT_CTX_CACHE_PARALLEL.
+ */
+#define NFT_CACHE_DUMP_WORKERS	3
+
+enum cache_dump_type {
+	CACHE_DUMP_SETELEM,
+	CACHE_DUMP_OBJ,
+	CACHE_DUMP_RULE,
+};
+
+struct cache_dump_job {
+	struct list_head	list;
+	enum cache_dump_type	type;
+	struct table		*table;
+	struct set		*set;
+	struct mnl_dump		*dump;
+};
+
+static void cache_dump_job_add(struct list_head *jobs,
+			       enum cache_dump_type type, struct table *table,
+			       struct set *set, struct mnl_dump *dump)
+{
+	struct cache_dump_job *job;
+
+	job = xzalloc(sizeof(*job));
+	job->type = type;
+	job->table = table;
+	job->set = set;
+	job->dump = dump;
+	list_add_tail(&job->list, jobs);
+}
+
+static int cache_dump_job_init(struct netlink_ctx *ctx,
+			       struct cache_dump_job *job)
+{
+	struct mnl_dump *dump = job->dump;
+
+	/* like the sequential fetch, leave out objects that failed to dump. */
+	if (dump->err)
+		return 0;
+
+	switch (job->type) {
+	case CACHE_DUMP_SETELEM:
+		netlink_setelems_init(ctx, job->set, dump->data);
+		break;
+	case CACHE_DUMP_OBJ:
+		return obj_cache_init(ctx, job->table, dump->data);
+	case CACHE_DUMP_RULE:
+		rule_cache_init(ctx, &job->table->handle, dump->data, true);
+		return rule_cache_move(ctx, job->table);
 	}
 
+	return 0;
+}
+
+/* Same as calling cache_init_table_objects() on every table, except that set
+ * elements, objects and rules of all tables are dumped at once through
+ * mnl_nft_dump_run().
+ */
+static int cache_init_objects_parallel(struct netlink_ctx *ctx,
+				       unsigned int flags,
+				       const struct nft_cache_filter *filter,
+				       struct nftnl_chain_list *chain_list,
+				       struct nftnl_set_list *set_list,
+				       struct nftnl_flowtable_list *ft_list)
+{
+	struct cache_dump_job *job, *next;
+	struct nftnl_set *nls;
+	struct mnl_dump *dump;
+	struct table *table;
+	LIST_HEAD(dumps);
+	LIST_HEAD(jobs);
+	struct set *set;
+	int ret = 0;
+
 	list_for_each_entry(table, &ctx->nft->cache.table_cache.list, cache.list) {
 		if (flags & NFT_CACHE_SET_BIT) {
 			ret = set_cache_init(ctx, table, set_list);
 			if (ret < 0)
-				goto cache_fails;
+				goto err;
 		}
-		if (flags & NFT_CACHE_SETELEM_BIT) {
-			list_for_each_entry(set, &table->set_cache.list, cache.list) {
-				if (cache_filter_find(filter, &set->handle))
-					continue;
-				if (!set_is_anonymous(set->flags) &&
-				    flags & NFT_CACHE_TERSE)
-					continue;
-
-				ret = netlink_list_setelems(ctx, &set->handle,
-							    set, false);
-				if (ret < 0)
-					goto cache_fails;
-			}
-		} else if (flags & NFT_CACHE_SETELEM_MAYBE) {
-			list_for_each_entry(set, &table->set_cache.list, cache.list) {
-				if (cache_filter_find(filter, &set->handle))
-					continue;
-
-				if (!set_is_non_concat_range(set))
-					continue;
-
-				ret = netlink_list_setelems(ctx, &set->handle,
-							    set, false);
-				if (ret < 0)
-					goto cache_fails;
-			}
+		list_for_each_entry(set, &table->set_cache.list, cache.list) {
+			if (cache_filter_find(filter, &set->handle))
+				continue;
+			if (!cache_needs_setelems(set, flags))
+				continue;
+
+			nls = netlink_setelems_alloc(&set->handle);
+			dump = mnl_nft_setelem_dump_add(&dumps, ctx->seqnum,
+							 nls);
+			cache_dump_job_add(&jobs, CACHE_DUMP_SETELEM, table,
+					   set, dump);
 		}
 		if (flags & NFT_CACHE_CHAIN_BIT) {
 			ret = chain_cache_init(ctx, table, chain_list);
 			if (ret < 0)
-				goto cache_fails;
+				goto err;
 		}
 		if (flags & NFT_CACHE_FLOWTABLE_BIT) {
 			ret = ft_cache_init(ctx, table, ft_list);
 			if (ret < 0)
-				goto cache_fails;
+				goto err;
 		}
 		if (flags & NFT_CACHE_OBJECT_BIT) {
-			obj_list = obj_cache_dump(ctx, table);
-			if (!obj_list) {
-				ret = -1;
-				goto cache_fails;
-			}
-			ret = obj_cache_init(ctx, table, obj_list);
+			dump = mnl_nft_obj_dump_add(&dumps, ctx->seqnum,
+						    table->handle.family,
+						    table->handle.table.name);
+			cache_dump_job_add(&jobs, CACHE_DUMP_OBJ, table,
+					   NULL, dump);
+		}
+		if (flags & NFT_CACHE_RULE_BIT) {
+			dump = mnl_nft_rule_dump_add(&dumps, ctx->seqnum,
+						     table->handle.family,
+						     table->handle.table.name);
+			cache_dump_job_add(&jobs, CACHE_DUMP_RULE, table,
+					   NULL, dump);
+		}
+	}
 
-			nftnl_obj_list_free(obj_list);
+	ret = mnl_nft_dump_run(ctx, &dumps, NFT_CACHE_DUMP_WORKERS);
+	if (ret < 0)
+		goto err;
 
-			if (ret < 0)
-				goto cache_fails;
-		}
+	list_for_each_entry(job, &jobs, list) {
+		ret = cache_dump_job_init(ctx, job);
+		if (ret < 0)
+			break;
+	}
+err:
+	list_for_each_entry_safe(job, next, &jobs, list) {
+		list_del(&job->list);
+		free(job);
+	}
+	mnl_nft_dump_free(&dumps);
 
-		if (flags & NFT_CACHE_RULE_BIT) {
-			ret = rule_init_cache(ctx, table, filter);
-			if (ret < 0)
-				goto cache_fails;
+	return ret;
+}
 
-			if (filter && filter->list.table && filter->list.chain) {
-				ret = implicit_chain_cache(ctx, table, filter->list.chain);
-				if (ret < 0)
-					goto cache_fails;
-			}
+/* Populate objects of @table, or of all tables in the cache if NULL. */
+static int cache_init_objects(struct netlink_ctx *ctx, unsigned int flags,
+			      const struct nft_cache_filter *filter,
+			      struct table *table)
+{
+	struct nftnl_flowtable_list *ft_list = NULL;
+	struct nftnl_chain_list *chain_list = NULL;
+	struct nftnl_set_list *set_list = NULL;
+	int ret = 0;
+
+	if (flags & NFT_CACHE_CHAIN_BIT) {
+		chain_list = chain_cache_dump(ctx, filter, &ret);
+		if (!chain_list)
+			return -1;
+	}
+	if (flags & NFT_CACHE_SET_BIT) {
+		set_list = set_cache_dump(ctx, filter, &ret);
+		if (!set_list) {
+			ret = -1;
+			goto cache_fails;
 		}
 	}
+	if (flags & NFT_CACHE_FLOWTABLE_BIT) {
+		ft_list = ft_cache_dump(ctx, filter);
+		if (!ft_list) {
+			ret = -1;
+			goto cache_fails;
+		}
+	}
+
+	if (table) {
+		ret = cache_init_table_objects(ctx, table, flags, filter,
+					       chain_list, set_list, ft_list);
+		goto cache_fails;
+	}
+
+	if (ctx->nft->cache.mode & NFT_CTX_CACHE_PARALLEL &&
+	    (!filter || !filter->list.table)) {
+		ret = cache_init_objects_parallel(ctx, flags, filter,
+						  chain_list, set_list,
+						  ft_list);
+		goto cache_fails;
+	}
+
+	list_for_each_entry(table, &ctx->nft->cache.table_cache.list, cache.list) {
+		ret = cache_init_table_objects(ctx, table, flags, filter,
+					       chain_list, set_list, ft_list);
+		if (ret < 0)
+			goto cache_fails;
+	}
 
 cache_fails:
 	if (set_list)
@@ -1166,7 +1567,7 @@ static int nft_cache_init(struct netlink_ctx *ctx, unsigned int flags,
 	ret = cache_init_tables(ctx, &handle, &ctx->nft->cache, filter);
 	if (ret < 0)
 		return ret;
-	ret = cache_init_objects(ctx, flags, filter);
+	ret = cache_init_objects(ctx, flags, filter, NULL);
 	if (ret < 0)
 		return ret;
 
@@ -1194,6 +1595,201 @@ bool nft_cache_needs_update(struct nft_cache *cache)
 	return cache->flags & NFT_CACHE_UPDATE;
 }
 
+/* Fetch @table again from the kernel, it might be gone already. */
+static int cache_refresh_table(struct netlink_ctx *ctx, struct table *table,
+			       unsigned int flags)
+{
+	struct nft_cache *cache = &ctx->nft->cache;
+	struct nft_cache_filter *filter;
+	struct handle handle = {
+		.family = table->handle.family,
+	};
+	struct table *new;
+	int ret;
+
+	filter = nft_cache_filter_init();
+	filter->list.family = table->handle.family;
+	filter->list.table = table->handle.table.name;
+
+	table_cache_del(table);
+
+	ret = cache_init_tables(ctx, &handle, cache, filter);
+	if (ret < 0) {
+		if (errno == ENOENT)
+			ret = 0;
+		goto out;
+	}
+
+	new = table_cache_find(&cache->table_cache, table->handle.table.name,
+			       table->handle.family);
+	if (new)
+		ret = cache_init_objects(ctx, flags, filter, new);
+out:
+	table_free(table);
+	nft_cache_filter_fini(filter);
+
+	return ret;
+}
+
+static int cache_refresh_stale(struct netlink_ctx *ctx, unsigned int flags)
+{
+	struct nft_cache *cache = &ctx->nft->cache;
+	struct table *table, *next;
+	struct set *set;
+	int ret;
+
+	list_for_each_entry_safe(table, next, &cache->table_cache.list, cache.list) {
+		if (table->stale) {
+			ret = cache_refresh_table(ctx, table, flags);
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+
+		list_for_each_entry(set, &table->set_cache.list, cache.list) {
+			if (!set->stale)
+				continue;
+
+			/* partial content, e.g. neighbouring intervals, is
+			 * dropped too.
+			 */
+			set->stale = false;
+			expr_free(set->init);
+			set->init = NULL;
+			if (!cache_needs_setelems(set, flags))
+				continue;
+
+			ret = netlink_list_setelems(ctx, &set->handle, set, false);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+struct cache_event {
+	struct list_head	list;
+	struct nlmsghdr		*nlh;
+};
+
+struct cache_sync_ctx {
+	struct netlink_ctx	*nlctx;
+	struct list_head	events;
+	uint16_t		genid;
+	int			err;
+};
+
+static void cache_sync_events_free(struct list_head *events)
+{
+	struct cache_event *ev, *next;
+
+	list_for_each_entry_safe(ev, next, events, list) {
+		list_del(&ev->list);
+		free(ev->nlh);
+		free(ev);
+	}
+}
+
+static int cache_sync_apply(struct cache_sync_ctx *sctx)
+{
+	struct cache_event *ev;
+
+	list_for_each_entry(ev, &sctx->events, list) {
+		if (netlink_events_cache_sync(sctx->nlctx, ev->nlh) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Events are buffered until the NEWGEN notification that closes the
+ * transaction arrives. Generations up to the one the cache was built
+ * from are already reflected in the cache. A gap means events were lost.
+ */
+static int cache_sync_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct cache_sync_ctx *sctx = data;
+	struct cache_event *ev;
+	uint32_t genid;
+	int16_t delta;
+
+	if (NFNL_SUBSYS_ID(nlh->nlmsg_type) != NFNL_SUBSYS_NFTABLES)
+		return MNL_CB_OK;
+
+	if (NFNL_MSG_TYPE(nlh->nlmsg_type) != NFT_MSG_NEWGEN) {
+		ev = xmalloc(sizeof(*ev));
+		ev->nlh = xmalloc(nlh->nlmsg_len);
+		memcpy(ev->nlh, nlh, nlh->nlmsg_len);
+		list_add_tail(&ev->list, &sctx->events);
+		return MNL_CB_OK;
+	}
+
+	if (netlink_events_genid(nlh, &genid) < 0)
+		goto err;
+
+	delta = (uint16_t)genid - sctx->genid;
+	if (delta > 1)
+		goto err;
+
+	if (delta == 1) {
+		if (cache_sync_apply(sctx) < 0)
+			goto err;
+
+		sctx->genid = genid;
+	}
+	cache_sync_events_free(&sctx->events);
+
+	return MNL_CB_OK;
+err:
+	sctx->err = -1;
+	return MNL_CB_ERROR;
+}
+
+/* Bring the cache from its generation to @genid by applying ruleset
+ * notifications, then refetch whatever could not be updated in place.
+ */
+static int nft_cache_sync(struct netlink_ctx *ctx, struct nft_cache *cache,
+			  uint16_t genid)
+{
+	struct cache_sync_ctx sctx = {
+		.nlctx	= ctx,
+		.events	= LIST_HEAD_INIT(sctx.events),
+		.genid	= cache->genid,
+	};
+	int ret;
+
+	ret = mnl_nft_event_drain(cache->evsock, cache_sync_cb, &sctx);
+	if (ret < 0 || sctx.err < 0 || !list_empty(&sctx.events) ||
+	    sctx.genid != genid) {
+		cache_sync_events_free(&sctx.events);
+		return -1;
+	}
+
+	return cache_refresh_stale(ctx, cache->flags);
+}
+
+static void nft_cache_events_open(struct nft_cache *cache)
+{
+	if (!(cache->mode & NFT_CTX_CACHE_INCREMENTAL))
+		return;
+
+	if (!cache->evsock) {
+		cache->evsock = mnl_nft_event_socket_open();
+		return;
+	}
+
+	/* the cache is rebuilt from scratch, discard pending events. */
+	if (mnl_nft_event_drain(cache->evsock, NULL, NULL) < 0)
+		nft_cache_events_close(cache);
+}
+
+static bool nft_cache_can_sync(struct nft_cache *cache, unsigned int flags)
+{
+	return cache->evsock && cache->genid &&
+	       !(flags & NFT_CACHE_FLUSHED);
+}
+
 int nft_cache_update(struct nft_ctx *nft, unsigned int flags,
 		     struct list_head *msgs,
 		     const struct nft_cache_filter *filter)
@@ -1210,13 +1806,34 @@ replay:
 	ctx.seqnum = cache->seqnum++;
 	genid = mnl_genid_get(&ctx);
 	if (!nft_cache_needs_refresh(cache, flags) &&
-	    nft_cache_is_complete(cache, flags) &&
-	    nft_cache_is_updated(cache, genid))
-		return 0;
+	    nft_cache_is_complete(cache, flags)) {
+		/* commands that failed or were only checked leave stale
+		 * objects behind without bumping the generation.
+		 */
+		if (nft_cache_is_updated(cache, genid))
+			ret = cache_refresh_stale(&ctx, cache->flags);
+		else if (nft_cache_can_sync(cache, flags))
+			ret = nft_cache_sync(&ctx, cache, genid);
+		else
+			ret = -1;
+
+		/* objects that were fetched again might already reflect a
+		 * later generation, the cache is then built from scratch.
+		 */
+		if (ret == 0) {
+			genid_stop = mnl_genid_get(&ctx);
+			if (genid == genid_stop) {
+				cache->genid = genid;
+				return 0;
+			}
+		}
+	}
 
 	if (cache->genid)
 		nft_cache_release(cache);
 
+	nft_cache_events_open(cache);
+
 	if (flags & NFT_CACHE_FLUSHED) {
 		oldflags = flags;
 		flags = NFT_CACHE_EMPTY;
@@ -1268,6 +1885,76 @@ void nft_cache_release(struct nft_cache *cache)
 	cache->flags = NFT_CACHE_EMPTY;
 }
 
+void nft_cache_events_close(struct nft_cache *cache)
+{
+	if (!cache->evsock)
+		return;
+
+	mnl_socket_close(cache->evsock);
+	cache->evsock = NULL;
+}
+
+static bool cache_cmd_is_update(const struct cmd *cmd)
+{
+	switch (cmd->op) {
+	case CMD_ADD:
+	case CMD_REPLACE:
+	case CMD_CREATE:
+	case CMD_INSERT:
+	case CMD_DELETE:
+	case CMD_DESTROY:
+	case CMD_GET:
+	case CMD_RESET:
+	case CMD_FLUSH:
+	case CMD_RENAME:
+	case CMD_IMPORT:
+		return true;
+	default:
+		break;
+	}
+
+	return false;
+}
+
+/* Commands modify the cache while being evaluated, mark the tables they
+ * refer to so their content is fetched again on the next cache update.
+ * Element commands only modify their set.
+ */
+void nft_cache_mark_stale(struct nft_cache *cache, const struct list_head *cmds)
+{
+	const struct cmd *cmd;
+	struct table *table;
+	struct set *set;
+
+	if (!(cache->mode & NFT_CTX_CACHE_INCREMENTAL) || !cache->genid)
+		return;
+
+	list_for_each_entry(cmd, cmds, list) {
+		if (!cache_cmd_is_update(cmd))
+			continue;
+
+		if (cmd->obj == CMD_OBJ_RULESET || !cmd->handle.table.name) {
+			nft_cache_release(cache);
+			return;
+		}
+
+		table = table_cache_find(&cache->table_cache,
+					 cmd->handle.table.name,
+					 cmd->handle.family);
+		if (!table)
+			continue;
+
+		if (cmd->obj == CMD_OBJ_ELEMENTS && cmd->handle.set.name) {
+			set = set_cache_find(table, cmd->handle.set.name);
+			if (set) {
+				set->stale = true;
+				continue;
+			}
+		}
+		table->stale = true;
+	}
+}
+
 void cache_init(struct cache *cache)
 {
 	int i;
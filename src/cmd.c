@@ -17,14 +17,20 @@
 #include <errno.h>
 #include <cache.h>
 
-void cmd_add_loc(struct cmd *cmd, uint16_t offset, const struct location *loc)
+void cmd_add_loc(struct cmd *cmd, const struct nlmsghdr *nlh,
+		 const struct location *loc)
 {
 	if (cmd->num_attrs >= cmd->attr_array_len) {
-		cmd->attr_array_len *= 2;
+		if (cmd->attr_array_len)
+			cmd->attr_array_len *= 2;
+		else
+			cmd->attr_array_len = NFT_NLATTR_LOC_MAX;
+
 		cmd->attr = xrealloc(cmd->attr, sizeof(struct nlerr_loc) * cmd->attr_array_len);
 	}
 
-	cmd->attr[cmd->num_attrs].offset = offset;
+	cmd->attr[cmd->num_attrs].seqnum = nlh->nlmsg_seq;
+	cmd->attr[cmd->num_attrs].offset = nlh->nlmsg_len;
 	cmd->attr[cmd->num_attrs].location = loc;
 	cmd->num_attrs++;
 }
@@ -293,16 +299,42 @@ static int nft_cmd_chain_error(struct netlink_ctx *ctx, struct cmd *cmd,
 	return 0;
 }
 
+static const struct location *nft_cmd_elem_loc(const struct cmd *cmd,
+					       uint32_t i,
+					       struct location *loc)
+{
+	const struct nlerr_elem_loc *elem_loc = &cmd->elem_loc[i];
+
+	if (!elem_loc->line)
+		return &cmd->location;
+
+	*loc = cmd->location;
+	loc->line_offset = elem_loc->line_offset;
+	loc->first_line = elem_loc->line;
+	loc->last_line = elem_loc->line;
+	loc->first_column = elem_loc->first_column;
+	loc->last_column = elem_loc->last_column;
+
+	return loc;
+}
+
 void nft_cmd_error(struct netlink_ctx *ctx, struct cmd *cmd,
 		   struct mnl_err *err)
 {
 	const struct location *loc = NULL;
+	struct location elem_loc;
 	uint32_t i;
 
 	for (i = 0; i < cmd->num_attrs; i++) {
 		if (!cmd->attr[i].offset)
 			break;
-		if (cmd->attr[i].offset == err->offset)
+		if (cmd->attr[i].seqnum != err->seqnum ||
+		    cmd->attr[i].offset != err->offset)
+			continue;
+
+		if (cmd->elem_loc)
+			loc = nft_cmd_elem_loc(cmd, i, &elem_loc);
+		else
 			loc = cmd->attr[i].location;
 	}
 
@@ -341,7 +373,7 @@ static void nft_cmd_expand_chain(struct chain *chain, struct list_head *new_cmds
 	struct cmd *new;
 
 	list_for_each_entry_safe(rule, next, &chain->rules, list) {
-		list_del(&rule->list);
+		chain_rule_del(chain, rule);
 		handle_merge(&rule->handle, &chain->handle);
 		memset(&h, 0, sizeof(h));
 		handle_merge(&h, &chain->handle);
@@ -487,6 +519,94 @@ bool nft_cmd_collapse(struct list_head *cmds)
 	return collapse;
 }
 
+static bool nft_cmd_elems_mergeable(const struct cmd *elems,
+				    const struct cmd *cmd)
+{
+	if ((cmd->op != CMD_ADD && cmd->op != CMD_CREATE) ||
+	    cmd->obj != CMD_OBJ_ELEMENTS ||
+	    cmd->expr->etype != EXPR_SET)
+		return false;
+
+	return elems->op == cmd->op &&
+	       elems->obj == cmd->obj &&
+	       elems->expr->etype == EXPR_SET &&
+	       list_empty(&elems->collapse_list) &&
+	       elems->handle.family == cmd->handle.family &&
+	       !strcmp(elems->handle.table.name, cmd->handle.table.name) &&
+	       !strcmp(elems->handle.set.name, cmd->handle.set.name);
+}
+
+/* Add a parsed command to the list. Elements added to the same set as the
+ * previous command are merged into it right away, so files with one command
+ * per element do not keep a command object per line. Elements keep their
+ * own location for error reporting. With echo, commands are not merged
+ * since the kernel reports one notification per command.
+ */
+void nft_cmd_append(struct nft_ctx *nft, struct list_head *cmds,
+		    struct cmd *cmd)
+{
+	struct expr *expr, *next;
+	struct cmd *elems;
+
+	if (list_empty(cmds) || nft_output_echo(&nft->output))
+		goto add;
+
+	elems = list_entry(cmds->prev, struct cmd, list);
+	if (!nft_cmd_elems_mergeable(elems, cmd))
+		goto add;
+
+	list_for_each_entry_safe(expr, next, &cmd->expr->expressions, list)
+		list_move_tail(&expr->list, &elems->expr->expressions);
+
+	elems->expr->size += cmd->expr->size;
+	cmd->expr->size = 0;
+	cmd_free(cmd);
+	cmd = elems;
+	goto stream;
+add:
+	list_add_tail(&cmd->list, cmds);
+stream:
+	if (cmd->obj == CMD_OBJ_ELEMENTS &&
+	    cmd->expr->etype == EXPR_SET &&
+	    cmd->expr->size > NFT_STREAM_ELEMS)
+		nft_stream_cmds(nft, cmds);
+}
+
+/* Element commands that are already in the batch while the input is still
+ * being parsed release their elements, see nft_stream_cmds(). Only the
+ * position of each element is kept to report errors from the kernel.
+ */
+void nft_cmd_release_elems(struct cmd *cmd)
+{
+	const struct location *loc;
+	uint32_t i;
+
+	if (cmd->num_attrs) {
+		cmd->attr = xrealloc(cmd->attr,
+				     cmd->num_attrs * sizeof(*cmd->attr));
+		cmd->attr_array_len = cmd->num_attrs;
+		cmd->elem_loc = xzalloc_array(cmd->num_attrs,
+					      sizeof(*cmd->elem_loc));
+	}
+
+	for (i = 0; i < cmd->num_attrs; i++) {
+		loc = cmd->attr[i].location;
+		cmd->attr[i].location = NULL;
+
+		if (!loc || loc->indesc != cmd->location.indesc ||
+		    loc->first_line != loc->last_line)
+			continue;
+
+		cmd->elem_loc[i].line_offset = loc->line_offset;
+		cmd->elem_loc[i].line = loc->first_line;
+		cmd->elem_loc[i].first_column = min(loc->first_column, UINT16_MAX);
+		cmd->elem_loc[i].last_column = min(loc->last_column, UINT16_MAX);
+	}
+
+	expr_free(cmd->expr);
+	cmd->expr = set_expr_alloc(&cmd->location, NULL);
+}
+
 void nft_cmd_uncollapse(struct list_head *cmds)
 {
 	struct cmd *cmd, *cmd_next, *collapse_cmd, *collapse_cmd_next;
@@ -148,12 +148,9 @@ const char *ct_label2str(const struct symbol_table *ct_label_tbl,
 {
 	const struct symbolic_constant *s;
 
-	for (s = ct_label_tbl->symbols; s->identifier; s++) {
-		if (value == s->value)
-			return s->identifier;
-	}
+	s = symbol_table_lookup_value(ct_label_tbl, value);
 
-	return NULL;
+	return s ? s->identifier : NULL;
 }
 
 static void ct_label_type_print(const struct expr *expr,
@@ -180,13 +177,10 @@ static struct error_record *ct_label_type_parse(struct parse_ctx *ctx,
 	uint64_t bit;
 	mpz_t value;
 
-	for (s = ctx->tbl->ct_label->symbols; s->identifier != NULL; s++) {
-		if (!strcmp(sym->identifier, s->identifier))
-			break;
-	}
+	s = symbol_table_lookup(ctx->tbl->ct_label, sym->identifier);
 
 	dtype = sym->dtype;
-	if (s->identifier == NULL) {
+	if (s == NULL) {
 		char *ptr;
 
 		errno = 0;
@@ -29,6 +29,8 @@
 #include <netlink.h>
 #include <json.h>
 #include <misspell.h>
+#include <cache.h>
+#include <resolve.h>
 #include "nftutils.h"
 
 #include <netinet/ip_icmp.h>
@@ -189,6 +191,113 @@ static struct error_record *symbol_parse_fuzzy(const struct expr *sym,
 	return NULL;
 }
 
+/* Open addressing tables, each slot holds the position of a symbol plus one.
+ * Name slots come first, then value slots. Only the first symbol of a given
+ * name or value is indexed, as the linear walk would find.
+ */
+struct symbol_table_index {
+	uint32_t			mask;
+	uint32_t			slots[];
+};
+
+static uint32_t symbol_value_hash(uint64_t value)
+{
+	return (value * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static void symbol_table_index_build(struct symbol_table *tbl,
+				     unsigned int nelems)
+{
+	struct symbol_table_index *index;
+	uint32_t i, hsize = 1, pos, *slot;
+
+	while (hsize < nelems * 2)
+		hsize <<= 1;
+
+	index = xzalloc(sizeof(*index) + 2 * hsize * sizeof(uint32_t));
+	index->mask = hsize - 1;
+
+	for (i = 0; i < nelems; i++) {
+		pos = djb_hash(tbl->symbols[i].identifier);
+		for (;; pos++) {
+			slot = &index->slots[pos & index->mask];
+			if (!*slot) {
+				*slot = i + 1;
+				break;
+			}
+			if (!strcmp(tbl->symbols[*slot - 1].identifier,
+				    tbl->symbols[i].identifier))
+				break;
+		}
+
+		pos = symbol_value_hash(tbl->symbols[i].value);
+		for (;; pos++) {
+			slot = &index->slots[hsize + (pos & index->mask)];
+			if (!*slot) {
+				*slot = i + 1;
+				break;
+			}
+			if (tbl->symbols[*slot - 1].value ==
+			    tbl->symbols[i].value)
+				break;
+		}
+	}
+
+	tbl->index = index;
+}
+
+const struct symbolic_constant *
+symbol_table_lookup(const struct symbol_table *tbl, const char *identifier)
+{
+	const struct symbol_table_index *index = tbl->index;
+	const struct symbolic_constant *s;
+	uint32_t pos, slot;
+
+	if (!index) {
+		for (s = tbl->symbols; s->identifier != NULL; s++) {
+			if (!strcmp(identifier, s->identifier))
+				return s;
+		}
+		return NULL;
+	}
+
+	for (pos = djb_hash(identifier); ; pos++) {
+		slot = index->slots[pos & index->mask];
+		if (!slot)
+			return NULL;
+
+		s = &tbl->symbols[slot - 1];
+		if (!strcmp(identifier, s->identifier))
+			return s;
+	}
+}
+
+const struct symbolic_constant *
+symbol_table_lookup_value(const struct symbol_table *tbl, uint64_t value)
+{
+	const struct symbol_table_index *index = tbl->index;
+	const struct symbolic_constant *s;
+	uint32_t pos, slot;
+
+	if (!index) {
+		for (s = tbl->symbols; s->identifier != NULL; s++) {
+			if (value == s->value)
+				return s;
+		}
+		return NULL;
+	}
+
+	for (pos = symbol_value_hash(value); ; pos++) {
+		slot = index->slots[index->mask + 1 + (pos & index->mask)];
+		if (!slot)
+			return NULL;
+
+		s = &tbl->symbols[slot - 1];
+		if (value == s->value)
+			return s;
+	}
+}
+
 struct error_record *symbolic_constant_parse(struct parse_ctx *ctx,
 					     const struct expr *sym,
 					     const struct symbol_table *tbl,
@@ -198,12 +307,8 @@ struct error_record *symbolic_constant_parse(struct parse_ctx *ctx,
 	const struct datatype *dtype;
 	struct error_record *erec;
 
-	for (s = tbl->symbols; s->identifier != NULL; s++) {
-		if (!strcmp(sym->identifier, s->identifier))
-			break;
-	}
-
-	if (s->identifier != NULL)
+	s = symbol_table_lookup(tbl, sym->identifier);
+	if (s)
 		goto out;
 
 	dtype = sym->dtype;
@@ -249,12 +354,8 @@ void symbolic_constant_print(const struct symbol_table *tbl,
 	mpz_export_data(constant_data_ptr(val, expr->len), expr->value,
 			expr->byteorder, len);
 
-	for (s = tbl->symbols; s->identifier != NULL; s++) {
-		if (val == s->value)
-			break;
-	}
-
-	if (s->identifier == NULL || nft_output_numeric_symbol(octx))
+	s = symbol_table_lookup_value(tbl, val);
+	if (!s || nft_output_numeric_symbol(octx))
 		return expr_basetype(expr)->print(expr, octx);
 
 	nft_print(octx, quotes ? "\"%s\"" : "%s", s->identifier);
@@ -585,16 +686,18 @@ static void ipaddr_type_print(const struct expr *expr, struct output_ctx *octx)
 {
 	struct sockaddr_in sin = { .sin_family = AF_INET, };
 	char buf[NI_MAXHOST];
-	int err;
+	const char *name;
 
 	sin.sin_addr.s_addr = mpz_get_be32(expr->value);
-	err = getnameinfo((struct sockaddr *)&sin, sizeof(sin), buf,
-			  sizeof(buf), NULL, 0,
-			  nft_output_reversedns(octx) ? 0 : NI_NUMERICHOST);
-	if (err != 0) {
-		getnameinfo((struct sockaddr *)&sin, sizeof(sin), buf,
-			    sizeof(buf), NULL, 0, NI_NUMERICHOST);
+	if (nft_output_reversedns(octx)) {
+		name = nft_dns_getname(octx->tbl.dns, AF_INET, &sin.sin_addr);
+		if (name) {
+			nft_print(octx, "%s", name);
+			return;
+		}
 	}
+	getnameinfo((struct sockaddr *)&sin, sizeof(sin), buf,
+		    sizeof(buf), NULL, 0, NI_NUMERICHOST);
 	nft_print(octx, "%s", buf);
 }
 
@@ -608,23 +711,18 @@ static struct error_record *ipaddr_type_parse(struct parse_ctx *ctx,
 		if (inet_pton(AF_INET, sym->identifier, &addr) != 1)
 			return error(&sym->location, "Invalid IPv4 address");
 	} else {
-		struct addrinfo *ai, hints = { .ai_family = AF_INET,
-					       .ai_socktype = SOCK_DGRAM};
+		unsigned int naddrs;
 		int err;
 
-		err = getaddrinfo(sym->identifier, NULL, &hints, &ai);
+		err = nft_dns_getaddr(ctx->tbl->dns, AF_INET, sym->identifier,
+				      &addr, &naddrs);
 		if (err != 0)
 			return error(&sym->location, "Could not resolve hostname: %s",
 				     gai_strerror(err));
 
-		if (ai->ai_next != NULL) {
-			freeaddrinfo(ai);
+		if (naddrs > 1)
 			return error(&sym->location,
 				     "Hostname resolves to multiple addresses");
-		}
-		assert(ai->ai_addr->sa_family == AF_INET);
-		addr = ((struct sockaddr_in *) (void *) ai->ai_addr)->sin_addr;
-		freeaddrinfo(ai);
 	}
 
 	*res = constant_expr_alloc(&sym->location, &ipaddr_type,
@@ -649,18 +747,20 @@ static void ip6addr_type_print(const struct expr *expr, struct output_ctx *octx)
 {
 	struct sockaddr_in6 sin6 = { .sin6_family = AF_INET6 };
 	char buf[NI_MAXHOST];
-	int err;
+	const char *name;
 
 	mpz_export_data(&sin6.sin6_addr, expr->value, BYTEORDER_BIG_ENDIAN,
 			sizeof(sin6.sin6_addr));
 
-	err = getnameinfo((struct sockaddr *)&sin6, sizeof(sin6), buf,
-			  sizeof(buf), NULL, 0,
-			  nft_output_reversedns(octx) ? 0 : NI_NUMERICHOST);
-	if (err != 0) {
-		getnameinfo((struct sockaddr *)&sin6, sizeof(sin6), buf,
-			    sizeof(buf), NULL, 0, NI_NUMERICHOST);
+	if (nft_output_reversedns(octx)) {
+		name = nft_dns_getname(octx->tbl.dns, AF_INET6, &sin6.sin6_addr);
+		if (name) {
+			nft_print(octx, "%s", name);
+			return;
+		}
 	}
+	getnameinfo((struct sockaddr *)&sin6, sizeof(sin6), buf,
+		    sizeof(buf), NULL, 0, NI_NUMERICHOST);
 	nft_print(octx, "%s", buf);
 }
 
@@ -674,24 +774,18 @@ static struct error_record *ip6addr_type_parse(struct parse_ctx *ctx,
 		if (inet_pton(AF_INET6, sym->identifier, &addr) != 1)
 			return error(&sym->location, "Invalid IPv6 address");
 	} else {
-		struct addrinfo *ai, hints = { .ai_family = AF_INET6,
-					       .ai_socktype = SOCK_DGRAM};
+		unsigned int naddrs;
 		int err;
 
-		err = getaddrinfo(sym->identifier, NULL, &hints, &ai);
+		err = nft_dns_getaddr(ctx->tbl->dns, AF_INET6, sym->identifier,
+				      &addr, &naddrs);
 		if (err != 0)
 			return error(&sym->location, "Could not resolve hostname: %s",
 				     gai_strerror(err));
 
-		if (ai->ai_next != NULL) {
-			freeaddrinfo(ai);
+		if (naddrs > 1)
 			return error(&sym->location,
 				     "Hostname resolves to multiple addresses");
-		}
-
-		assert(ai->ai_addr->sa_family == AF_INET6);
-		addr = ((struct sockaddr_in6 *)(void *)ai->ai_addr)->sin6_addr;
-		freeaddrinfo(ai);
 	}
 
 	*res = constant_expr_alloc(&sym->location, &ip6addr_type,
@@ -719,7 +813,9 @@ static void inet_protocol_type_print(const struct expr *expr,
 	    mpz_cmp_ui(expr->value, UINT8_MAX) <= 0) {
 		char name[NFT_PROTONAME_MAXSIZE];
 
-		if (nft_getprotobynumber(mpz_get_uint8(expr->value), name, sizeof(name))) {
+		if (nft_getprotobynumber(octx->tbl.netdb,
+					 mpz_get_uint8(expr->value),
+					 name, sizeof(name))) {
 			nft_print(octx, "%s", name);
 			return;
 		}
@@ -734,7 +830,8 @@ static void inet_protocol_type_describe(struct output_ctx *octx)
 	for (protonum = 0; protonum < UINT8_MAX; protonum++) {
 		char name[NFT_PROTONAME_MAXSIZE];
 
-		if (!nft_getprotobynumber(protonum, name, sizeof(name)))
+		if (!nft_getprotobynumber(octx->tbl.netdb, protonum,
+					  name, sizeof(name)))
 			continue;
 
 		nft_print(octx, "\t%-30s\t%u\n", name, protonum);
@@ -759,7 +856,7 @@ static struct error_record *inet_protocol_type_parse(struct parse_ctx *ctx,
 	} else {
 		int r;
 
-		r = nft_getprotobyname(sym->identifier);
+		r = nft_getprotobyname(ctx->tbl->netdb, sym->identifier);
 		if (r < 0)
 			return error(&sym->location, "Could not resolve protocol name");
 
@@ -789,7 +886,7 @@ static void inet_service_print(const struct expr *expr, struct output_ctx *octx)
 	uint16_t port = mpz_get_be16(expr->value);
 	char name[NFT_SERVNAME_MAXSIZE];
 
-	if (!nft_getservbyport(port, NULL, name, sizeof(name)))
+	if (!nft_getservbyport(octx->tbl.netdb, port, NULL, name, sizeof(name)))
 		nft_print(octx, "%hu", ntohs(port));
 	else
 		nft_print(octx, "\"%s\"", name);
@@ -822,7 +919,8 @@ static struct error_record *inet_service_type_parse(struct parse_ctx *ctx,
 			return error(&sym->location, "Service out of range");
 
 		port = htons(i);
-	} else {
+	} else if (!nft_getservbyname(ctx->tbl->netdb, sym->identifier,
+				      &port)) {
 		err = getaddrinfo(NULL, sym->identifier, NULL, &ai);
 		if (err != 0)
 			return error(&sym->location, "Could not resolve service: %s",
@@ -936,6 +1034,9 @@ out:
 	if (path)
 		free(path);
 	tbl->symbols[nelems] = SYMBOL_LIST_END;
+	tbl->index = NULL;
+	symbol_table_index_build(tbl, nelems);
+
 	return tbl;
 }
 
@@ -945,6 +1046,7 @@ void rt_symbol_table_free(const struct symbol_table *tbl)
 
 	for (s = tbl->symbols; s->identifier != NULL; s++)
 		free_const(s->identifier);
+	free(tbl->index);
 	free_const(tbl);
 }
 
@@ -1359,7 +1461,8 @@ const struct datatype *datatype_get(const struct datatype *ptr)
 	if (!(dtype->flags & DTYPE_F_ALLOC))
 		return dtype;
 
-	dtype->refcnt++;
+	/* set key types are shared by rules delinearized concurrently. */
+	__atomic_add_fetch(&dtype->refcnt, 1, __ATOMIC_RELAXED);
 	return dtype;
 }
 
@@ -1403,7 +1506,7 @@ void datatype_free(const struct datatype *ptr)
 
 	assert(dtype->refcnt != 0);
 
-	if (--dtype->refcnt > 0)
+	if (__atomic_sub_fetch(&dtype->refcnt, 1, __ATOMIC_ACQ_REL) > 0)
 		return;
 
 	free_const(dtype->name);
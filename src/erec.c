@@ -112,6 +112,9 @@ const char *line_location(const struct input_descriptor *indesc,
 	const char *line = NULL;
 	FILE *f;
 
+	if (loc->line_offset == LOCATION_OFFSET_MAX)
+		return NULL;
+
 	f = fopen(indesc->name, "r");
 	if (!f)
 		return NULL;
@@ -145,6 +148,8 @@ void erec_print(struct output_ctx *octx, const struct error_record *erec,
 		*strchrnul(line, '\n') = '\0';
 		break;
 	case INDESC_STDIN:
+		if (loc->line_offset == LOCATION_OFFSET_MAX)
+			break;
 		line = indesc->data;
 		line += loc->line_offset;
 		*strchrnul(line, '\n') = '\0';
@@ -208,6 +213,16 @@ void erec_print(struct output_ctx *octx, const struct error_record *erec,
 	fprintf(f, "\n");
 }
 
+void erec_free_list(struct list_head *list)
+{
+	struct error_record *erec, *next;
+
+	list_for_each_entry_safe(erec, next, list, list) {
+		list_del(&erec->list);
+		erec_destroy(erec);
+	}
+}
+
 void erec_print_list(struct output_ctx *octx, struct list_head *list,
 		     unsigned int debug_mask)
 {
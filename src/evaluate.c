@@ -32,7 +32,9 @@
 #include <netlink.h>
 #include <time.h>
 #include <rule.h>
+#include <cmd.h>
 #include <cache.h>
+#include <resolve.h>
 #include <erec.h>
 #include <gmputil.h>
 #include <utils.h>
@@ -1931,6 +1933,359 @@ static int interval_set_eval(struct eval_ctx *ctx, struct set *set,
 	return ret;
 }
 
+/* Generated rulesets often repeat the same literal interval set in many
+ * rules, e.g. tcp dport { 1-1023, 8000-8999 }. Each one becomes an anonymous
+ * set of its own since the kernel binds an anonymous set to exactly one
+ * lookup, but sorting and merging the intervals only needs to be done once
+ * per transaction. Sets are interned by their elements as given, before
+ * interval processing, later sets with the same elements get a copy of the
+ * processed elements. This only saves work in userspace, each set is still
+ * sent to the kernel.
+ */
+#define SET_INTERN_HSIZE_MIN	64
+
+struct set_intern_entry {
+	struct hlist_node	hnode;
+	uint32_t		hash;
+	uint32_t		flags;
+	uint32_t		key_type;
+	unsigned int		key_len;
+	enum byteorder		key_byteorder;
+	struct expr		*raw;
+	struct expr		*init;
+	unsigned int		*loc_index;
+};
+
+static uint32_t set_intern_mix(uint32_t hash, uint32_t val)
+{
+	return hash * 31 + val;
+}
+
+static bool set_intern_expr_hash(const struct expr *expr, uint32_t *hash)
+{
+	const struct expr *i;
+
+	*hash = set_intern_mix(*hash, expr->etype);
+	*hash = set_intern_mix(*hash, expr->len);
+	*hash = set_intern_mix(*hash, expr->flags);
+
+	switch (expr->etype) {
+	case EXPR_VALUE:
+		*hash = set_intern_mix(*hash, mpz_get_ui(expr->value));
+		return true;
+	case EXPR_PREFIX:
+		*hash = set_intern_mix(*hash, expr->prefix_len);
+		return set_intern_expr_hash(expr->prefix, hash);
+	case EXPR_RANGE:
+		return set_intern_expr_hash(expr->left, hash) &&
+		       set_intern_expr_hash(expr->right, hash);
+	case EXPR_CONCAT:
+	case EXPR_SET:
+		list_for_each_entry(i, &expr->expressions, list) {
+			if (!set_intern_expr_hash(i, hash))
+				return false;
+		}
+		return true;
+	case EXPR_SET_ELEM:
+		/* Keep elements with per-element state out of it. */
+		if (expr->timeout || expr->expiration || expr->comment ||
+		    !list_empty(&expr->stmt_list))
+			return false;
+
+		*hash = set_intern_mix(*hash, expr->elem_flags);
+		return set_intern_expr_hash(expr->key, hash);
+	default:
+		return false;
+	}
+}
+
+static bool set_intern_expr_equal(const struct expr *e1, const struct expr *e2)
+{
+	const struct expr *i, *j;
+
+	if (e1->etype != e2->etype ||
+	    e1->len != e2->len ||
+	    e1->flags != e2->flags ||
+	    !datatype_equal(e1->dtype, e2->dtype))
+		return false;
+
+	switch (e1->etype) {
+	case EXPR_VALUE:
+		return e1->byteorder == e2->byteorder &&
+		       !mpz_cmp(e1->value, e2->value);
+	case EXPR_PREFIX:
+		return e1->prefix_len == e2->prefix_len &&
+		       set_intern_expr_equal(e1->prefix, e2->prefix);
+	case EXPR_RANGE:
+		return set_intern_expr_equal(e1->left, e2->left) &&
+		       set_intern_expr_equal(e1->right, e2->right);
+	case EXPR_CONCAT:
+	case EXPR_SET:
+		if (e1->size != e2->size)
+			return false;
+
+		j = list_first_entry(&e2->expressions, struct expr, list);
+		list_for_each_entry(i, &e1->expressions, list) {
+			if (!set_intern_expr_equal(i, j))
+				return false;
+			j = list_next_entry(j, list);
+		}
+		return true;
+	case EXPR_SET_ELEM:
+		return e1->elem_flags == e2->elem_flags &&
+		       set_intern_expr_equal(e1->key, e2->key);
+	default:
+		return false;
+	}
+}
+
+static bool set_intern_hash(const struct eval_ctx *ctx, const struct set *set,
+			    uint32_t *hash)
+{
+	switch (ctx->cmd->op) {
+	case CMD_CREATE:
+	case CMD_ADD:
+	case CMD_REPLACE:
+	case CMD_INSERT:
+		break;
+	default:
+		return false;
+	}
+
+	*hash = set_intern_mix(set->flags, set->key->dtype->type);
+	*hash = set_intern_mix(*hash, set->key->len);
+	*hash = set_intern_mix(*hash, set->key->byteorder);
+
+	return set_intern_expr_hash(set->init, hash);
+}
+
+static struct set_intern_entry *set_intern_lookup(const struct set_intern *si,
+						  const struct set *set,
+						  uint32_t hash)
+{
+	struct set_intern_entry *e;
+	struct hlist_node *n;
+
+	if (!si->hsize)
+		return NULL;
+
+	hlist_for_each_entry(e, n, &si->hash[hash & (si->hsize - 1)], hnode) {
+		if (e->hash == hash &&
+		    e->flags == set->flags &&
+		    e->key_type == set->key->dtype->type &&
+		    e->key_len == set->key->len &&
+		    e->key_byteorder == set->key->byteorder &&
+		    set_intern_expr_equal(e->raw, set->init))
+			return e;
+	}
+	return NULL;
+}
+
+static void set_intern_resize(struct set_intern *si, unsigned int hsize)
+{
+	struct set_intern_entry *e;
+	struct hlist_node *n, *next;
+	struct hlist_head *hash;
+	unsigned int i;
+
+	hash = xzalloc_array(hsize, sizeof(struct hlist_head));
+	for (i = 0; i < si->hsize; i++) {
+		hlist_for_each_entry_safe(e, n, next, &si->hash[i], hnode) {
+			hlist_del(&e->hnode);
+			hlist_add_head(&e->hnode, &hash[e->hash & (hsize - 1)]);
+		}
+	}
+	free(si->hash);
+	si->hash = hash;
+	si->hsize = hsize;
+}
+
+static unsigned int set_intern_nelems(const struct expr *init)
+{
+	const struct expr *i;
+	unsigned int n = 0;
+
+	list_for_each_entry(i, &init->expressions, list)
+		n++;
+
+	return n;
+}
+
+struct set_intern_pos {
+	const struct expr	*elem;
+	unsigned int		index;
+};
+
+static int set_intern_pos_cmp(const void *p1, const void *p2)
+{
+	const struct set_intern_pos *a = p1, *b = p2;
+
+	if (a->elem == b->elem)
+		return 0;
+
+	return (uintptr_t)a->elem < (uintptr_t)b->elem ? -1 : 1;
+}
+
+/* Record the position of each element as given, sorted by element. */
+static struct set_intern_pos *set_intern_pos_alloc(const struct expr *init)
+{
+	struct set_intern_pos *pos;
+	const struct expr *i;
+	unsigned int n = 0;
+
+	pos = xmalloc_array(set_intern_nelems(init) + 1, sizeof(*pos));
+	list_for_each_entry(i, &init->expressions, list) {
+		pos[n].elem = i;
+		pos[n].index = n + 1;
+		n++;
+	}
+	qsort(pos, n, sizeof(*pos), set_intern_pos_cmp);
+
+	return pos;
+}
+
+/* Interval processing merges and adjusts the elements as given in place,
+ * every processed element is one of them. Record which one, so sets reusing
+ * the processed elements can point to their own elements in error reports.
+ * Zero means no element matches, the location of the set is used then.
+ */
+static unsigned int *set_intern_loc_index(const struct set_intern_pos *pos,
+					  unsigned int npos,
+					  const struct expr *init)
+{
+	struct set_intern_pos key = {}, *found;
+	unsigned int *loc_index;
+	const struct expr *i;
+	unsigned int n = 0;
+
+	loc_index = xzalloc_array(set_intern_nelems(init) + 1,
+				  sizeof(*loc_index));
+	list_for_each_entry(i, &init->expressions, list) {
+		key.elem = i;
+		found = bsearch(&key, pos, npos, sizeof(*pos),
+				set_intern_pos_cmp);
+		if (found)
+			loc_index[n] = found->index;
+		n++;
+	}
+
+	return loc_index;
+}
+
+static void set_intern_add(struct set_intern *si, const struct set *set,
+			   struct expr *raw, const struct set_intern_pos *pos,
+			   uint32_t hash)
+{
+	struct set_intern_entry *e;
+
+	if (!si->hsize)
+		set_intern_resize(si, SET_INTERN_HSIZE_MIN);
+	else if (si->nelems >= si->hsize)
+		set_intern_resize(si, si->hsize * 2);
+
+	e = xzalloc(sizeof(*e));
+	e->hash = hash;
+	e->flags = set->flags;
+	e->key_type = set->key->dtype->type;
+	e->key_len = set->key->len;
+	e->key_byteorder = set->key->byteorder;
+	e->raw = raw;
+	/* Later evaluation steps, such as binop_transfer(), may still update
+	 * the elements of this set, keep a copy of them as they are now.
+	 */
+	e->loc_index = set_intern_loc_index(pos, set_intern_nelems(raw),
+					    set->init);
+	e->init = expr_clone(set->init);
+	hlist_add_head(&e->hnode, &si->hash[hash & (si->hsize - 1)]);
+	si->nelems++;
+}
+
+void set_intern_release(struct set_intern *si)
+{
+	struct set_intern_entry *e;
+	struct hlist_node *n, *next;
+	unsigned int i;
+
+	for (i = 0; i < si->hsize; i++) {
+		hlist_for_each_entry_safe(e, n, next, &si->hash[i], hnode) {
+			hlist_del(&e->hnode);
+			expr_free(e->raw);
+			expr_free(e->init);
+			free(e->loc_index);
+			free(e);
+		}
+	}
+	free(si->hash);
+	memset(si, 0, sizeof(*si));
+}
+
+static void set_intern_copy(struct expr *init,
+			    const struct set_intern_entry *e)
+{
+	struct location *locs;
+	struct expr *i, *next;
+	unsigned int n = 0;
+
+	/* Same elements as the interned set, in the same order. */
+	locs = xmalloc_array(set_intern_nelems(init) + 1, sizeof(*locs));
+	list_for_each_entry_safe(i, next, &init->expressions, list) {
+		locs[n++] = i->location;
+		list_del(&i->list);
+		expr_free(i);
+	}
+
+	n = 0;
+	list_for_each_entry(i, &e->init->expressions, list) {
+		struct expr *elem = expr_clone(i);
+
+		if (e->loc_index[n])
+			elem->location = locs[e->loc_index[n] - 1];
+		else
+			elem->location = init->location;
+
+		if (elem->etype == EXPR_SET_ELEM)
+			elem->key->location = elem->location;
+
+		list_add_tail(&elem->list, &init->expressions);
+		n++;
+	}
+	free(locs);
+
+	init->size = e->init->size;
+	init->set_flags = e->init->set_flags;
+}
+
+static int anon_interval_set_eval(struct eval_ctx *ctx, struct set *set)
+{
+	struct set_intern *si = ctx->set_intern;
+	struct set_intern_entry *e;
+	struct set_intern_pos *pos;
+	struct expr *raw;
+	uint32_t hash;
+
+	if (!si || !set_intern_hash(ctx, set, &hash))
+		return interval_set_eval(ctx, set, set->init);
+
+	e = set_intern_lookup(si, set, hash);
+	if (e) {
+		set_intern_copy(set->init, e);
+		si->hits++;
+		return 0;
+	}
+
+	raw = expr_clone(set->init);
+	pos = set_intern_pos_alloc(set->init);
+	if (interval_set_eval(ctx, set, set->init) < 0) {
+		expr_free(raw);
+		free(pos);
+		return -1;
+	}
+	set_intern_add(si, set, raw, pos, hash);
+	free(pos);
+
+	return 0;
+}
+
 static void expr_evaluate_set_ref(struct eval_ctx *ctx, struct expr *expr)
 {
 	struct set *set = expr->set;
@@ -1939,11 +2294,50 @@ static void expr_evaluate_set_ref(struct eval_ctx *ctx, struct expr *expr)
 	ctx->ectx.key = set->key;
 }
 
+/* Resolve all hostnames in the set concurrently before the elements are
+ * evaluated one by one, symbol parsing then hits the cached results.
+ */
+static void expr_set_resolve_hostnames(struct eval_ctx *ctx,
+				       const struct expr *set)
+{
+	struct nft_dns_cache *dns = ctx->nft->output.tbl.dns;
+	const struct datatype *dtype = ctx->ectx.dtype;
+	const struct expr *i, *key;
+	int family;
+
+	if (!dtype || nft_input_no_dns(&ctx->nft->input))
+		return;
+
+	switch (dtype->type) {
+	case TYPE_IPADDR:
+		family = AF_INET;
+		break;
+	case TYPE_IP6ADDR:
+		family = AF_INET6;
+		break;
+	default:
+		return;
+	}
+
+	list_for_each_entry(i, &set->expressions, list) {
+		key = i->etype == EXPR_MAPPING ? i->left : i;
+		if (key->etype == EXPR_SET_ELEM)
+			key = key->key;
+		if (key->etype != EXPR_SYMBOL || key->symtype != SYMBOL_VALUE)
+			continue;
+
+		nft_dns_queue_name(dns, family, key->identifier);
+	}
+	nft_dns_run(dns);
+}
+
 static int expr_evaluate_set(struct eval_ctx *ctx, struct expr **expr)
 {
 	struct expr *set = *expr, *i, *next;
 	const struct expr *elem;
 
+	expr_set_resolve_hostnames(ctx, set);
+
 	list_for_each_entry_safe(i, next, &set->expressions, list) {
 		if (list_member_evaluate(ctx, &i) < 0)
 			return -1;
@@ -4294,9 +4688,10 @@ static int stmt_evaluate_chain(struct eval_ctx *ctx, struct stmt *stmt)
 
 		list_for_each_entry_safe(rule, next, &chain->rules, list) {
 			struct eval_ctx rule_ctx = {
-				.nft	= ctx->nft,
-				.msgs	= ctx->msgs,
-				.cmd	= ctx->cmd,
+				.nft		= ctx->nft,
+				.msgs		= ctx->msgs,
+				.set_intern	= ctx->set_intern,
+				.cmd		= ctx->cmd,
 			};
 			struct handle h2 = {};
 
@@ -4754,6 +5149,210 @@ int stmt_evaluate(struct eval_ctx *ctx, struct stmt *stmt)
 	}
 }
 
+/* Upper bound of kernel lookups per command before falling back to fetch
+ * all elements in the set.
+ */
+#define SETELEM_NEIGH_MAX	1024
+
+static const struct expr *setelem_key(const struct expr *elem)
+{
+	if (elem->etype == EXPR_MAPPING)
+		elem = elem->left;
+
+	return elem->key;
+}
+
+/* Lookups only return the interval that contains a given value, intervals
+ * that are fully enclosed by a new range cannot be found this way. Automerge
+ * needs those to merge them, hence only single values can be added to such
+ * sets. Otherwise, the intervals that contain both ends of a new range are
+ * fetched to report partial overlaps, enclosed intervals are rejected by the
+ * kernel. Elements of any kind can be deleted. Keys up to 16 bits use the
+ * bitmap backend which only returns exact matches, string keys need wildcard
+ * handling.
+ */
+static bool setelem_neigh_supported(const struct cmd *cmd,
+				    const struct set *set,
+				    const struct expr *init)
+{
+	const struct expr *i, *key;
+	unsigned int num = 1;
+	mpz_t low, high;
+	bool ret = true;
+
+	if (set->key->len <= 16 ||
+	    set->key->byteorder != BYTEORDER_BIG_ENDIAN ||
+	    expr_basetype(set->key)->type == TYPE_STRING)
+		return false;
+
+	switch (cmd->op) {
+	case CMD_ADD:
+	case CMD_INSERT:
+	case CMD_DELETE:
+	case CMD_DESTROY:
+		break;
+	default:
+		return false;
+	}
+
+	mpz_init(low);
+	mpz_init(high);
+	list_for_each_entry(i, &init->expressions, list) {
+		key = setelem_key(i);
+		if (key->etype == EXPR_SET_ELEM_CATCHALL) {
+			ret = false;
+			break;
+		}
+		if (cmd->op == CMD_DELETE || cmd->op == CMD_DESTROY) {
+			num++;
+		} else {
+			range_expr_value_low(low, i);
+			range_expr_value_high(high, i);
+			if (!mpz_cmp(low, high)) {
+				num += set->automerge ? 3 : 1;
+			} else if (!set->automerge) {
+				num += 2;
+			} else {
+				ret = false;
+				break;
+			}
+		}
+		if (num > SETELEM_NEIGH_MAX) {
+			ret = false;
+			break;
+		}
+	}
+	mpz_clear(low);
+	mpz_clear(high);
+
+	return ret;
+}
+
+static bool setelem_neigh_cached(const struct set *set, const mpz_t value)
+{
+	const struct expr *i;
+	mpz_t low, high;
+	bool ret = false;
+
+	mpz_init(low);
+	mpz_init(high);
+	list_for_each_entry(i, &set->init->expressions, list) {
+		range_expr_value_low(low, i);
+		range_expr_value_high(high, i);
+		if (mpz_cmp(low, value) <= 0 && mpz_cmp(value, high) <= 0) {
+			ret = true;
+			break;
+		}
+	}
+	mpz_clear(low);
+	mpz_clear(high);
+
+	return ret;
+}
+
+static int setelem_neigh_fetch(struct netlink_ctx *nl_ctx, struct set *set,
+			       const mpz_t value)
+{
+	if (setelem_neigh_cached(set, value))
+		return 0;
+
+	return netlink_get_setelem_interval(nl_ctx, set, value);
+}
+
+static int __setelem_neigh_evaluate(struct netlink_ctx *nl_ctx,
+				    const struct cmd *cmd, struct set *set,
+				    const struct expr *init)
+{
+	bool add = cmd->op == CMD_ADD || cmd->op == CMD_INSERT;
+	mpz_t value, adj, max;
+	const struct expr *i;
+	int ret = 0;
+
+	mpz_init(value);
+	mpz_init(adj);
+	mpz_init_bitmask(max, set->key->len);
+
+	/* Anything that covers zero tells that the set is not empty, see
+	 * segtree_needs_first_segment().
+	 */
+	if (add)
+		ret = setelem_neigh_fetch(nl_ctx, set, value);
+
+	list_for_each_entry(i, &init->expressions, list) {
+		if (ret < 0)
+			break;
+
+		range_expr_value_low(value, i);
+		ret = setelem_neigh_fetch(nl_ctx, set, value);
+		if (ret < 0 || !add)
+			continue;
+
+		if (!set->automerge) {
+			range_expr_value_high(adj, i);
+			if (mpz_cmp(adj, value))
+				ret = setelem_neigh_fetch(nl_ctx, set, adj);
+			continue;
+		}
+
+		/* adjacent intervals are merged with the new element. */
+		if (mpz_cmp_ui(value, 0)) {
+			mpz_sub_ui(adj, value, 1);
+			ret = setelem_neigh_fetch(nl_ctx, set, adj);
+		}
+		if (ret == 0 && mpz_cmp(value, max)) {
+			mpz_add_ui(adj, value, 1);
+			ret = setelem_neigh_fetch(nl_ctx, set, adj);
+		}
+	}
+	mpz_clear(value);
+	mpz_clear(adj);
+	mpz_clear(max);
+
+	return ret;
+}
+
+/* Elements of interval sets are not fetched when building the cache for
+ * element updates, see NFT_CACHE_SETELEM_NEIGH. Fetch those intervals that
+ * may overlap or be merged with the elements in this command, or the whole
+ * set if this is not enough.
+ */
+static int setelem_neigh_evaluate(struct eval_ctx *ctx, struct cmd *cmd,
+				  struct set *set)
+{
+	unsigned int flags = ctx->nft->cache.flags;
+	struct netlink_ctx nl_ctx = {
+		.list		= LIST_HEAD_INIT(nl_ctx.list),
+		.nft		= ctx->nft,
+		.msgs		= ctx->msgs,
+		.seqnum		= time(NULL),
+	};
+	int ret;
+
+	if (!(flags & NFT_CACHE_SETELEM_NEIGH) ||
+	    flags & (NFT_CACHE_SETELEM_MAYBE | NFT_CACHE_SETELEM_BIT) ||
+	    set->init || !set_is_non_concat_range(set))
+		return 0;
+
+	if (setelem_neigh_supported(cmd, set, cmd->expr)) {
+		set->init = set_expr_alloc(&internal_location, set);
+		ret = __setelem_neigh_evaluate(&nl_ctx, cmd, set, cmd->expr);
+		if (ret == 0)
+			return 0;
+
+		/* kernel lacks support for lookups, fetch all elements. */
+		expr_free(set->init);
+		set->init = NULL;
+	}
+
+	ret = netlink_list_setelems(&nl_ctx, &set->handle, set, false);
+	if (ret < 0)
+		return cmd_error(ctx, &cmd->location,
+				 "Could not fetch elements of set %s: %s",
+				 set->handle.set.name, strerror(errno));
+
+	return 0;
+}
+
 static int setelem_evaluate(struct eval_ctx *ctx, struct cmd *cmd)
 {
 	struct table *table;
@@ -4781,8 +5380,16 @@ static int setelem_evaluate(struct eval_ctx *ctx, struct cmd *cmd)
 
 	cmd->elem.set = set_get(set);
 	if (set_is_interval(ctx->set->flags)) {
+		/* elements are released once they are in the batch. */
+		if (!set->runs && !set->automerge &&
+		    (cmd->op == CMD_ADD || cmd->op == CMD_CREATE) &&
+		    set_is_non_concat_range(set) &&
+		    nft_stream_started(ctx->nft))
+			set->runs = interval_runs_alloc(set);
+
 		if (!(set->flags & NFT_SET_CONCAT) &&
-		    interval_set_eval(ctx, ctx->set, cmd->expr) < 0)
+		    (setelem_neigh_evaluate(ctx, cmd, set) < 0 ||
+		     interval_set_eval(ctx, ctx->set, cmd->expr) < 0))
 			return -1;
 
 		assert(cmd->expr->etype == EXPR_SET);
@@ -5005,7 +5612,7 @@ static int set_evaluate(struct eval_ctx *ctx, struct set *set)
 	if (set_is_anonymous(set->flags)) {
 		if (set_is_interval(set->init->set_flags) &&
 		    !(set->init->set_flags & NFT_SET_CONCAT) &&
-		    interval_set_eval(ctx, set, set->init) < 0)
+		    anon_interval_set_eval(ctx, set) < 0)
 			return -1;
 
 		return 0;
@@ -5178,7 +5785,8 @@ static void link_rules(struct rule *src, struct rule *dst)
 
 	/* dst is not in kernel, make src reference it by per-transaction ID */
 	if (!dst->handle.rule_id)
-		dst->handle.rule_id = ++ref_id;
+		dst->handle.rule_id = __atomic_add_fetch(&ref_id, 1,
+							 __ATOMIC_RELAXED);
 	src->handle.position_id = dst->handle.rule_id;
 }
 
@@ -5224,23 +5832,23 @@ static int rule_cache_update(struct eval_ctx *ctx, enum cmd_ops op)
 	case CMD_INSERT:
 		rule_get(rule);
 		if (ref)
-			list_add_tail(&rule->list, &ref->list);
+			chain_rule_add_tail(chain, rule, &ref->list);
 		else
-			list_add(&rule->list, &chain->rules);
+			chain_rule_add(chain, rule, &chain->rules);
 		break;
 	case CMD_ADD:
 		rule_get(rule);
 		if (ref)
-			list_add(&rule->list, &ref->list);
+			chain_rule_add(chain, rule, &ref->list);
 		else
-			list_add_tail(&rule->list, &chain->rules);
+			chain_rule_add_tail(chain, rule, &chain->rules);
 		break;
 	case CMD_REPLACE:
 		rule_get(rule);
-		list_add(&rule->list, &ref->list);
+		chain_rule_add(chain, rule, &ref->list);
 		/* fall through */
 	case CMD_DELETE:
-		list_del(&ref->list);
+		chain_rule_del(chain, ref);
 		rule_free(ref);
 		break;
 	default:
@@ -13,6 +13,8 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <limits.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 
 #include <expression.h>
 #include <statement.h>
@@ -24,6 +26,7 @@
 #include <list.h>
 #include <erec.h>
 #include <json.h>
+#include <resolve.h>
 
 extern const struct expr_ops ct_expr_ops;
 extern const struct expr_ops fib_expr_ops;
@@ -1095,12 +1098,55 @@ static const char *calculate_delim(const struct expr *expr, int *count)
 	return newline;
 }
 
+void set_expr_resolve(const struct expr *set, struct output_ctx *octx)
+{
+	struct nft_dns_cache *dns = octx->tbl.dns;
+	const struct expr *i, *key;
+	struct in6_addr addr;
+	int family;
+
+	if (!nft_output_reversedns(octx) || !dns)
+		return;
+
+	/* Reverse lookups for all addresses at once, rather than one blocking
+	 * getnameinfo() call per printed element.
+	 */
+	list_for_each_entry(i, &set->expressions, list) {
+		key = i->etype == EXPR_MAPPING ? i->left : i;
+		if (key->etype == EXPR_SET_ELEM)
+			key = key->key;
+		if (key->etype == EXPR_PREFIX)
+			key = key->prefix;
+		if (key->etype != EXPR_VALUE || !key->dtype)
+			continue;
+
+		switch (key->dtype->type) {
+		case TYPE_IPADDR:
+			family = AF_INET;
+			mpz_export_data(&addr, key->value, BYTEORDER_BIG_ENDIAN,
+					sizeof(struct in_addr));
+			break;
+		case TYPE_IP6ADDR:
+			family = AF_INET6;
+			mpz_export_data(&addr, key->value, BYTEORDER_BIG_ENDIAN,
+					sizeof(struct in6_addr));
+			break;
+		default:
+			continue;
+		}
+		nft_dns_queue_addr(dns, family, &addr);
+	}
+	nft_dns_run(dns);
+}
+
 static void set_expr_print(const struct expr *expr, struct output_ctx *octx)
 {
 	const struct expr *i;
 	const char *d = "";
 	int count = 0;
 
+	set_expr_resolve(expr, octx);
+
 	nft_print(octx, "{ ");
 
 	list_for_each_entry(i, &expr->expressions, list) {
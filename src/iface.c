@@ -21,8 +21,11 @@
 #include <netlink.h>
 #include <iface.h>
 
-static LIST_HEAD(iface_list);
-static bool iface_cache_init;
+struct iface_cache {
+	struct list_head	list;
+	bool			init;
+	bool			expired;
+};
 
 static int data_attr_cb(const struct nlattr *attr, void *data)
 {
@@ -48,18 +51,20 @@ static int data_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct nlattr *tb[IFLA_MAX + 1] = {};
 	struct ifinfomsg *ifm = mnl_nlmsg_get_payload(nlh);
+	struct iface_cache *cache = data;
 	struct iface *iface;
 
 	iface = xmalloc(sizeof(struct iface));
 	iface->ifindex = ifm->ifi_index;
 	mnl_attr_parse(nlh, sizeof(*ifm), data_attr_cb, tb);
 	snprintf(iface->name, IFNAMSIZ, "%s", mnl_attr_get_str(tb[IFLA_IFNAME]));
-	list_add(&iface->list, &iface_list);
+	list_add(&iface->list, &cache->list);
 
 	return MNL_CB_OK;
 }
 
-static int iface_mnl_talk(struct mnl_socket *nl, uint32_t portid)
+static int iface_mnl_talk(struct iface_cache *cache, struct mnl_socket *nl,
+			  uint32_t portid)
 {
 	char buf[MNL_SOCKET_BUFFER_SIZE];
 	struct nlmsghdr *nlh;
@@ -80,7 +85,7 @@ static int iface_mnl_talk(struct mnl_socket *nl, uint32_t portid)
 
 	ret = mnl_socket_recvfrom(nl, buf, sizeof(buf));
 	while (ret > 0) {
-		ret = mnl_cb_run(buf, ret, seq, portid, data_cb, NULL);
+		ret = mnl_cb_run(buf, ret, seq, portid, data_cb, cache);
 		if (ret == 0)
 			break;
 		if (ret < 0) {
@@ -101,7 +106,7 @@ static int iface_mnl_talk(struct mnl_socket *nl, uint32_t portid)
 	return ret;
 }
 
-void iface_cache_update(void)
+void iface_cache_update(struct iface_cache *cache)
 {
 	struct mnl_socket *nl;
 	uint32_t portid;
@@ -117,7 +122,7 @@ void iface_cache_update(void)
 	portid = mnl_socket_get_portid(nl);
 
 	do {
-		ret = iface_mnl_talk(nl, portid);
+		ret = iface_mnl_talk(cache, nl, portid);
 	} while (ret < 0 && errno == EINTR);
 
 	if (ret == -1)
@@ -125,49 +130,112 @@ void iface_cache_update(void)
 
 	mnl_socket_close(nl);
 
-	iface_cache_init = true;
+	cache->init = true;
+	cache->expired = false;
 }
 
-void iface_cache_release(void)
+struct iface_cache *iface_cache_alloc(void)
+{
+	struct iface_cache *cache;
+
+	cache = xzalloc(sizeof(*cache));
+	init_list_head(&cache->list);
+
+	return cache;
+}
+
+void iface_cache_release(struct iface_cache *cache)
 {
 	struct iface *iface, *next;
 
-	if (!iface_cache_init)
+	if (!cache->init)
 		return;
 
-	list_for_each_entry_safe(iface, next, &iface_list, list) {
+	list_for_each_entry_safe(iface, next, &cache->list, list) {
 		list_del(&iface->list);
 		free(iface);
 	}
-	iface_cache_init = false;
+	cache->init = false;
+	cache->expired = false;
 }
 
-unsigned int nft_if_nametoindex(const char *name)
+/* Fetch the list again on the first lookup of the next run, interfaces might
+ * have been added, removed or renamed meanwhile. Runs that do not look up any
+ * interface do not fetch it at all.
+ */
+void iface_cache_expire(struct iface_cache *cache)
 {
-	struct iface *iface;
+	if (cache->init)
+		cache->expired = true;
+}
+
+static void iface_cache_refresh(struct iface_cache *cache)
+{
+	iface_cache_release(cache);
+	iface_cache_update(cache);
+}
+
+void iface_cache_free(struct iface_cache *cache)
+{
+	if (!cache)
+		return;
 
-	if (!iface_cache_init)
-		iface_cache_update();
+	iface_cache_release(cache);
+	free(cache);
+}
+
+static struct iface *iface_lookup_name(struct iface_cache *cache,
+					const char *name)
+{
+	struct iface *iface;
 
-	list_for_each_entry(iface, &iface_list, list) {
+	list_for_each_entry(iface, &cache->list, list) {
 		if (strncmp(name, iface->name, IFNAMSIZ) == 0)
-			return iface->ifindex;
+			return iface;
 	}
-	return 0;
+	return NULL;
 }
 
-char *nft_if_indextoname(unsigned int ifindex, char *name)
+static struct iface *iface_lookup_index(struct iface_cache *cache,
+					 unsigned int ifindex)
 {
 	struct iface *iface;
 
-	if (!iface_cache_init)
-		iface_cache_update();
-
-	list_for_each_entry(iface, &iface_list, list) {
-		if (iface->ifindex == ifindex) {
-			snprintf(name, IFNAMSIZ, "%s", iface->name);
-			return name;
-		}
+	list_for_each_entry(iface, &cache->list, list) {
+		if (iface->ifindex == ifindex)
+			return iface;
 	}
 	return NULL;
 }
+
+unsigned int nft_if_nametoindex(struct iface_cache *cache, const char *name)
+{
+	struct iface *iface;
+
+	if (!cache->init)
+		iface_cache_update(cache);
+	else if (cache->expired)
+		iface_cache_refresh(cache);
+
+	iface = iface_lookup_name(cache, name);
+
+	return iface ? iface->ifindex : 0;
+}
+
+char *nft_if_indextoname(struct iface_cache *cache, unsigned int ifindex,
+			 char *name)
+{
+	struct iface *iface;
+
+	if (!cache->init)
+		iface_cache_update(cache);
+	else if (cache->expired)
+		iface_cache_refresh(cache);
+
+	iface = iface_lookup_index(cache, ifindex);
+	if (!iface)
+		return NULL;
+
+	snprintf(name, IFNAMSIZ, "%s", iface->name);
+	return name;
+}
@@ -614,6 +614,206 @@ err_out:
 	return err;
 }
 
+/* Elements that are released once they are in the batch, see
+ * nft_stream_cmds(), are not kept in the set. Their intervals are stored
+ * as big endian keys in sorted runs instead, so later elements are still
+ * checked against them. Runs of similar size are merged, there are never
+ * more than a few dozen of them.
+ */
+#define INTERVAL_RUNS_MAX	64
+
+struct interval_run {
+	unsigned int	num;
+	uint8_t		data[];
+};
+
+struct interval_runs {
+	unsigned int		keylen;
+	unsigned int		num_runs;
+	struct interval_run	*run[INTERVAL_RUNS_MAX];
+	uint64_t		nelems;
+	uint64_t		pending;
+};
+
+struct interval_runs *interval_runs_alloc(const struct set *set)
+{
+	struct interval_runs *runs;
+
+	runs = xzalloc(sizeof(*runs));
+	runs->keylen = div_round_up(set->key->len, BITS_PER_BYTE);
+
+	return runs;
+}
+
+void interval_runs_free(struct interval_runs *runs)
+{
+	unsigned int i;
+
+	if (!runs)
+		return;
+
+	for (i = 0; i < runs->num_runs; i++)
+		free(runs->run[i]);
+	free(runs);
+}
+
+static uint8_t *interval_run_low(const struct interval_runs *runs,
+				 const struct interval_run *run, unsigned int i)
+{
+	return (uint8_t *)run->data + i * 2 * runs->keylen;
+}
+
+static uint8_t *interval_run_high(const struct interval_runs *runs,
+				  const struct interval_run *run, unsigned int i)
+{
+	return interval_run_low(runs, run, i) + runs->keylen;
+}
+
+enum interval_run_match {
+	INTERVAL_RUN_NONE,
+	INTERVAL_RUN_EXISTS,
+	INTERVAL_RUN_OVERLAP,
+};
+
+/* Look for the last interval in @run that starts at or before @high. */
+static enum interval_run_match
+interval_run_find(const struct interval_runs *runs,
+		  const struct interval_run *run,
+		  const uint8_t *low, const uint8_t *high)
+{
+	unsigned int first = 0, last = run->num, mid;
+
+	while (first < last) {
+		mid = first + (last - first) / 2;
+		if (memcmp(interval_run_low(runs, run, mid), high,
+			   runs->keylen) <= 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	if (first == 0 ||
+	    memcmp(interval_run_high(runs, run, first - 1), low,
+		   runs->keylen) < 0)
+		return INTERVAL_RUN_NONE;
+
+	if (!memcmp(interval_run_low(runs, run, first - 1), low,
+		    runs->keylen) &&
+	    !memcmp(interval_run_high(runs, run, first - 1), high,
+		    runs->keylen))
+		return INTERVAL_RUN_EXISTS;
+
+	return INTERVAL_RUN_OVERLAP;
+}
+
+static struct interval_run *interval_run_merge(const struct interval_runs *runs,
+					       const struct interval_run *a,
+					       const struct interval_run *b)
+{
+	unsigned int i = 0, j = 0, k = 0, len = 2 * runs->keylen;
+	struct interval_run *run;
+
+	run = xmalloc(sizeof(*run) + (size_t)(a->num + b->num) * len);
+	run->num = a->num + b->num;
+
+	while (i < a->num || j < b->num) {
+		if (j == b->num ||
+		    (i < a->num &&
+		     memcmp(interval_run_low(runs, a, i),
+			    interval_run_low(runs, b, j), runs->keylen) < 0))
+			memcpy(interval_run_low(runs, run, k++),
+			       interval_run_low(runs, a, i++), len);
+		else
+			memcpy(interval_run_low(runs, run, k++),
+			       interval_run_low(runs, b, j++), len);
+	}
+
+	return run;
+}
+
+static void interval_runs_push(struct interval_runs *runs,
+			       struct interval_run *run)
+{
+	struct interval_run *a, *b;
+
+	runs->run[runs->num_runs++] = run;
+
+	while (runs->num_runs > 1) {
+		a = runs->run[runs->num_runs - 2];
+		b = runs->run[runs->num_runs - 1];
+		if (a->num > 2 * b->num &&
+		    runs->num_runs < INTERVAL_RUNS_MAX)
+			break;
+
+		runs->run[runs->num_runs - 2] = interval_run_merge(runs, a, b);
+		runs->num_runs--;
+		free(a);
+		free(b);
+	}
+}
+
+/* @init is sorted and holds no kernel elements at this point. */
+static int interval_runs_add(struct list_head *msgs,
+			     struct interval_runs *runs, struct expr *init)
+{
+	enum interval_run_match match;
+	struct interval_run *run;
+	struct expr *elem, *i;
+	unsigned int j, n = 0;
+	mpz_t low, high;
+	int err = 0;
+
+	run = xmalloc(sizeof(*run) + (size_t)init->size * 2 * runs->keylen);
+
+	mpz_init(low);
+	mpz_init(high);
+	list_for_each_entry(elem, &init->expressions, list) {
+		i = interval_expr_key(elem);
+		if (i->key->etype == EXPR_SET_ELEM_CATCHALL)
+			continue;
+
+		range_expr_value_low(low, i);
+		range_expr_value_high(high, i);
+		mpz_export_data(interval_run_low(runs, run, n), low,
+				BYTEORDER_BIG_ENDIAN, runs->keylen);
+		mpz_export_data(interval_run_high(runs, run, n), high,
+				BYTEORDER_BIG_ENDIAN, runs->keylen);
+
+		/* the same interval can be added again, as in setelem_overlap() */
+		match = INTERVAL_RUN_NONE;
+		for (j = 0; j < runs->num_runs && !match; j++)
+			match = interval_run_find(runs, runs->run[j],
+						  interval_run_low(runs, run, n),
+						  interval_run_high(runs, run, n));
+
+		switch (match) {
+		case INTERVAL_RUN_NONE:
+			n++;
+			break;
+		case INTERVAL_RUN_EXISTS:
+			break;
+		case INTERVAL_RUN_OVERLAP:
+			expr_error(msgs, i, "conflicting intervals specified");
+			err = -1;
+			goto err_out;
+		}
+	}
+	run->num = n;
+err_out:
+	mpz_clear(low);
+	mpz_clear(high);
+
+	if (err < 0 || !n) {
+		free(run);
+		return err;
+	}
+
+	interval_runs_push(runs, run);
+	runs->pending += n;
+
+	return 0;
+}
+
 /* overlap detection for intervals already exists in Linux kernels >= 5.7. */
 int set_overlap(struct list_head *msgs, struct set *set, struct expr *init)
 {
@@ -628,19 +828,26 @@ int set_overlap(struct list_head *msgs, struct set *set, struct expr *init)
 	list_for_each_entry_safe(i, n, &init->expressions, list) {
 		if (i->flags & EXPR_F_KERNEL)
 			list_move_tail(&i->list, &existing_set->init->expressions);
-		else if (existing_set) {
+		else if (existing_set && !set->runs) {
 			clone = expr_clone(i);
 			clone->flags |= EXPR_F_KERNEL;
 			list_add_tail(&clone->list, &existing_set->init->expressions);
 		}
 	}
 
+	if (!err && set->runs)
+		err = interval_runs_add(msgs, set->runs, init);
+
 	return err;
 }
 
 static bool segtree_needs_first_segment(const struct set *set,
 					const struct expr *init, bool add)
 {
+	/* intervals of earlier elements are in the batch already. */
+	if (set->runs && set->runs->nelems)
+		return false;
+
 	if (add && !set->root) {
 		/* Add the first segment in four situations:
 		 *
@@ -753,6 +960,11 @@ int set_to_intervals(const struct set *set, struct expr *init, bool add)
 
 	list_splice_init(&intervals, &init->expressions);
 
+	if (add && set->runs) {
+		set->runs->nelems += set->runs->pending;
+		set->runs->pending = 0;
+	}
+
 	mpz_clear(p);
 	mpz_clear(q);
 
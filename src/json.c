@@ -311,11 +311,11 @@ static json_t *chain_print_json(const struct chain *chain)
 	return json_pack("{s:o}", "chain", root);
 }
 
-static json_t *proto_name_json(uint8_t proto)
+static json_t *proto_name_json(uint8_t proto, struct output_ctx *octx)
 {
 	char name[NFT_PROTONAME_MAXSIZE];
 
-	if (nft_getprotobynumber(proto, name, sizeof(name)))
+	if (nft_getprotobynumber(octx->tbl.netdb, proto, name, sizeof(name)))
 		return json_string(name);
 	return json_integer(proto);
 }
@@ -337,7 +337,7 @@ static json_t *timeout_policy_json(uint8_t l4, const uint32_t *timeout)
 	return root ? : json_null();
 }
 
-static json_t *obj_print_json(const struct obj *obj)
+static json_t *obj_print_json(struct output_ctx *octx, const struct obj *obj)
 {
 	const char *rate_unit = NULL, *burst_unit = NULL;
 	const char *type = obj_type_name(obj->type);
@@ -381,7 +381,7 @@ static json_t *obj_print_json(const struct obj *obj)
 	case NFT_OBJECT_CT_HELPER:
 		tmp = json_pack("{s:s, s:o, s:s}",
 				"type", obj->ct_helper.name, "protocol",
-				proto_name_json(obj->ct_helper.l4proto),
+				proto_name_json(obj->ct_helper.l4proto, octx),
 				"l3proto", family2str(obj->ct_helper.l3proto));
 		json_object_update(root, tmp);
 		json_decref(tmp);
@@ -391,7 +391,7 @@ static json_t *obj_print_json(const struct obj *obj)
 					  obj->ct_timeout.timeout);
 		tmp = json_pack("{s:o, s:s, s:o}",
 				"protocol",
-				proto_name_json(obj->ct_timeout.l4proto),
+				proto_name_json(obj->ct_timeout.l4proto, octx),
 				"l3proto", family2str(obj->ct_timeout.l3proto),
 				"policy", tmp);
 		json_object_update(root, tmp);
@@ -400,7 +400,7 @@ static json_t *obj_print_json(const struct obj *obj)
 	case NFT_OBJECT_CT_EXPECT:
 		tmp = json_pack("{s:o, s:I, s:I, s:I, s:s}",
 				"protocol",
-				proto_name_json(obj->ct_expect.l4proto),
+				proto_name_json(obj->ct_expect.l4proto, octx),
 				"dport", obj->ct_expect.dport,
 				"timeout", obj->ct_expect.timeout,
 				"size", obj->ct_expect.size,
@@ -658,6 +658,8 @@ json_t *set_expr_json(const struct expr *expr, struct output_ctx *octx)
 	json_t *array = json_array();
 	const struct expr *i;
 
+	set_expr_resolve(expr, octx);
+
 	list_for_each_entry(i, &expr->expressions, list)
 		json_array_append_new(array, expr_print_json(i, octx));
 
@@ -959,11 +961,8 @@ static json_t *symbolic_constant_json(const struct symbol_table *tbl,
 	mpz_export_data(constant_data_ptr(val, expr->len), expr->value,
 			expr->byteorder, len);
 
-	for (s = tbl->symbols; s->identifier != NULL; s++) {
-		if (val == s->value)
-			break;
-	}
-	if (!s->identifier)
+	s = symbol_table_lookup_value(tbl, val);
+	if (!s)
 		return expr_basetype(expr)->json(expr, octx);
 
 	if (nft_output_numeric_symbol(octx))
@@ -1127,7 +1126,9 @@ json_t *inet_protocol_type_json(const struct expr *expr,
 	if (!nft_output_numeric_proto(octx)) {
 		char name[NFT_PROTONAME_MAXSIZE];
 
-		if (nft_getprotobynumber(mpz_get_uint8(expr->value), name, sizeof(name)))
+		if (nft_getprotobynumber(octx->tbl.netdb,
+					 mpz_get_uint8(expr->value),
+					 name, sizeof(name)))
 			return json_string(name);
 	}
 	return integer_type_json(expr, octx);
@@ -1139,7 +1140,8 @@ json_t *inet_service_type_json(const struct expr *expr, struct output_ctx *octx)
 	char name[NFT_SERVNAME_MAXSIZE];
 
 	if (!nft_output_service(octx) ||
-	    !nft_getservbyport(port, NULL, name, sizeof(name)))
+	    !nft_getservbyport(octx->tbl.netdb, port, NULL,
+			       name, sizeof(name)))
 		return json_integer(ntohs(port));
 
 	return json_string(name);
@@ -1731,7 +1733,7 @@ static json_t *table_print_json_full(struct netlink_ctx *ctx,
 		json_array_append_new(root, tmp);
 	}
 	list_for_each_entry(obj, &table->obj_cache.list, cache.list) {
-		tmp = obj_print_json(obj);
+		tmp = obj_print_json(&ctx->nft->output, obj);
 		json_array_append_new(root, tmp);
 	}
 	list_for_each_entry(set, &table->set_cache.list, cache.list) {
@@ -1906,7 +1908,8 @@ static json_t *do_list_obj_json(struct netlink_ctx *ctx,
 			     strcmp(cmd->handle.obj.name, obj->handle.obj.name)))
 				continue;
 
-			json_array_append_new(root, obj_print_json(obj));
+			json_array_append_new(root,
+					      obj_print_json(&ctx->nft->output, obj));
 		}
 	}
 
@@ -2094,7 +2097,9 @@ void monitor_print_element_json(struct netlink_mon_handler *monh,
 void monitor_print_obj_json(struct netlink_mon_handler *monh,
 			    const char *cmd, struct obj *o)
 {
-	monitor_print_json(monh, cmd, obj_print_json(o));
+	struct output_ctx *octx = &monh->ctx->nft->output;
+
+	monitor_print_json(monh, cmd, obj_print_json(octx, o));
 }
 
 void monitor_print_rule_json(struct netlink_mon_handler *monh,
@@ -2105,6 +2110,18 @@ void monitor_print_rule_json(struct netlink_mon_handler *monh,
 	monitor_print_json(monh, cmd, rule_print_json(octx, r));
 }
 
+void monitor_print_lost_json(struct netlink_mon_handler *monh)
+{
+	monitor_print_json(monh, "lost", json_object());
+}
+
+void monitor_print_resync_json(struct netlink_mon_handler *monh,
+			       uint32_t genid)
+{
+	monitor_print_json(monh, "resync", json_pack("{s:I}", "genid",
+						     (json_int_t)genid));
+}
+
 void json_alloc_echo(struct nft_ctx *nft)
 {
 	nft->json_echo = json_array();
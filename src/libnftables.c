@@ -14,59 +14,70 @@
 #include <parser.h>
 #include <utils.h>
 #include <iface.h>
+#include <resolve.h>
 #include <cmd.h>
+#include <cache.h>
+#include <intervals.h>
 #include <errno.h>
+#include "nftutils.h"
 #include <sys/stat.h>
 #include <libgen.h>
 
-static int nft_netlink(struct nft_ctx *nft,
-		       struct list_head *cmds, struct list_head *msgs)
+static bool cmd_seqnum_match(const struct cmd *cmd, uint32_t seqnum)
 {
-	uint32_t batch_seqnum, seqnum = 0, last_seqnum = UINT32_MAX, num_cmds = 0;
-	struct netlink_ctx ctx = {
-		.nft  = nft,
-		.msgs = msgs,
-		.list = LIST_HEAD_INIT(ctx.list),
-		.batch = mnl_batch_init(),
-	};
-	struct cmd *cmd;
-	struct mnl_err *err, *tmp;
-	LIST_HEAD(err_list);
-	int ret = 0;
+	return seqnum >= cmd->seqnum && seqnum <= cmd->seqnum_last;
+}
 
-	if (list_empty(cmds))
-		goto out;
+static int nft_netlink_cmds(struct netlink_ctx *ctx, struct list_head *cmds,
+			    uint32_t *seqnum)
+{
+	struct cmd *cmd;
+	int ret;
 
-	batch_seqnum = mnl_batch_begin(ctx.batch, mnl_seqnum_alloc(&seqnum));
 	list_for_each_entry(cmd, cmds, list) {
-		ctx.seqnum = cmd->seqnum = mnl_seqnum_alloc(&seqnum);
-		ret = do_command(&ctx, cmd);
+		ctx->seqnum = cmd->seqnum = mnl_seqnum_alloc(seqnum);
+		ret = do_command(ctx, cmd);
 		if (ret < 0) {
-			netlink_io_error(&ctx, &cmd->location,
+			netlink_io_error(ctx, &cmd->location,
 					 "Could not process rule: %s",
 					 strerror(errno));
-			goto out;
+			return ret;
 		}
-		num_cmds++;
+		/* element commands take one seqnum per message. */
+		cmd->seqnum_last = ctx->seqnum;
+		*seqnum = ctx->seqnum + 1;
 	}
-	if (!nft->check)
-		mnl_batch_end(ctx.batch, mnl_seqnum_alloc(&seqnum));
 
-	if (!mnl_batch_ready(ctx.batch))
-		goto out;
+	return 0;
+}
+
+static int nft_netlink_commit(struct netlink_ctx *ctx, struct list_head *cmds,
+			      uint32_t batch_seqnum, uint32_t seqnum)
+{
+	struct cmd *cmd = list_first_entry(cmds, struct cmd, list);
+	uint32_t last_seqnum = UINT32_MAX;
+	struct mnl_err *err, *tmp;
+	LIST_HEAD(err_list);
+	int ret;
 
-	ret = mnl_batch_talk(&ctx, &err_list, num_cmds);
+	if (!ctx->nft->check)
+		mnl_batch_end(ctx->batch, mnl_seqnum_alloc(&seqnum));
+
+	if (!mnl_batch_ready(ctx->batch))
+		return 0;
+
+	ret = mnl_batch_talk(ctx, &err_list);
 	if (ret < 0) {
-		if (ctx.maybe_emsgsize && errno == EMSGSIZE) {
-			netlink_io_error(&ctx, NULL,
+		if (ctx->maybe_emsgsize && errno == EMSGSIZE) {
+			netlink_io_error(ctx, NULL,
 					 "Could not process rule: %s\n"
 					 "Please, rise /proc/sys/net/core/wmem_max on the host namespace. Hint: %d bytes",
-					 strerror(errno), round_pow_2(ctx.maybe_emsgsize));
-			goto out;
+					 strerror(errno), round_pow_2(ctx->maybe_emsgsize));
+			return ret;
 		}
-		netlink_io_error(&ctx, NULL,
+		netlink_io_error(ctx, NULL,
 				 "Could not process rule: %s", strerror(errno));
-		goto out;
+		return ret;
 	}
 
 	if (!list_empty(&err_list))
@@ -81,11 +92,11 @@ static int nft_netlink(struct nft_ctx *nft,
 
 		list_for_each_entry_from(cmd, cmds, list) {
 			last_seqnum = cmd->seqnum;
-			if (err->seqnum == cmd->seqnum ||
+			if (cmd_seqnum_match(cmd, err->seqnum) ||
 			    err->seqnum == batch_seqnum) {
-				nft_cmd_error(&ctx, cmd, err);
+				nft_cmd_error(ctx, cmd, err);
 				errno = err->err;
-				if (err->seqnum == cmd->seqnum) {
+				if (cmd_seqnum_match(cmd, err->seqnum)) {
 					mnl_err_list_free(err);
 					break;
 				}
@@ -103,6 +114,29 @@ static int nft_netlink(struct nft_ctx *nft,
 	 */
 	list_for_each_entry_safe(err, tmp, &err_list, head)
 		mnl_err_list_free(err);
+
+	return ret;
+}
+
+static int nft_netlink(struct nft_ctx *nft,
+		       struct list_head *cmds, struct list_head *msgs)
+{
+	uint32_t batch_seqnum, seqnum = 0;
+	struct netlink_ctx ctx = {
+		.nft  = nft,
+		.msgs = msgs,
+		.list = LIST_HEAD_INIT(ctx.list),
+		.batch = mnl_batch_init(),
+	};
+	int ret = 0;
+
+	if (list_empty(cmds))
+		goto out;
+
+	batch_seqnum = mnl_batch_begin(ctx.batch, mnl_seqnum_alloc(&seqnum));
+	ret = nft_netlink_cmds(&ctx, cmds, &seqnum);
+	if (ret == 0)
+		ret = nft_netlink_commit(&ctx, cmds, batch_seqnum, seqnum);
 out:
 	mnl_batch_reset(ctx.batch);
 	return ret;
@@ -114,11 +148,17 @@ static void nft_init(struct nft_ctx *ctx)
 	realm_table_rt_init(ctx);
 	devgroup_table_init(ctx);
 	ct_label_table_init(ctx);
+	ctx->output.tbl.netdb = nft_netdb_alloc();
+	ctx->output.tbl.dns = nft_dns_cache_alloc();
+	ctx->output.tbl.iface = iface_cache_alloc();
 }
 
 static void nft_exit(struct nft_ctx *ctx)
 {
 	cache_free(&ctx->cache.table_cache);
+	nft_netdb_free(ctx->output.tbl.netdb);
+	nft_dns_cache_free(ctx->output.tbl.dns);
+	iface_cache_free(ctx->output.tbl.iface);
 	ct_label_table_exit(ctx);
 	realm_table_rt_exit(ctx);
 	devgroup_table_exit(ctx);
@@ -211,6 +251,7 @@ struct nft_ctx *nft_ctx_new(uint32_t flags)
 	init_list_head(&ctx->vars_ctx.indesc_list);
 
 	ctx->nf_sock = nft_mnl_socket_open();
+	mnl_dump_workers_init(ctx);
 
 	return ctx;
 }
@@ -335,19 +376,61 @@ EXPORT_SYMBOL(nft_ctx_free);
 void nft_ctx_free(struct nft_ctx *ctx)
 {
 	mnl_socket_close(ctx->nf_sock);
+	free(ctx->nl_rxbuf);
+	mnl_dump_workers_free(ctx);
 
 	exit_cookie(&ctx->output.output_cookie);
 	exit_cookie(&ctx->output.error_cookie);
-	iface_cache_release();
+	nft_ctx_session_end(ctx);
 	nft_cache_release(&ctx->cache);
+	nft_cache_events_close(&ctx->cache);
 	nft_ctx_clear_vars(ctx);
 	nft_ctx_clear_include_paths(ctx);
 	scope_free(ctx->top_scope);
 	free(ctx->state);
+	json_parse_state_free(ctx);
 	nft_exit(ctx);
 	free(ctx);
 }
 
+EXPORT_SYMBOL(nft_ctx_netdb_refresh);
+void nft_ctx_netdb_refresh(struct nft_ctx *ctx)
+{
+	nft_netdb_flush(ctx->output.tbl.netdb);
+}
+
+EXPORT_SYMBOL(nft_ctx_session_begin);
+int nft_ctx_session_begin(struct nft_ctx *ctx)
+{
+	if (ctx->session.active)
+		return -1;
+
+	ctx->session.active = true;
+	ctx->session.cache_mode = ctx->cache.mode;
+	ctx->cache.mode |= NFT_CTX_CACHE_INCREMENTAL;
+
+	return 0;
+}
+
+EXPORT_SYMBOL(nft_ctx_session_end);
+void nft_ctx_session_end(struct nft_ctx *ctx)
+{
+	if (!ctx->session.active)
+		return;
+
+	ctx->session.active = false;
+	nft_ctx_cache_set_flags(ctx, ctx->session.cache_mode);
+
+	iface_cache_release(ctx->output.tbl.iface);
+	if (ctx->scanner) {
+		scanner_destroy(ctx);
+		ctx->scanner = NULL;
+	}
+	free(ctx->session.buf);
+	ctx->session.buf = NULL;
+	ctx->session.buflen = 0;
+}
+
 EXPORT_SYMBOL(nft_ctx_set_output);
 FILE *nft_ctx_set_output(struct nft_ctx *ctx, FILE *fp)
 {
@@ -414,6 +497,25 @@ unsigned int nft_ctx_input_set_flags(struct nft_ctx *ctx, unsigned int flags)
 	return old_flags;
 }
 
+EXPORT_SYMBOL(nft_ctx_cache_get_flags);
+unsigned int nft_ctx_cache_get_flags(struct nft_ctx *ctx)
+{
+	return ctx->cache.mode;
+}
+
+EXPORT_SYMBOL(nft_ctx_cache_set_flags);
+unsigned int nft_ctx_cache_set_flags(struct nft_ctx *ctx, unsigned int flags)
+{
+	unsigned int old_flags;
+
+	old_flags = ctx->cache.mode;
+	ctx->cache.mode = flags;
+	if (!(flags & NFT_CTX_CACHE_INCREMENTAL))
+		nft_cache_events_close(&ctx->cache);
+
+	return old_flags;
+}
+
 EXPORT_SYMBOL(nft_ctx_output_get_flags);
 unsigned int nft_ctx_output_get_flags(struct nft_ctx *ctx)
 {
@@ -449,7 +551,8 @@ static int nft_parse_bison_buffer(struct nft_ctx *nft, const char *buf,
 	int ret;
 
 	parser_init(nft, nft->state, msgs, cmds, nft->top_scope);
-	nft->scanner = scanner_init(nft->state);
+	if (!nft->scanner)
+		nft->scanner = scanner_init(nft->state);
 	scanner_push_buffer(nft->scanner, indesc, buf);
 
 	ret = nft_parse(nft, nft->scanner, nft->state);
@@ -496,7 +599,8 @@ static int nft_parse_bison_filename(struct nft_ctx *nft, const char *filename,
 					      &indesc_stdin);
 
 	parser_init(nft, nft->state, msgs, cmds, nft->top_scope);
-	nft->scanner = scanner_init(nft->state);
+	if (!nft->scanner)
+		nft->scanner = scanner_init(nft->state);
 	if (scanner_read_file(nft, filename, &internal_location) < 0)
 		return -1;
 
@@ -507,27 +611,14 @@ static int nft_parse_bison_filename(struct nft_ctx *nft, const char *filename,
 	return 0;
 }
 
-static int nft_evaluate(struct nft_ctx *nft, struct list_head *msgs,
-			struct list_head *cmds)
+static int nft_evaluate_cmds(struct nft_ctx *nft, struct list_head *msgs,
+			     struct list_head *cmds,
+			     struct set_intern *set_intern)
 {
-	struct nft_cache_filter *filter;
 	struct cmd *cmd, *next;
 	bool collapsed = false;
-	unsigned int flags;
 	int err = 0;
 
-	filter = nft_cache_filter_init();
-	if (nft_cache_evaluate(nft, cmds, msgs, filter, &flags) < 0) {
-		nft_cache_filter_fini(filter);
-		return -1;
-	}
-	if (nft_cache_update(nft, flags, msgs, filter) < 0) {
-		nft_cache_filter_fini(filter);
-		return -1;
-	}
-
-	nft_cache_filter_fini(filter);
-
 	if (nft_cmd_collapse(cmds))
 		collapsed = true;
 
@@ -541,8 +632,9 @@ static int nft_evaluate(struct nft_ctx *nft, struct list_head *msgs,
 
 	list_for_each_entry_safe(cmd, next, cmds, list) {
 		struct eval_ctx ectx = {
-			.nft	= nft,
-			.msgs	= msgs,
+			.nft		= nft,
+			.msgs		= msgs,
+			.set_intern	= set_intern,
 		};
 
 		if (cmd_evaluate(&ectx, cmd) < 0 &&
@@ -555,12 +647,360 @@ static int nft_evaluate(struct nft_ctx *nft, struct list_head *msgs,
 	if (collapsed)
 		nft_cmd_uncollapse(cmds);
 
+	return err;
+}
+
+static int nft_evaluate(struct nft_ctx *nft, struct list_head *msgs,
+			struct list_head *cmds)
+{
+	struct set_intern set_intern = {};
+	struct nft_cache_filter *filter;
+	unsigned int flags;
+	int err;
+
+	filter = nft_cache_filter_init();
+	if (nft_cache_evaluate(nft, cmds, msgs, filter, &flags) < 0) {
+		nft_cache_filter_fini(filter);
+		return -1;
+	}
+	if (nft_cache_update(nft, flags, msgs, filter) < 0) {
+		nft_cache_filter_fini(filter);
+		return -1;
+	}
+
+	nft_cache_filter_fini(filter);
+
+	err = nft_evaluate_cmds(nft, msgs, cmds, &set_intern);
+
+	if (nft->debug_mask & NFT_DEBUG_EVALUATION && set_intern.nelems)
+		nft_print(&nft->output,
+			  "anonymous interval sets: %u evaluated, %u reused\n\n",
+			  set_intern.nelems, set_intern.hits);
+	set_intern_release(&set_intern);
+
 	if (err < 0 || nft->state->nerrs)
 		return -1;
 
 	return 0;
 }
 
+/* With NFT_CTX_INPUT_STREAM, element commands with more than NFT_STREAM_ELEMS
+ * elements in a file are evaluated and added to the batch while the file is
+ * still being parsed, their elements are released right after, see
+ * nft_cmd_release_elems(). Commands before them go along. JSON input is
+ * streamed one command at a time. The batch is only sent once the whole file
+ * is parsed, so this is still one transaction. Intervals are checked for overlaps
+ * against those that were already released, see struct interval_runs.
+ *
+ * If anything fails or a later command needs more than the cache that was
+ * built for the first chunk, the file is run again without streaming, so
+ * errors are reported as usual.
+ */
+struct nft_stream {
+	struct netlink_ctx	ctx;
+	struct list_head	cmds;
+	struct set_intern	set_intern;
+	unsigned int		cache_flags;
+	uint32_t		batch_seqnum;
+	uint32_t		seqnum;
+	bool			started;
+	bool			fallback;
+	struct {
+		bool		active;
+		enum cmd_ops	op;
+		struct handle	handle;
+		struct location	location;
+	} elems;
+};
+
+static struct nft_stream *nft_stream_alloc(struct nft_ctx *nft,
+					   struct list_head *msgs)
+{
+	struct nft_stream *stream;
+
+	stream = xzalloc(sizeof(*stream));
+	stream->ctx.nft = nft;
+	stream->ctx.msgs = msgs;
+	init_list_head(&stream->ctx.list);
+	init_list_head(&stream->cmds);
+
+	return stream;
+}
+
+static void nft_stream_free(struct nft_ctx *nft)
+{
+	struct nft_stream *stream = nft->stream;
+	struct table *table;
+	struct set *set;
+
+	if (stream->started) {
+		mnl_batch_reset(stream->ctx.batch);
+
+		list_for_each_entry(table, &nft->cache.table_cache.list, cache.list) {
+			list_for_each_entry(set, &table->set_cache.list, cache.list) {
+				interval_runs_free(set->runs);
+				set->runs = NULL;
+			}
+		}
+	}
+	set_intern_release(&stream->set_intern);
+	free(stream);
+	nft->stream = NULL;
+}
+
+/* The file is read again if streaming does not work out. */
+static bool nft_stream_supported(struct nft_ctx *nft, const char *filename)
+{
+	struct stat sb;
+
+	if (!nft_input_stream(&nft->input) ||
+	    nft->optimize_flags ||
+	    nft_output_echo(&nft->output))
+		return false;
+
+	if (nft->stdin_buf)
+		return true;
+
+	return stat(filename, &sb) == 0 && S_ISREG(sb.st_mode);
+}
+
+bool nft_stream_started(const struct nft_ctx *nft)
+{
+	return nft->stream && nft->stream->started;
+}
+
+/* Elements that are released cannot be deleted again in the same batch. */
+static bool nft_stream_cmds_supported(const struct list_head *cmds)
+{
+	const struct cmd *cmd;
+
+	list_for_each_entry(cmd, cmds, list) {
+		if (cmd->obj == CMD_OBJ_ELEMENTS &&
+		    cmd->op != CMD_ADD &&
+		    cmd->op != CMD_CREATE)
+			return false;
+	}
+
+	return true;
+}
+
+static int nft_stream_cache(struct nft_ctx *nft, struct nft_stream *stream,
+			    struct list_head *cmds)
+{
+	struct nft_cache_filter *filter;
+	unsigned int flags;
+	int ret;
+
+	filter = nft_cache_filter_init();
+	ret = nft_cache_evaluate(nft, cmds, stream->ctx.msgs, filter, &flags);
+	if (ret < 0)
+		goto out;
+
+	if (!stream->started) {
+		/* objects that later commands in the file might refer to. */
+		flags |= NFT_CACHE_TABLE |
+			 NFT_CACHE_CHAIN |
+			 NFT_CACHE_SET |
+			 NFT_CACHE_OBJECT |
+			 NFT_CACHE_FLOWTABLE;
+		ret = nft_cache_update(nft, flags, stream->ctx.msgs, filter);
+		stream->cache_flags = flags;
+	} else if (!(stream->cache_flags & NFT_CACHE_FLUSHED) &&
+		   flags & ~stream->cache_flags) {
+		ret = -1;
+	}
+out:
+	nft_cache_filter_fini(filter);
+
+	return ret;
+}
+
+static void nft_stream_fallback(struct nft_stream *stream,
+				struct list_head *cmds)
+{
+	struct cmd *cmd, *next;
+
+	stream->fallback = true;
+
+	/* the file is parsed again, drop what is left. */
+	list_for_each_entry_safe(cmd, next, cmds, list) {
+		list_del(&cmd->list);
+		cmd_free(cmd);
+	}
+}
+
+/* Evaluate the commands parsed so far and add them to the batch. */
+void nft_stream_cmds(struct nft_ctx *nft, struct list_head *cmds)
+{
+	struct nft_stream *stream = nft->stream;
+	struct cmd *cmd, *next;
+
+	if (!stream || list_empty(cmds))
+		return;
+
+	if (stream->fallback ||
+	    nft->state->nerrs ||
+	    !nft_stream_cmds_supported(cmds) ||
+	    nft_stream_cache(nft, stream, cmds) < 0) {
+		nft_stream_fallback(stream, cmds);
+		return;
+	}
+
+	if (!stream->started) {
+		stream->ctx.batch = mnl_batch_init();
+		stream->batch_seqnum =
+			mnl_batch_begin(stream->ctx.batch,
+					mnl_seqnum_alloc(&stream->seqnum));
+		stream->started = true;
+	}
+
+	if (nft_evaluate_cmds(nft, stream->ctx.msgs, cmds,
+			      &stream->set_intern) < 0 ||
+	    nft->state->nerrs ||
+	    nft_netlink_cmds(&stream->ctx, cmds, &stream->seqnum) < 0) {
+		nft_stream_fallback(stream, cmds);
+		return;
+	}
+
+	list_for_each_entry_safe(cmd, next, cmds, list) {
+		if (cmd->obj == CMD_OBJ_ELEMENTS)
+			nft_cmd_release_elems(cmd);
+
+		list_move_tail(&cmd->list, &stream->cmds);
+	}
+}
+
+/* The input can not be parsed in one go after all, the file is run again. */
+void nft_stream_cancel(struct nft_ctx *nft)
+{
+	if (nft->stream)
+		nft->stream->fallback = true;
+}
+
+/* A single element command in the file, its elements are streamed in chunks
+ * while they are parsed, see nft_stream_elems().
+ */
+void nft_stream_elems_begin(struct nft_ctx *nft, enum cmd_ops op,
+			    const struct handle *h,
+			    const struct location *loc)
+{
+	struct nft_stream *stream = nft->stream;
+
+	if (!stream)
+		return;
+
+	stream->elems.active = true;
+	stream->elems.op = op;
+	stream->elems.handle = *h;
+	stream->elems.location = *loc;
+}
+
+void nft_stream_elems(struct nft_ctx *nft, struct list_head *cmds,
+		      struct expr *set)
+{
+	struct nft_stream *stream = nft->stream;
+	struct handle h = {};
+	struct expr *chunk, *last;
+	struct cmd *cmd;
+
+	/* after a syntax error, the command might have been dropped. */
+	if (!stream || !stream->elems.active || stream->fallback ||
+	    nft->state->nerrs || set->size <= NFT_STREAM_ELEMS)
+		return;
+
+	/* the command is still being parsed, leave one element to it. */
+	last = list_entry(set->expressions.prev, struct expr, list);
+	chunk = set_expr_alloc(&set->location, NULL);
+	list_splice_init(&set->expressions, &chunk->expressions);
+	list_move_tail(&last->list, &set->expressions);
+	chunk->size = set->size - 1;
+	set->size = 1;
+
+	handle_merge(&h, &stream->elems.handle);
+	cmd = cmd_alloc(stream->elems.op, CMD_OBJ_ELEMENTS, &h,
+			&stream->elems.location, chunk);
+	list_add_tail(&cmd->list, cmds);
+
+	nft_stream_cmds(nft, cmds);
+}
+
+void nft_stream_elems_end(struct nft_ctx *nft)
+{
+	if (nft->stream)
+		nft->stream->elems.active = false;
+}
+
+/* The whole file is parsed, add what is left and send the batch. */
+static int nft_stream_commit(struct nft_ctx *nft, struct list_head *cmds,
+			     int parser_rc)
+{
+	struct nft_stream *stream = nft->stream;
+
+	if (parser_rc)
+		nft_stream_fallback(stream, cmds);
+	else
+		nft_stream_cmds(nft, cmds);
+
+	list_splice_init(&stream->cmds, cmds);
+	if (stream->fallback)
+		return -1;
+
+	return nft_netlink_commit(&stream->ctx, cmds, stream->batch_seqnum,
+				  stream->seqnum);
+}
+
+/* The scanner expects a trailing newline. A session keeps the copy of the
+ * command around for the next one.
+ */
+static char *nft_cmd_buffer(struct nft_ctx *nft, const char *buf)
+{
+	size_t len = strlen(buf);
+	char *nlbuf;
+
+	if (!nft->session.active) {
+		nlbuf = xmalloc(len + 2);
+	} else {
+		if (nft->session.buflen < len + 2) {
+			free(nft->session.buf);
+			nft->session.buflen = len + 2;
+			nft->session.buf = xmalloc(nft->session.buflen);
+		}
+		nlbuf = nft->session.buf;
+	}
+	memcpy(nlbuf, buf, len);
+	nlbuf[len] = '\n';
+	nlbuf[len + 1] = '\0';
+
+	return nlbuf;
+}
+
+/* Release what was built for this run only. A session keeps the interface
+ * list for the next command.
+ */
+static void nft_run_release(struct nft_ctx *nft)
+{
+	nft_dns_cache_flush(nft->output.tbl.dns);
+
+	if (nft->session.active)
+		iface_cache_expire(nft->output.tbl.iface);
+	else
+		iface_cache_release(nft->output.tbl.iface);
+
+	if (nft->scanner) {
+		scanner_destroy(nft);
+		nft->scanner = NULL;
+	}
+}
+
+/* Objects that failed or --check commands left in the cache are marked stale
+ * in incremental mode, a session does not need to drop the whole cache then.
+ */
+static bool nft_cache_keep(const struct nft_ctx *nft)
+{
+	return nft->session.active &&
+	       nft->cache.mode & NFT_CTX_CACHE_INCREMENTAL;
+}
+
 EXPORT_SYMBOL(nft_run_cmd_from_buffer);
 int nft_run_cmd_from_buffer(struct nft_ctx *nft, const char *buf)
 {
@@ -570,8 +1010,7 @@ int nft_run_cmd_from_buffer(struct nft_ctx *nft, const char *buf)
 	LIST_HEAD(cmds);
 	char *nlbuf;
 
-	nlbuf = xzalloc(strlen(buf) + 2);
-	sprintf(nlbuf, "%s\n", buf);
+	nlbuf = nft_cmd_buffer(nft, buf);
 
 	if (nft_output_json(&nft->output) || nft_input_json(&nft->input))
 		rc = nft_parse_json_buffer(nft, nlbuf, &msgs, &cmds);
@@ -598,24 +1037,23 @@ int nft_run_cmd_from_buffer(struct nft_ctx *nft, const char *buf)
 	if (nft_netlink(nft, &cmds, &msgs) != 0)
 		rc = -1;
 err:
+	nft_print_flush(&nft->output);
 	erec_print_list(&nft->output, &msgs, nft->debug_mask);
+	nft_cache_mark_stale(&nft->cache, &cmds);
 	list_for_each_entry_safe(cmd, next, &cmds, list) {
 		list_del(&cmd->list);
 		cmd_free(cmd);
 	}
-	iface_cache_release();
-	if (nft->scanner) {
-		scanner_destroy(nft);
-		nft->scanner = NULL;
-	}
-	free(nlbuf);
+	nft_run_release(nft);
+	if (nlbuf != nft->session.buf)
+		free(nlbuf);
 
 	if (!rc &&
 	    nft_output_json(&nft->output) &&
 	    nft_output_echo(&nft->output))
 		json_print_echo(nft);
 
-	if (rc || nft->check)
+	if ((rc || nft->check) && !nft_cache_keep(nft))
 		nft_cache_release(&nft->cache);
 
 	return rc;
@@ -688,10 +1126,45 @@ static struct error_record *filename_is_useable(struct nft_ctx *nft, const char
 	return error(&internal_location, "Not a regular file: \"%s\"\n", name);
 }
 
-static int __nft_run_cmd_from_filename(struct nft_ctx *nft, const char *filename)
+/* Merge proposals are only shown once the optimized ruleset evaluates. The
+ * optimizer writes to both the output and the error stream, both go to one
+ * buffer to keep their order, it is printed to the error stream later on.
+ */
+static char *nft_optimize_held(struct nft_ctx *nft, struct list_head *cmds)
+{
+	FILE *output_fp = nft->output.output_fp;
+	FILE *error_fp = nft->output.error_fp;
+	size_t size;
+	char *text;
+	FILE *fp;
+
+	fp = open_memstream(&text, &size);
+	if (!fp) {
+		nft_optimize(nft, cmds);
+		return NULL;
+	}
+
+	nft->output.output_fp = fp;
+	nft->output.error_fp = fp;
+	nft_optimize(nft, cmds);
+	nft->output.output_fp = output_fp;
+	nft->output.error_fp = error_fp;
+
+	if (fclose(fp)) {
+		free(text);
+		return NULL;
+	}
+
+	return text;
+}
+
+static int __nft_run_cmd_from_filename(struct nft_ctx *nft, const char *filename,
+				       bool *retry, bool unmerged)
 {
 	struct error_record *erec;
+	char *held = NULL;
 	struct cmd *cmd, *next;
+	bool optimized = false;
 	int rc, parser_rc;
 	LIST_HEAD(msgs);
 	LIST_HEAD(cmds);
@@ -707,6 +1180,9 @@ static int __nft_run_cmd_from_filename(struct nft_ctx *nft, const char *filename
 	if (rc < 0)
 		goto err;
 
+	if (retry && nft_stream_supported(nft, filename))
+		nft->stream = nft_stream_alloc(nft, &msgs);
+
 	rc = -EINVAL;
 	if (nft_output_json(&nft->output) || nft_input_json(&nft->input))
 		rc = nft_parse_json_filename(nft, filename, &msgs, &cmds);
@@ -715,31 +1191,66 @@ static int __nft_run_cmd_from_filename(struct nft_ctx *nft, const char *filename
 
 	parser_rc = rc;
 
-	if (nft->optimize_flags)
-		nft_optimize(nft, &cmds);
+	if (nft_stream_started(nft)) {
+		rc = nft_stream_commit(nft, &cmds, parser_rc);
+		if (nft->stream->fallback) {
+			erec_free_list(&msgs);
+			*retry = true;
+		}
+		nft_stream_free(nft);
+		if (*retry)
+			nft_cache_release(&nft->cache);
+		goto err;
+	} else if (nft->stream) {
+		nft_stream_free(nft);
+	}
+
+	/* The optimizer relies on the ruleset to be well-formed, leave it alone
+	 * if parsing failed so errors refer to the ruleset as written.
+	 */
+	if (nft->optimize_flags && !parser_rc) {
+		held = nft_optimize_held(nft, &cmds);
+		optimized = true;
+	}
 
 	rc = nft_evaluate(nft, &msgs, &cmds);
-	if (rc < 0)
+	if (rc < 0) {
+		/* Errors would refer to the merged rules, the caller runs the
+		 * ruleset again as written instead.
+		 */
+		if (optimized && retry) {
+			erec_free_list(&msgs);
+			*retry = true;
+		}
 		goto err;
+	}
+
+	/* Only the merged rules did not evaluate, the ruleset as written does. */
+	if (unmerged)
+		fprintf(nft->output.error_fp,
+			"Warning: optimized ruleset does not evaluate, "
+			"loading it without merging rules\n");
 
 	if (parser_rc) {
 		rc = parser_rc;
 		goto err;
 	}
 
+	if (held)
+		fputs(held, nft->output.error_fp);
+
 	if (nft_netlink(nft, &cmds, &msgs) != 0)
 		rc = -1;
 err:
+	free(held);
+	nft_print_flush(&nft->output);
 	erec_print_list(&nft->output, &msgs, nft->debug_mask);
+	nft_cache_mark_stale(&nft->cache, &cmds);
 	list_for_each_entry_safe(cmd, next, &cmds, list) {
 		list_del(&cmd->list);
 		cmd_free(cmd);
 	}
-	iface_cache_release();
-	if (nft->scanner) {
-		scanner_destroy(nft);
-		nft->scanner = NULL;
-	}
+	nft_run_release(nft);
 	if (!list_empty(&nft->vars_ctx.indesc_list)) {
 		struct input_descriptor *indesc, *next;
 
@@ -757,7 +1268,7 @@ err:
 	    nft_output_echo(&nft->output))
 		json_print_echo(nft);
 
-	if (rc || nft->check)
+	if ((rc || nft->check) && !nft_cache_keep(nft))
 		nft_cache_release(&nft->cache);
 
 	scope_release(nft->state->scopes[0]);
@@ -765,26 +1276,29 @@ err:
 	return rc;
 }
 
-static int nft_run_optimized_file(struct nft_ctx *nft, const char *filename)
+/* The ruleset is parsed, optimized, evaluated and loaded in one go. Only if
+ * the optimized ruleset does not evaluate, it is run again without merging
+ * any rules, so errors refer to the rules as written. A warning is only
+ * printed if the rules as written evaluate. The same applies if elements
+ * could not be streamed to the batch, see struct nft_stream.
+ */
+static int nft_run_file(struct nft_ctx *nft, const char *filename)
 {
 	uint32_t optimize_flags;
-	bool check;
+	bool retry = false;
 	int ret;
 
-	check = nft->check;
-	nft->check = true;
-	optimize_flags = nft->optimize_flags;
-	nft->optimize_flags = 0;
-
-	/* First check the original ruleset loads fine as is. */
-	ret = __nft_run_cmd_from_filename(nft, filename);
-	if (ret < 0)
+	ret = __nft_run_cmd_from_filename(nft, filename, &retry, false);
+	if (!retry)
 		return ret;
 
-	nft->check = check;
+	optimize_flags = nft->optimize_flags;
+	nft->optimize_flags = 0;
+	ret = __nft_run_cmd_from_filename(nft, filename, NULL,
+					  optimize_flags != 0);
 	nft->optimize_flags = optimize_flags;
 
-	return __nft_run_cmd_from_filename(nft, filename);
+	return ret;
 }
 
 static int nft_ctx_add_basedir_include_path(struct nft_ctx *nft,
@@ -815,13 +1329,7 @@ int nft_run_cmd_from_filename(struct nft_ctx *nft, const char *filename)
 	    nft_ctx_add_basedir_include_path(nft, filename) < 0)
 		return -1;
 
-	if (nft->optimize_flags) {
-		ret = nft_run_optimized_file(nft, filename);
-		free_const(nft->stdin_buf);
-		return ret;
-	}
-
-	ret = __nft_run_cmd_from_filename(nft, filename);
+	ret = nft_run_file(nft, filename);
 	free_const(nft->stdin_buf);
 
 	return ret;
@@ -37,7 +37,9 @@ enum opt_indices {
         IDX_INCLUDEPATH,
 	IDX_CHECK,
 	IDX_OPTIMIZE,
-#define IDX_RULESET_INPUT_END	IDX_OPTIMIZE
+	IDX_PARALLEL,
+	IDX_STREAM,
+#define IDX_RULESET_INPUT_END	IDX_STREAM
         /* Ruleset list formatting */
         IDX_HANDLE,
 #define IDX_RULESET_LIST_START	IDX_HANDLE
@@ -82,6 +84,8 @@ enum opt_vals {
 	OPT_NUMERIC_TIME	= 'T',
 	OPT_TERSE		= 't',
 	OPT_OPTIMIZE		= 'o',
+	OPT_PARALLEL		= 'P',
+	OPT_STREAM		= 'B',
 	OPT_INVALID		= '?',
 };
 
@@ -140,6 +144,10 @@ static const struct nft_opt nft_options[] = {
 				     "Specify debugging level (scanner, parser, eval, netlink, mnl, proto-ctx, segtree, all)"),
 	[IDX_OPTIMIZE]	    = NFT_OPT("optimize",		OPT_OPTIMIZE,		NULL,
 				     "Optimize ruleset"),
+	[IDX_PARALLEL]	    = NFT_OPT("parallel",		OPT_PARALLEL,		NULL,
+				     "Fetch the ruleset over several netlink sockets"),
+	[IDX_STREAM]	    = NFT_OPT("stream",			OPT_STREAM,		NULL,
+				     "Add large element commands to the batch while the file is parsed"),
 };
 
 #define NR_NFT_OPTIONS (sizeof(nft_options) / sizeof(nft_options[0]))
@@ -501,6 +509,14 @@ int main(int argc, char * const *argv)
 		case OPT_OPTIMIZE:
 			nft_ctx_set_optimize(nft, 0x1);
 			break;
+		case OPT_PARALLEL:
+			nft_ctx_cache_set_flags(nft, nft_ctx_cache_get_flags(nft) |
+						     NFT_CTX_CACHE_PARALLEL);
+			break;
+		case OPT_STREAM:
+			nft_ctx_input_set_flags(nft, nft_ctx_input_get_flags(nft) |
+						     NFT_CTX_INPUT_STREAM);
+			break;
 		case OPT_INVALID:
 			goto out_fail;
 		}
@@ -535,6 +551,8 @@ int main(int argc, char * const *argv)
 	} else if (filename != NULL) {
 		rc = !!nft_run_cmd_from_filename(nft, filename);
 	} else if (interactive) {
+		/* keep caches warm between the commands entered. */
+		nft_ctx_session_begin(nft);
 		if (cli_init(nft) < 0) {
 			fprintf(stderr, "%s: interactive CLI not supported in this build\n",
 				argv[0]);
@@ -12,11 +12,11 @@
 #include <gmputil.h>
 #include <list.h>
 
-static void concat_expr_msort_value(const struct expr *expr, mpz_t value)
+static unsigned int concat_expr_msort_data(const struct expr *expr,
+					   char *data)
 {
 	unsigned int len = 0, ilen;
 	const struct expr *i;
-	char data[512];
 
 	list_for_each_entry(i, &expr->expressions, list) {
 		ilen = div_round_up(i->len, BITS_PER_BYTE);
@@ -24,22 +24,81 @@ static void concat_expr_msort_value(const struct expr *expr, mpz_t value)
 		len += ilen;
 	}
 
-	mpz_import_data(value, data, BYTEORDER_HOST_ENDIAN, len);
+	return len;
 }
 
-static mpz_srcptr expr_msort_value(const struct expr *expr, mpz_t value)
+static const struct expr *expr_msort_key(const struct expr *expr)
 {
 	switch (expr->etype) {
 	case EXPR_SET_ELEM:
-		return expr_msort_value(expr->key, value);
+		return expr_msort_key(expr->key);
 	case EXPR_BINOP:
 	case EXPR_MAPPING:
 	case EXPR_RANGE:
-		return expr_msort_value(expr->left, value);
+		return expr_msort_key(expr->left);
 	case EXPR_VALUE:
-		return expr->value;
 	case EXPR_CONCAT:
-		concat_expr_msort_value(expr, value);
+	case EXPR_SET_ELEM_CATCHALL:
+		return expr;
+	default:
+		BUG("Unknown expression %s\n", expr_name(expr));
+	}
+}
+
+static int concat_expr_msort_import_cmp(const char *data1, unsigned int len1,
+					const char *data2, unsigned int len2)
+{
+	mpz_t value1, value2;
+	int ret;
+
+	mpz_init(value1);
+	mpz_init(value2);
+	mpz_import_data(value1, data1, BYTEORDER_HOST_ENDIAN, len1);
+	mpz_import_data(value2, data2, BYTEORDER_HOST_ENDIAN, len2);
+	ret = mpz_cmp(value1, value2);
+	mpz_clear(value1);
+	mpz_clear(value2);
+
+	return ret;
+}
+
+/* Compare two concatenations as if their data was imported in host byte
+ * order, without going through GMP integers if both have the same length.
+ */
+static int concat_expr_msort_cmp(const struct expr *e1, const struct expr *e2)
+{
+	char data1[512], data2[512];
+	unsigned int len1, len2;
+
+	len1 = concat_expr_msort_data(e1, data1);
+	len2 = concat_expr_msort_data(e2, data2);
+	if (len1 != len2)
+		return concat_expr_msort_import_cmp(data1, len1, data2, len2);
+
+#ifdef __LITTLE_ENDIAN_BITFIELD
+	while (len1-- > 0) {
+		if (data1[len1] != data2[len1])
+			return (unsigned char)data1[len1] <
+			       (unsigned char)data2[len1] ? -1 : 1;
+	}
+	return 0;
+#else
+	return memcmp(data1, data2, len1);
+#endif
+}
+
+static void expr_msort_value(const struct expr *expr, mpz_t value)
+{
+	char data[512];
+	unsigned int len;
+
+	switch (expr->etype) {
+	case EXPR_VALUE:
+		mpz_set(value, expr->value);
+		break;
+	case EXPR_CONCAT:
+		len = concat_expr_msort_data(expr, data);
+		mpz_import_data(value, data, BYTEORDER_HOST_ENDIAN, len);
 		break;
 	case EXPR_SET_ELEM_CATCHALL:
 		/* max value to ensure listing shows it in the last position */
@@ -48,28 +107,41 @@ static mpz_srcptr expr_msort_value(const struct expr *expr, mpz_t value)
 	default:
 		BUG("Unknown expression %s\n", expr_name(expr));
 	}
-	return value;
 }
 
-static int expr_msort_cmp(const struct expr *e1, const struct expr *e2)
+/* Slow path for mixed key types, such as the catch-all element. */
+static int expr_msort_value_cmp(const struct expr *e1, const struct expr *e2)
 {
-	mpz_srcptr value1;
-	mpz_srcptr value2;
-	mpz_t value1_tmp;
-	mpz_t value2_tmp;
+	mpz_t value1, value2;
 	int ret;
 
-	mpz_init(value1_tmp);
-	mpz_init(value2_tmp);
-	value1 = expr_msort_value(e1, value1_tmp);
-	value2 = expr_msort_value(e2, value2_tmp);
+	mpz_init(value1);
+	mpz_init(value2);
+	expr_msort_value(e1, value1);
+	expr_msort_value(e2, value2);
 	ret = mpz_cmp(value1, value2);
-	mpz_clear(value1_tmp);
-	mpz_clear(value2_tmp);
+	mpz_clear(value1);
+	mpz_clear(value2);
 
 	return ret;
 }
 
+/* Keys of the same set share the same type, compare them without
+ * allocating temporary GMP integers in the common cases.
+ */
+static int expr_msort_cmp(const struct expr *e1, const struct expr *e2)
+{
+	e1 = expr_msort_key(e1);
+	e2 = expr_msort_key(e2);
+
+	if (e1->etype == EXPR_VALUE && e2->etype == EXPR_VALUE)
+		return mpz_cmp(e1->value, e2->value);
+	if (e1->etype == EXPR_CONCAT && e2->etype == EXPR_CONCAT)
+		return concat_expr_msort_cmp(e1, e2);
+
+	return expr_msort_value_cmp(e1, e2);
+}
+
 void list_splice_sorted(struct list_head *list, struct list_head *head)
 {
 	struct list_head *h = head->next;
@@ -88,35 +160,121 @@ void list_splice_sorted(struct list_head *list, struct list_head *head)
 	}
 }
 
-static void list_cut_middle(struct list_head *list, struct list_head *head)
+struct expr_sort_key {
+	struct expr		*expr;
+	const unsigned char	*key;
+	unsigned int		len;
+	unsigned int		idx;
+};
+
+static unsigned int expr_msort_key_len(const struct expr *expr)
 {
-	struct list_head *s = head->next;
-	struct list_head *e = head->prev;
+	const struct expr *i;
+	unsigned int len = 0;
+
+	switch (expr->etype) {
+	case EXPR_VALUE:
+		len = div_round_up(mpz_sizeinbase(expr->value, 2),
+				   BITS_PER_BYTE);
+		return max(len, div_round_up(expr->len, BITS_PER_BYTE));
+	case EXPR_CONCAT:
+		list_for_each_entry(i, &expr->expressions, list)
+			len += div_round_up(i->len, BITS_PER_BYTE);
+		return len;
+	case EXPR_SET_ELEM_CATCHALL:
+		return div_round_up(expr->len, BITS_PER_BYTE);
+	default:
+		BUG("Unknown expression %s\n", expr_name(expr));
+	}
+}
 
-	while (e != s) {
-		e = e->prev;
+/* Build a big endian key of @len bytes that sorts with memcmp() in the
+ * same order as expr_msort_cmp().
+ */
+static void expr_msort_key_build(const struct expr *expr, unsigned char *key,
+				 unsigned int len, mpz_t value)
+{
+	unsigned char data[512];
+	unsigned int dlen, i;
 
-		if (e != s)
-			s = s->next;
+	switch (expr->etype) {
+	case EXPR_VALUE:
+		mpz_export_data(key, expr->value, BYTEORDER_BIG_ENDIAN, len);
+		break;
+	case EXPR_CONCAT:
+		dlen = concat_expr_msort_data(expr, (char *)data);
+		memset(key, 0, len - dlen);
+		key += len - dlen;
+#ifdef __LITTLE_ENDIAN_BITFIELD
+		for (i = 0; i < dlen; i++)
+			key[i] = data[dlen - i - 1];
+#else
+		for (i = 0; i < dlen; i++)
+			key[i] = data[i];
+#endif
+		break;
+	case EXPR_SET_ELEM_CATCHALL:
+		mpz_bitmask(value, expr->len);
+		mpz_export_data(key, value, BYTEORDER_BIG_ENDIAN, len);
+		break;
+	default:
+		BUG("Unknown expression %s\n", expr_name(expr));
 	}
+}
 
-	__list_cut_position(list, head, s);
+static int expr_sort_key_cmp(const void *p1, const void *p2)
+{
+	const struct expr_sort_key *k1 = p1, *k2 = p2;
+	int ret;
+
+	ret = memcmp(k1->key, k2->key, k1->len);
+	if (ret)
+		return ret;
+
+	return k1->idx < k2->idx ? -1 : k1->idx > k2->idx;
 }
 
+/* Sort keys are computed once per element into a flat buffer, then the
+ * array of keys is sorted and the list is relinked in that order.
+ */
 void list_expr_sort(struct list_head *head)
 {
-	struct list_head *list;
-	LIST_HEAD(temp);
+	struct expr_sort_key *keys;
+	unsigned int n = 0, len = 0, i;
+	unsigned char *buf;
+	struct expr *expr;
+	mpz_t value;
 
-	list = &temp;
+	list_for_each_entry(expr, head, list) {
+		len = max(len, expr_msort_key_len(expr_msort_key(expr)));
+		n++;
+	}
 
-	if (list_empty(head) || list_is_singular(head))
+	if (n < 2)
 		return;
 
-	list_cut_middle(list, head);
+	keys = xmalloc(n * sizeof(*keys));
+	buf = xmalloc(n * len);
+	mpz_init(value);
+
+	i = 0;
+	list_for_each_entry(expr, head, list) {
+		keys[i].expr = expr;
+		keys[i].key = buf + i * len;
+		keys[i].len = len;
+		keys[i].idx = i;
+		expr_msort_key_build(expr_msort_key(expr), buf + i * len, len,
+				     value);
+		i++;
+	}
+	mpz_clear(value);
+
+	qsort(keys, n, sizeof(keys[0]), expr_sort_key_cmp);
 
-	list_expr_sort(head);
-	list_expr_sort(list);
+	init_list_head(head);
+	for (i = 0; i < n; i++)
+		list_add_tail(&keys[i].expr->list, head);
 
-	list_splice_sorted(list, head);
+	free(buf);
+	free(keys);
 }
@@ -115,7 +115,7 @@ static void ifindex_type_print(const struct expr *expr, struct output_ctx *octx)
 	int ifindex;
 
 	ifindex = mpz_get_uint32(expr->value);
-	if (nft_if_indextoname(ifindex, name))
+	if (nft_if_indextoname(octx->tbl.iface, ifindex, name))
 		nft_print(octx, "\"%s\"", name);
 	else
 		nft_print(octx, "%d", ifindex);
@@ -127,7 +127,7 @@ static struct error_record *ifindex_type_parse(struct parse_ctx *ctx,
 {
 	int ifindex;
 
-	ifindex = nft_if_nametoindex(sym->identifier);
+	ifindex = nft_if_nametoindex(ctx->tbl->iface, sym->identifier);
 	if (ifindex == 0) {
 		char *end;
 		long res;
@@ -31,9 +31,13 @@
 #include <cmd.h>
 #include <net/if.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <utils.h>
 #include <nftables.h>
 #include <linux/netfilter.h>
@@ -51,23 +55,41 @@ struct basehook {
 	int prio;
 };
 
-struct mnl_socket *nft_mnl_socket_open(void)
+static struct mnl_socket *__nft_mnl_socket_open(void)
 {
 	struct mnl_socket *nf_sock;
 	int one = 1;
 
 	nf_sock = mnl_socket_open(NETLINK_NETFILTER);
 	if (!nf_sock)
-		netlink_init_error();
+		return NULL;
 
-	if (fcntl(mnl_socket_get_fd(nf_sock), F_SETFL, O_NONBLOCK))
-		netlink_init_error();
+	if (fcntl(mnl_socket_get_fd(nf_sock), F_SETFL, O_NONBLOCK)) {
+		mnl_socket_close(nf_sock);
+		return NULL;
+	}
 
 	mnl_socket_setsockopt(nf_sock, NETLINK_EXT_ACK, &one, sizeof(one));
 
 	return nf_sock;
 }
 
+struct mnl_socket *nft_mnl_socket_open(void)
+{
+	struct mnl_socket *nf_sock;
+
+	nf_sock = __nft_mnl_socket_open();
+	if (!nf_sock)
+		netlink_init_error();
+
+	return nf_sock;
+}
+
+struct mnl_socket *mnl_nft_monitor_socket_open(void)
+{
+	return __nft_mnl_socket_open();
+}
+
 uint32_t mnl_seqnum_alloc(unsigned int *seqnum)
 {
 	return (*seqnum)++;
@@ -81,32 +103,128 @@ uint32_t mnl_seqnum_alloc(unsigned int *seqnum)
  */
 #define NFT_NLMSG_MAXSIZE (UINT16_MAX + getpagesize())
 
+/* Number of datagrams read per recvmmsg() call. The kernel builds the next
+ * dump chunk as soon as the previous one is read, so a single call drains
+ * this many chunks of a large dump.
+ */
+#define NFT_NLMSG_RECV_BATCH	16
+
+struct mnl_recv_stats {
+	uint64_t		syscalls;
+	uint64_t		msgs;
+	uint64_t		bytes;
+};
+
+struct mnl_recv_buf {
+	struct mnl_recv_stats	stats;
+	struct mmsghdr		msgs[NFT_NLMSG_RECV_BATCH];
+	struct iovec		iov[NFT_NLMSG_RECV_BATCH];
+	struct sockaddr_nl	addr[NFT_NLMSG_RECV_BATCH];
+	char			data[];
+};
+
+static struct mnl_recv_buf *mnl_recv_buf_alloc(void)
+{
+	size_t size = NFT_NLMSG_MAXSIZE;
+	struct mnl_recv_buf *rx;
+	int i;
+
+	/* do not clear data, pages are only touched as dumps fill them. */
+	rx = xmalloc(sizeof(*rx) + NFT_NLMSG_RECV_BATCH * size);
+	memset(rx, 0, sizeof(*rx));
+
+	for (i = 0; i < NFT_NLMSG_RECV_BATCH; i++) {
+		rx->iov[i].iov_base = rx->data + i * size;
+		rx->iov[i].iov_len = size;
+		rx->msgs[i].msg_hdr.msg_name = &rx->addr[i];
+		rx->msgs[i].msg_hdr.msg_iov = &rx->iov[i];
+		rx->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return rx;
+}
+
+static struct mnl_recv_buf *nft_mnl_recv_buf(struct nft_ctx *nft)
+{
+	if (!nft->nl_rxbuf)
+		nft->nl_rxbuf = mnl_recv_buf_alloc();
+
+	return nft->nl_rxbuf;
+}
+
+/* Same checks as mnl_socket_recvfrom(), on every datagram of the batch. */
+static int mnl_recv_batch(struct mnl_socket *nf_sock, struct mnl_recv_buf *rx)
+{
+	struct msghdr *msg;
+	int i, num;
+
+	for (i = 0; i < NFT_NLMSG_RECV_BATCH; i++)
+		rx->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_nl);
+
+	num = recvmmsg(mnl_socket_get_fd(nf_sock), rx->msgs,
+		       NFT_NLMSG_RECV_BATCH, 0, NULL);
+	rx->stats.syscalls++;
+	if (num < 0)
+		return -1;
+
+	for (i = 0; i < num; i++) {
+		msg = &rx->msgs[i].msg_hdr;
+		if (msg->msg_flags & MSG_TRUNC) {
+			errno = ENOSPC;
+			return -1;
+		}
+		if (msg->msg_namelen != sizeof(struct sockaddr_nl)) {
+			errno = EINVAL;
+			return -1;
+		}
+		rx->stats.msgs++;
+		rx->stats.bytes += rx->msgs[i].msg_len;
+	}
+
+	return num;
+}
+
+/* Ruleset generation that dump callbacks check against, see check_genid().
+ * Callbacks only get their object list, so this is set for the receiving
+ * thread from the context that issued the request.
+ */
+static __thread uint32_t nft_genid;
+
 static int
-nft_mnl_recv(struct netlink_ctx *ctx, uint32_t portid,
-	     int (*cb)(const struct nlmsghdr *nlh, void *data), void *cb_data)
+__nft_mnl_recv(struct mnl_socket *nf_sock, struct mnl_recv_buf *rx,
+	       uint32_t seqnum, uint32_t portid, uint32_t genid,
+	       int (*cb)(const struct nlmsghdr *nlh, void *data), void *cb_data)
 {
-	char buf[NFT_NLMSG_MAXSIZE];
 	bool eintr = false;
-	int ret;
+	int i, num, ret;
 
-	ret = mnl_socket_recvfrom(ctx->nft->nf_sock, buf, sizeof(buf));
+	nft_genid = genid;
+
+	ret = mnl_recv_batch(nf_sock, rx);
 	while (ret > 0) {
-		ret = mnl_cb_run(buf, ret, ctx->seqnum, portid, cb, cb_data);
-		if (ret == 0)
-			break;
-		if (ret < 0) {
-			if (errno == EAGAIN) {
-				ret = 0;
-				break;
-			}
-			if (errno != EINTR)
-				break;
+		num = ret;
+		for (i = 0; i < num; i++) {
+			ret = mnl_cb_run(rx->iov[i].iov_base, rx->msgs[i].msg_len,
+					 seqnum, portid, cb, cb_data);
+			if (ret == 0)
+				goto out;
+			if (ret < 0) {
+				if (errno == EAGAIN) {
+					ret = 0;
+					goto out;
+				}
+				if (errno != EINTR)
+					goto out;
 
-			/* process all pending messages before reporting EINTR */
-			eintr = true;
+				/* process all pending messages before
+				 * reporting EINTR
+				 */
+				eintr = true;
+			}
 		}
-		ret = mnl_socket_recvfrom(ctx->nft->nf_sock, buf, sizeof(buf));
+		ret = mnl_recv_batch(nf_sock, rx);
 	}
+out:
 	if (eintr) {
 		ret = -1;
 		errno = EINTR;
@@ -114,6 +232,35 @@ nft_mnl_recv(struct netlink_ctx *ctx, uint32_t portid,
 	return ret;
 }
 
+/* Print what was received since @from was taken. */
+static void mnl_recv_stats_print(struct nft_ctx *nft,
+				 const struct mnl_recv_stats *stats,
+				 const struct mnl_recv_stats *from)
+{
+	fprintf(nft->output.output_fp,
+		"recv: %" PRIu64 " messages, %" PRIu64 " bytes, "
+		"%" PRIu64 " syscalls\n",
+		stats->msgs - from->msgs, stats->bytes - from->bytes,
+		stats->syscalls - from->syscalls);
+}
+
+static int
+nft_mnl_recv(struct netlink_ctx *ctx, uint32_t portid,
+	     int (*cb)(const struct nlmsghdr *nlh, void *data), void *cb_data)
+{
+	struct mnl_recv_buf *rx = nft_mnl_recv_buf(ctx->nft);
+	struct mnl_recv_stats stats = rx->stats;
+	int ret;
+
+	ret = __nft_mnl_recv(ctx->nft->nf_sock, rx, ctx->seqnum, portid,
+			     ctx->nft->nf_genid, cb, cb_data);
+
+	if (ctx->nft->debug_mask & NFT_DEBUG_MNL)
+		mnl_recv_stats_print(ctx->nft, &rx->stats, &stats);
+
+	return ret;
+}
+
 int
 nft_mnl_talk(struct netlink_ctx *ctx, const void *data, unsigned int len,
 	     int (*cb)(const struct nlmsghdr *nlh, void *data), void *cb_data)
@@ -133,13 +280,12 @@ nft_mnl_talk(struct netlink_ctx *ctx, const void *data, unsigned int len,
 /*
  * Rule-set consistency check across several netlink dumps
  */
-static uint32_t nft_genid;
-
 static int genid_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct nfgenmsg *nfh = mnl_nlmsg_get_payload(nlh);
+	uint32_t *genid = data;
 
-	nft_genid = ntohs(nfh->res_id);
+	*genid = ntohs(nfh->res_id);
 
 	return MNL_CB_OK;
 }
@@ -151,9 +297,9 @@ uint32_t mnl_genid_get(struct netlink_ctx *ctx)
 
 	nlh = nftnl_nlmsg_build_hdr(buf, NFT_MSG_GETGEN, AF_UNSPEC, 0, ctx->seqnum);
 	/* Skip error checking, old kernels sets res_id field to zero. */
-	nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, genid_cb, NULL);
+	nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, genid_cb, &ctx->nft->nf_genid);
 
-	return nft_genid;
+	return ctx->nft->nf_genid;
 }
 
 static uint16_t nft_genid_u16(uint32_t genid)
@@ -272,19 +418,16 @@ static void mnl_set_sndbuffer(struct netlink_ctx *ctx)
 	}
 }
 
-static unsigned int nlsndbufsiz;
-
 static int mnl_set_rcvbuffer(const struct mnl_socket *nl, socklen_t bufsiz)
 {
-	socklen_t len = sizeof(nlsndbufsiz);
+	unsigned int nlrcvbufsiz = 0;
+	socklen_t len = sizeof(nlrcvbufsiz);
 	int ret;
 
-	if (!nlsndbufsiz) {
-		getsockopt(mnl_socket_get_fd(nl), SOL_SOCKET, SO_RCVBUF,
-			   &nlsndbufsiz, &len);
-	}
+	getsockopt(mnl_socket_get_fd(nl), SOL_SOCKET, SO_RCVBUF,
+		   &nlrcvbufsiz, &len);
 
-	if (nlsndbufsiz >= bufsiz)
+	if (nlrcvbufsiz >= bufsiz)
 		return 0;
 
 	ret = setsockopt(mnl_socket_get_fd(nl), SOL_SOCKET, SO_RCVBUFFORCE,
@@ -386,28 +529,45 @@ static int mnl_batch_extack_cb(const struct nlmsghdr *nlh, void *data)
 }
 
 #define NFT_MNL_ECHO_RCVBUFF_DEFAULT	(MNL_SOCKET_BUFFER_SIZE * 1024U)
-#define NFT_MNL_ACK_MAXSIZE		((sizeof(struct nlmsghdr) + \
-					  sizeof(struct nfgenmsg) + (1 << 16)) + \
-					  MNL_SOCKET_BUFFER_SIZE)
+/* Receive buffer space taken by one acknowledgment, including overhead. */
+#define NFT_MNL_ACK_TRUESIZE		1024U
+
+/* Count the messages in the batch, any of them might be acknowledged. */
+static unsigned int mnl_nft_batch_num_msgs(const struct iovec *iov,
+					   uint32_t iov_len, size_t *len)
+{
+	const struct nlmsghdr *nlh;
+	unsigned int num_msgs = 0;
+	uint32_t i;
+	int buflen;
+
+	*len = 0;
+	for (i = 0; i < iov_len; i++) {
+		nlh = iov[i].iov_base;
+		buflen = iov[i].iov_len;
+		while (mnl_nlmsg_ok(nlh, buflen)) {
+			num_msgs++;
+			nlh = mnl_nlmsg_next(nlh, &buflen);
+		}
+		*len += iov[i].iov_len;
+	}
+
+	return num_msgs;
+}
 
-int mnl_batch_talk(struct netlink_ctx *ctx, struct list_head *err_list,
-		   uint32_t num_cmds)
+int mnl_batch_talk(struct netlink_ctx *ctx, struct list_head *err_list)
 {
+	struct mnl_recv_buf *rx = nft_mnl_recv_buf(ctx->nft);
 	struct mnl_socket *nl = ctx->nft->nf_sock;
-	int ret, fd = mnl_socket_get_fd(nl), portid = mnl_socket_get_portid(nl);
 	uint32_t iov_len = nftnl_batch_iovec_len(ctx->batch);
-	char rcv_buf[NFT_MNL_ACK_MAXSIZE];
+	int portid = mnl_socket_get_portid(nl);
+	struct mnl_recv_stats stats = rx->stats;
 	const struct sockaddr_nl snl = {
 		.nl_family = AF_NETLINK
 	};
-	struct timeval tv = {
-		.tv_sec		= 0,
-		.tv_usec	= 0
-	};
 	struct iovec iov[iov_len];
 	struct msghdr msg = {};
 	unsigned int rcvbufsiz;
-	fd_set readfds;
 	static mnl_cb_t cb_ctl_array[NLMSG_MIN_TYPE] = {
 	        [NLMSG_ERROR] = mnl_batch_extack_cb,
 	};
@@ -415,13 +575,18 @@ int mnl_batch_talk(struct netlink_ctx *ctx, struct list_head *err_list,
 		.err_list = err_list,
 		.nl_ctx = ctx,
 	};
+	size_t batch_len;
+	int i, num, ret;
 
 	mnl_set_sndbuffer(ctx);
 
 	mnl_nft_batch_to_msg(ctx, &msg, &snl, iov, iov_len);
 
-	rcvbufsiz = num_cmds * 1024;
+	rcvbufsiz = mnl_nft_batch_num_msgs(iov, iov_len, &batch_len) *
+		    NFT_MNL_ACK_TRUESIZE;
 	if (nft_output_echo(&ctx->nft->output)) {
+		/* objects are echoed back at about the size they were sent. */
+		rcvbufsiz += batch_len;
 		if (rcvbufsiz < NFT_MNL_ECHO_RCVBUFF_DEFAULT)
 			rcvbufsiz = NFT_MNL_ECHO_RCVBUFF_DEFAULT;
 	}
@@ -432,27 +597,29 @@ int mnl_batch_talk(struct netlink_ctx *ctx, struct list_head *err_list,
 	if (ret == -1)
 		return -1;
 
-	/* receive and digest all the acknowledgments from the kernel. */
+	/* The kernel processes the batch before sendmsg() returns, so all the
+	 * acknowledgments are queued already. Receive and digest them until
+	 * the socket runs empty.
+	 */
 	while (true) {
-		FD_ZERO(&readfds);
-		FD_SET(fd, &readfds);
-
-		ret = select(fd + 1, &readfds, NULL, NULL, &tv);
-		if (ret == -1)
-			return -1;
-
-		if (!FD_ISSET(fd, &readfds))
-			break;
+		num = mnl_recv_batch(nl, rx);
+		if (num < 0) {
+			if (errno == EAGAIN)
+				break;
 
-		ret = mnl_socket_recvfrom(nl, rcv_buf, sizeof(rcv_buf));
-		if (ret == -1)
 			return -1;
+		}
 
 		/* Continue on error, make sure we get all acknowledgments */
-		ret = mnl_cb_run2(rcv_buf, ret, 0, portid,
-				  netlink_echo_callback, &cb_data,
-				  cb_ctl_array, MNL_ARRAY_SIZE(cb_ctl_array));
+		for (i = 0; i < num; i++)
+			mnl_cb_run2(rx->iov[i].iov_base, rx->msgs[i].msg_len,
+				    0, portid, netlink_echo_callback, &cb_data,
+				    cb_ctl_array, MNL_ARRAY_SIZE(cb_ctl_array));
 	}
+
+	if (ctx->nft->debug_mask & NFT_DEBUG_MNL)
+		mnl_recv_stats_print(ctx->nft, &rx->stats, &stats);
+
 	return 0;
 }
 
@@ -472,7 +639,7 @@ static int mnl_nft_expr_build_cb(struct nftnl_expr *nle, void *data)
 
 	eloc = nft_expr_loc_find(nle, ctx->lctx);
 	if (eloc)
-		cmd_add_loc(cmd, nlh->nlmsg_len, eloc->loc);
+		cmd_add_loc(cmd, nlh, eloc->loc);
 
 	nest = mnl_attr_nest_start(nlh, NFTA_LIST_ELEM);
 	nftnl_expr_build_payload(nlh, nle);
@@ -525,9 +692,9 @@ int mnl_nft_rule_add(struct netlink_ctx *ctx, struct cmd *cmd,
 				    cmd->handle.family,
 				    NLM_F_CREATE | flags, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &h->table.location);
+	cmd_add_loc(cmd, nlh, &h->table.location);
 	mnl_attr_put_strz(nlh, NFTA_RULE_TABLE, h->table.name);
-	cmd_add_loc(cmd, nlh->nlmsg_len, &h->chain.location);
+	cmd_add_loc(cmd, nlh, &h->chain.location);
 
 	if (h->chain_id)
 		mnl_attr_put_u32(nlh, NFTA_RULE_CHAIN_ID, htonl(h->chain_id));
@@ -576,11 +743,11 @@ int mnl_nft_rule_replace(struct netlink_ctx *ctx, struct cmd *cmd)
 				    cmd->handle.family,
 				    NLM_F_REPLACE | flags, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &h->table.location);
+	cmd_add_loc(cmd, nlh, &h->table.location);
 	mnl_attr_put_strz(nlh, NFTA_RULE_TABLE, h->table.name);
-	cmd_add_loc(cmd, nlh->nlmsg_len, &h->chain.location);
+	cmd_add_loc(cmd, nlh, &h->chain.location);
 	mnl_attr_put_strz(nlh, NFTA_RULE_CHAIN, h->chain.name);
-	cmd_add_loc(cmd, nlh->nlmsg_len, &h->handle.location);
+	cmd_add_loc(cmd, nlh, &h->handle.location);
 	mnl_attr_put_u64(nlh, NFTA_RULE_HANDLE, htobe64(h->handle.id));
 
 	mnl_nft_rule_build_ctx_init(&rule_ctx, nlh, cmd, &lctx);
@@ -619,14 +786,14 @@ int mnl_nft_rule_del(struct netlink_ctx *ctx, struct cmd *cmd)
 				    nftnl_rule_get_u32(nlr, NFTNL_RULE_FAMILY),
 				    0, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &h->table.location);
+	cmd_add_loc(cmd, nlh, &h->table.location);
 	mnl_attr_put_strz(nlh, NFTA_RULE_TABLE, h->table.name);
 	if (h->chain.name) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &h->chain.location);
+		cmd_add_loc(cmd, nlh, &h->chain.location);
 		mnl_attr_put_strz(nlh, NFTA_RULE_CHAIN, h->chain.name);
 	}
 	if (h->handle.id) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &h->handle.location);
+		cmd_add_loc(cmd, nlh, &h->handle.location);
 		mnl_attr_put_u64(nlh, NFTA_RULE_HANDLE, htobe64(h->handle.id));
 	}
 
@@ -665,17 +832,15 @@ err_free:
 	return MNL_CB_OK;
 }
 
-struct nftnl_rule_list *mnl_nft_rule_dump(struct netlink_ctx *ctx, int family,
-					  const char *table, const char *chain,
-					  uint64_t rule_handle,
-					  bool dump, bool reset)
+static struct nlmsghdr *
+mnl_nft_rule_dump_build(char *buf, uint32_t seqnum, int family,
+			const char *table, const char *chain,
+			uint64_t rule_handle, bool dump, bool reset)
 {
 	uint16_t nl_flags = dump ? NLM_F_DUMP : NLM_F_ACK;
-	char buf[MNL_SOCKET_BUFFER_SIZE];
-	struct nftnl_rule_list *nlr_list;
 	struct nftnl_rule *nlr = NULL;
 	struct nlmsghdr *nlh;
-	int msg_type, ret;
+	int msg_type;
 
 	if (reset)
 		msg_type = NFT_MSG_GETRULE_RESET;
@@ -694,17 +859,32 @@ struct nftnl_rule_list *mnl_nft_rule_dump(struct netlink_ctx *ctx, int family,
 			nftnl_rule_set_u64(nlr, NFTNL_RULE_HANDLE, rule_handle);
 	}
 
-	nlr_list = nftnl_rule_list_alloc();
-	if (nlr_list == NULL)
-		memory_allocation_error();
-
-	nlh = nftnl_nlmsg_build_hdr(buf, msg_type, family,
-				    nl_flags, ctx->seqnum);
+	nlh = nftnl_nlmsg_build_hdr(buf, msg_type, family, nl_flags, seqnum);
 	if (nlr) {
 		nftnl_rule_nlmsg_build_payload(nlh, nlr);
 		nftnl_rule_free(nlr);
 	}
 
+	return nlh;
+}
+
+struct nftnl_rule_list *mnl_nft_rule_dump(struct netlink_ctx *ctx, int family,
+					  const char *table, const char *chain,
+					  uint64_t rule_handle,
+					  bool dump, bool reset)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nftnl_rule_list *nlr_list;
+	struct nlmsghdr *nlh;
+	int ret;
+
+	nlh = mnl_nft_rule_dump_build(buf, ctx->seqnum, family, table, chain,
+				      rule_handle, dump, reset);
+
+	nlr_list = nftnl_rule_list_alloc();
+	if (nlr_list == NULL)
+		memory_allocation_error();
+
 	ret = nft_mnl_talk(ctx, nlh, nlh->nlmsg_len, rule_cb, nlr_list);
 	if (ret < 0)
 		goto err;
@@ -790,12 +970,12 @@ static void mnl_nft_chain_devs_build(struct nlmsghdr *nlh, struct cmd *cmd)
 
 	dev_array = nft_dev_array(dev_expr, &num_devs);
 	if (num_devs == 1) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, dev_array[0].location);
+		cmd_add_loc(cmd, nlh, dev_array[0].location);
 		mnl_attr_put_strz(nlh, NFTA_HOOK_DEV, dev_array[0].ifname);
 	} else {
 		nest_dev = mnl_attr_nest_start(nlh, NFTA_HOOK_DEVS);
 		for (i = 0; i < num_devs; i++) {
-			cmd_add_loc(cmd, nlh->nlmsg_len, dev_array[i].location);
+			cmd_add_loc(cmd, nlh, dev_array[i].location);
 			mnl_attr_put_strz(nlh, NFTA_DEVICE_NAME, dev_array[i].ifname);
 			mnl_attr_nest_end(nlh, nest_dev);
 		}
@@ -840,9 +1020,9 @@ int mnl_nft_chain_add(struct netlink_ctx *ctx, struct cmd *cmd,
 				    cmd->handle.family,
 				    NLM_F_CREATE | flags, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.table.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.table.location);
 	mnl_attr_put_strz(nlh, NFTA_CHAIN_TABLE, cmd->handle.table.name);
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.chain.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.chain.location);
 
 	if (!cmd->chain || !(cmd->chain->flags & CHAIN_F_BINDING)) {
 		mnl_attr_put_strz(nlh, NFTA_CHAIN_NAME, cmd->handle.chain.name);
@@ -859,7 +1039,7 @@ int mnl_nft_chain_add(struct netlink_ctx *ctx, struct cmd *cmd,
 	if (cmd->chain && cmd->chain->policy) {
 		mpz_export_data(&policy, cmd->chain->policy->value,
 				BYTEORDER_HOST_ENDIAN, sizeof(int));
-		cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->chain->policy->location);
+		cmd_add_loc(cmd, nlh, &cmd->chain->policy->location);
 		mnl_attr_put_u32(nlh, NFTA_CHAIN_POLICY, htonl(policy));
 	}
 
@@ -871,7 +1051,7 @@ int mnl_nft_chain_add(struct netlink_ctx *ctx, struct cmd *cmd,
 		struct nlattr *nest;
 
 		if (cmd->chain->type.str) {
-			cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->chain->type.loc);
+			cmd_add_loc(cmd, nlh, &cmd->chain->type.loc);
 			mnl_attr_put_strz(nlh, NFTA_CHAIN_TYPE, cmd->chain->type.str);
 		}
 
@@ -947,13 +1127,13 @@ int mnl_nft_chain_del(struct netlink_ctx *ctx, struct cmd *cmd)
 				    cmd->handle.family,
 				    0, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.table.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.table.location);
 	mnl_attr_put_strz(nlh, NFTA_CHAIN_TABLE, cmd->handle.table.name);
 	if (cmd->handle.chain.name) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.chain.location);
+		cmd_add_loc(cmd, nlh, &cmd->handle.chain.location);
 		mnl_attr_put_strz(nlh, NFTA_CHAIN_NAME, cmd->handle.chain.name);
 	} else if (cmd->handle.handle.id) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.handle.location);
+		cmd_add_loc(cmd, nlh, &cmd->handle.handle.location);
 		mnl_attr_put_u64(nlh, NFTA_CHAIN_HANDLE,
 				 htobe64(cmd->handle.handle.id));
 	}
@@ -1075,7 +1255,7 @@ int mnl_nft_table_add(struct netlink_ctx *ctx, struct cmd *cmd,
 				    cmd->handle.family,
 				    flags, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.table.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.table.location);
 	mnl_attr_put_strz(nlh, NFTA_TABLE_NAME, cmd->handle.table.name);
 	nftnl_table_nlmsg_build_payload(nlh, nlt);
 	nftnl_table_free(nlt);
@@ -1104,10 +1284,10 @@ int mnl_nft_table_del(struct netlink_ctx *ctx, struct cmd *cmd)
 			            cmd->handle.family, 0, ctx->seqnum);
 
 	if (cmd->handle.table.name) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.table.location);
+		cmd_add_loc(cmd, nlh, &cmd->handle.table.location);
 		mnl_attr_put_strz(nlh, NFTA_TABLE_NAME, cmd->handle.table.name);
 	} else if (cmd->handle.handle.id) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.handle.location);
+		cmd_add_loc(cmd, nlh, &cmd->handle.handle.location);
 		mnl_attr_put_u64(nlh, NFTA_TABLE_HANDLE,
 				 htobe64(cmd->handle.handle.id));
 	}
@@ -1320,9 +1500,9 @@ int mnl_nft_set_add(struct netlink_ctx *ctx, struct cmd *cmd,
 				    h->family,
 				    NLM_F_CREATE | flags, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &h->table.location);
+	cmd_add_loc(cmd, nlh, &h->table.location);
 	mnl_attr_put_strz(nlh, NFTA_SET_TABLE, h->table.name);
-	cmd_add_loc(cmd, nlh->nlmsg_len, &h->set.location);
+	cmd_add_loc(cmd, nlh, &h->set.location);
 	mnl_attr_put_strz(nlh, NFTA_SET_NAME, h->set.name);
 
 	nftnl_set_nlmsg_build_payload(nlh, nls);
@@ -1354,13 +1534,13 @@ int mnl_nft_set_del(struct netlink_ctx *ctx, struct cmd *cmd)
 				    h->family,
 				    0, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.table.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.table.location);
 	mnl_attr_put_strz(nlh, NFTA_SET_TABLE, cmd->handle.table.name);
 	if (h->set.name) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.set.location);
+		cmd_add_loc(cmd, nlh, &cmd->handle.set.location);
 		mnl_attr_put_strz(nlh, NFTA_SET_NAME, cmd->handle.set.name);
 	} else if (h->handle.id) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.handle.location);
+		cmd_add_loc(cmd, nlh, &cmd->handle.handle.location);
 		mnl_attr_put_u64(nlh, NFTA_SET_HANDLE,
 				 htobe64(cmd->handle.handle.id));
 	}
@@ -1539,9 +1719,9 @@ int mnl_nft_obj_add(struct netlink_ctx *ctx, struct cmd *cmd,
 				    NFT_MSG_NEWOBJ, cmd->handle.family,
 				    NLM_F_CREATE | flags, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.table.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.table.location);
 	mnl_attr_put_strz(nlh, NFTA_OBJ_TABLE, cmd->handle.table.name);
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.obj.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.obj.location);
 	mnl_attr_put_strz(nlh, NFTA_OBJ_NAME, cmd->handle.obj.name);
 
 	nftnl_obj_nlmsg_build_payload(nlh, nlo);
@@ -1572,14 +1752,14 @@ int mnl_nft_obj_del(struct netlink_ctx *ctx, struct cmd *cmd, int type)
 				    msg_type, cmd->handle.family,
 				    0, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.table.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.table.location);
 	mnl_attr_put_strz(nlh, NFTA_OBJ_TABLE, cmd->handle.table.name);
 
 	if (cmd->handle.obj.name) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.obj.location);
+		cmd_add_loc(cmd, nlh, &cmd->handle.obj.location);
 		mnl_attr_put_strz(nlh, NFTA_OBJ_NAME, cmd->handle.obj.name);
 	} else if (cmd->handle.handle.id) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.handle.location);
+		cmd_add_loc(cmd, nlh, &cmd->handle.handle.location);
 		mnl_attr_put_u64(nlh, NFTA_OBJ_HANDLE,
 				 htobe64(cmd->handle.handle.id));
 	}
@@ -1616,17 +1796,15 @@ err_free:
 }
 
 
-struct nftnl_obj_list *
-mnl_nft_obj_dump(struct netlink_ctx *ctx, int family,
-		 const char *table, const char *name,  uint32_t type, bool dump,
-		 bool reset)
+static struct nlmsghdr *
+mnl_nft_obj_dump_build(char *buf, uint32_t seqnum, int family,
+		       const char *table, const char *name, uint32_t type,
+		       bool dump, bool reset)
 {
 	uint16_t nl_flags = dump ? NLM_F_DUMP : NLM_F_ACK;
-	struct nftnl_obj_list *nln_list;
-	char buf[MNL_SOCKET_BUFFER_SIZE];
 	struct nlmsghdr *nlh;
 	struct nftnl_obj *n;
-	int msg_type, ret;
+	int msg_type;
 
 	if (reset)
 		msg_type = NFT_MSG_GETOBJ_RESET;
@@ -1637,8 +1815,7 @@ mnl_nft_obj_dump(struct netlink_ctx *ctx, int family,
 	if (n == NULL)
 		memory_allocation_error();
 
-	nlh = nftnl_nlmsg_build_hdr(buf, msg_type, family,
-				    nl_flags, ctx->seqnum);
+	nlh = nftnl_nlmsg_build_hdr(buf, msg_type, family, nl_flags, seqnum);
 	if (table != NULL)
 		nftnl_obj_set_str(n, NFTNL_OBJ_TABLE, table);
 	if (name != NULL)
@@ -1648,6 +1825,22 @@ mnl_nft_obj_dump(struct netlink_ctx *ctx, int family,
 	nftnl_obj_nlmsg_build_payload(nlh, n);
 	nftnl_obj_free(n);
 
+	return nlh;
+}
+
+struct nftnl_obj_list *
+mnl_nft_obj_dump(struct netlink_ctx *ctx, int family,
+		 const char *table, const char *name,  uint32_t type, bool dump,
+		 bool reset)
+{
+	struct nftnl_obj_list *nln_list;
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+	int ret;
+
+	nlh = mnl_nft_obj_dump_build(buf, ctx->seqnum, family, table, name,
+				     type, dump, reset);
+
 	nln_list = nftnl_obj_list_alloc();
 	if (nln_list == NULL)
 		memory_allocation_error();
@@ -1717,8 +1910,7 @@ static void netlink_dump_setelem_done(struct netlink_ctx *ctx)
 static int mnl_nft_setelem_batch(const struct nftnl_set *nls, struct cmd *cmd,
 				 struct nftnl_batch *batch,
 				 enum nf_tables_msg_types msg_type,
-				 unsigned int flags, uint32_t seqnum,
-				 const struct expr *set,
+				 unsigned int flags, const struct expr *set,
 				 struct netlink_ctx *ctx)
 {
 	struct nlattr *nest1, *nest2;
@@ -1736,7 +1928,7 @@ static int mnl_nft_setelem_batch(const struct nftnl_set *nls, struct cmd *cmd,
 next:
 	nlh = nftnl_nlmsg_build_hdr(nftnl_batch_buffer(batch), msg_type,
 				    nftnl_set_get_u32(nls, NFTNL_SET_FAMILY),
-				    flags, seqnum);
+				    flags, ctx->seqnum);
 
 	if (nftnl_set_is_set(nls, NFTNL_SET_TABLE)) {
                 mnl_attr_put_strz(nlh, NFTA_SET_ELEM_LIST_TABLE,
@@ -1759,7 +1951,7 @@ next:
 	list_for_each_entry_from(expr, &set->expressions, list) {
 		nlse = alloc_nftnl_setelem(set, expr);
 
-		cmd_add_loc(cmd, nlh->nlmsg_len, &expr->location);
+		cmd_add_loc(cmd, nlh, &expr->location);
 		nest2 = mnl_attr_nest_start(nlh, ++i);
 		nftnl_set_elem_nlmsg_build_payload(nlh, nlse);
 		mnl_attr_nest_end(nlh, nest2);
@@ -1769,6 +1961,10 @@ next:
 		if (mnl_nft_attr_nest_overflow(nlh, nest1, nest2)) {
 			mnl_attr_nest_end(nlh, nest1);
 			mnl_nft_batch_continue(batch);
+			/* error offsets restart in the next message, tell them
+			 * apart through the sequence number.
+			 */
+			ctx->seqnum++;
 			goto next;
 		}
 	}
@@ -1803,7 +1999,7 @@ int mnl_nft_setelem_add(struct netlink_ctx *ctx, struct cmd *cmd,
 	netlink_dump_set(nls, ctx);
 
 	err = mnl_nft_setelem_batch(nls, cmd, ctx->batch, NFT_MSG_NEWSETELEM,
-				    flags, ctx->seqnum, expr, ctx);
+				    flags, expr, ctx);
 	nftnl_set_free(nls);
 
 	return err;
@@ -1863,7 +2059,7 @@ int mnl_nft_setelem_del(struct netlink_ctx *ctx, struct cmd *cmd,
 		msg_type = NFT_MSG_DESTROYSETELEM;
 
 	err = mnl_nft_setelem_batch(nls, cmd, ctx->batch, msg_type, 0,
-				    ctx->seqnum, init, ctx);
+				    init, ctx);
 	nftnl_set_free(nls);
 
 	return err;
@@ -2000,7 +2196,7 @@ static void mnl_nft_ft_devs_build(struct nlmsghdr *nlh, struct cmd *cmd)
 	dev_array = nft_dev_array(dev_expr, &num_devs);
 	nest_dev = mnl_attr_nest_start(nlh, NFTA_FLOWTABLE_HOOK_DEVS);
 	for (i = 0; i < num_devs; i++) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, dev_array[i].location);
+		cmd_add_loc(cmd, nlh, dev_array[i].location);
 		mnl_attr_put_strz(nlh, NFTA_DEVICE_NAME, dev_array[i].ifname);
 	}
 
@@ -2032,9 +2228,9 @@ int mnl_nft_flowtable_add(struct netlink_ctx *ctx, struct cmd *cmd,
 				    NFT_MSG_NEWFLOWTABLE, cmd->handle.family,
 				    NLM_F_CREATE | flags, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.table.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.table.location);
 	mnl_attr_put_strz(nlh, NFTA_FLOWTABLE_TABLE, cmd->handle.table.name);
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.flowtable.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.flowtable.location);
 	mnl_attr_put_strz(nlh, NFTA_FLOWTABLE_NAME, cmd->handle.flowtable.name);
 
 	nftnl_flowtable_nlmsg_build_payload(nlh, flo);
@@ -2081,7 +2277,7 @@ int mnl_nft_flowtable_del(struct netlink_ctx *ctx, struct cmd *cmd)
 				    msg_type, cmd->handle.family,
 				    0, ctx->seqnum);
 
-	cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.table.location);
+	cmd_add_loc(cmd, nlh, &cmd->handle.table.location);
 	mnl_attr_put_strz(nlh, NFTA_FLOWTABLE_TABLE, cmd->handle.table.name);
 
 	if (cmd->handle.flowtable.name) {
@@ -2090,7 +2286,7 @@ int mnl_nft_flowtable_del(struct netlink_ctx *ctx, struct cmd *cmd)
 		mnl_attr_put_strz(nlh, NFTA_FLOWTABLE_NAME,
 				  cmd->handle.flowtable.name);
 	} else if (cmd->handle.handle.id) {
-		cmd_add_loc(cmd, nlh->nlmsg_len, &cmd->handle.handle.location);
+		cmd_add_loc(cmd, nlh, &cmd->handle.handle.location);
 		mnl_attr_put_u64(nlh, NFTA_FLOWTABLE_HANDLE,
 				 htobe64(cmd->handle.handle.id));
 	}
@@ -2111,23 +2307,568 @@ int mnl_nft_flowtable_del(struct netlink_ctx *ctx, struct cmd *cmd)
 	return 0;
 }
 
+/*
+ * Parallel dumps
+ */
+static struct mnl_dump *mnl_nft_dump_add(struct list_head *dumps,
+					 const struct nlmsghdr *nlh,
+					 int (*cb)(const struct nlmsghdr *nlh,
+						   void *data),
+					 void *data,
+					 void (*free_data)(void *data))
+{
+	struct mnl_dump *dump;
+
+	dump = xzalloc(sizeof(*dump));
+	dump->nlh = xmalloc(nlh->nlmsg_len);
+	memcpy(dump->nlh, nlh, nlh->nlmsg_len);
+	dump->cb = cb;
+	dump->data = data;
+	dump->free_data = free_data;
+	list_add_tail(&dump->list, dumps);
+
+	return dump;
+}
+
+static void mnl_nft_set_free(void *data)
+{
+	nftnl_set_free(data);
+}
+
+/* Takes over @nls, which collects the dumped elements. */
+struct mnl_dump *mnl_nft_setelem_dump_add(struct list_head *dumps,
+					  uint32_t seqnum,
+					  struct nftnl_set *nls)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+
+	nlh = nftnl_nlmsg_build_hdr(buf, NFT_MSG_GETSETELEM,
+				    nftnl_set_get_u32(nls, NFTNL_SET_FAMILY),
+				    NLM_F_DUMP, seqnum);
+	nftnl_set_elems_nlmsg_build_payload(nlh, nls);
+
+	return mnl_nft_dump_add(dumps, nlh, set_elem_cb, nls,
+				mnl_nft_set_free);
+}
+
+static void mnl_nft_obj_list_free(void *data)
+{
+	nftnl_obj_list_free(data);
+}
+
+struct mnl_dump *mnl_nft_obj_dump_add(struct list_head *dumps,
+				      uint32_t seqnum, int family,
+				      const char *table)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nftnl_obj_list *nln_list;
+	struct nlmsghdr *nlh;
+
+	nlh = mnl_nft_obj_dump_build(buf, seqnum, family, table, NULL,
+				     NFT_OBJECT_UNSPEC, true, false);
+
+	nln_list = nftnl_obj_list_alloc();
+	if (nln_list == NULL)
+		memory_allocation_error();
+
+	return mnl_nft_dump_add(dumps, nlh, obj_cb, nln_list,
+				mnl_nft_obj_list_free);
+}
+
+static void mnl_nft_rule_list_free(void *data)
+{
+	nftnl_rule_list_free(data);
+}
+
+struct mnl_dump *mnl_nft_rule_dump_add(struct list_head *dumps,
+				       uint32_t seqnum, int family,
+				       const char *table)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nftnl_rule_list *nlr_list;
+	struct nlmsghdr *nlh;
+
+	nlh = mnl_nft_rule_dump_build(buf, seqnum, family, table, NULL, 0,
+				      true, false);
+
+	nlr_list = nftnl_rule_list_alloc();
+	if (nlr_list == NULL)
+		memory_allocation_error();
+
+	return mnl_nft_dump_add(dumps, nlh, rule_cb, nlr_list,
+				mnl_nft_rule_list_free);
+}
+
+void mnl_nft_dump_free(struct list_head *dumps)
+{
+	struct mnl_dump *dump, *next;
+
+	list_for_each_entry_safe(dump, next, dumps, list) {
+		list_del(&dump->list);
+		if (dump->free_data)
+			dump->free_data(dump->data);
+		free(dump->nlh);
+		free(dump);
+	}
+}
+
+struct mnl_dump_pool {
+	pthread_mutex_t		lock;
+	struct list_head	*dumps;
+	struct list_head	*next;
+	uint32_t		genid;
+};
+
+static struct mnl_dump *mnl_dump_pool_get(struct mnl_dump_pool *pool)
+{
+	struct mnl_dump *dump = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->next != pool->dumps) {
+		dump = list_entry(pool->next, struct mnl_dump, list);
+		pool->next = pool->next->next;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return dump;
+}
+
+/* Callbacks only touch the object they are given and the genid, which is
+ * taken from the context before the pool runs, so several dumps can be parsed
+ * concurrently.
+ */
+static int mnl_dump_pool_run(struct mnl_dump_pool *pool,
+			     struct mnl_socket *nf_sock,
+			     struct mnl_recv_buf *rx)
+{
+	uint32_t portid = mnl_socket_get_portid(nf_sock);
+	struct mnl_dump *dump;
+	int ret = 0;
+
+	while ((dump = mnl_dump_pool_get(pool)) != NULL) {
+		if (mnl_socket_sendto(nf_sock, dump->nlh,
+				      dump->nlh->nlmsg_len) < 0 ||
+		    __nft_mnl_recv(nf_sock, rx, dump->nlh->nlmsg_seq, portid,
+				   pool->genid, dump->cb, dump->data) < 0) {
+			dump->err = errno;
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+struct mnl_dump_worker {
+	pthread_t		thread;
+	struct mnl_socket	*nf_sock;
+	struct mnl_recv_buf	*rx;
+	struct mnl_dump_pool	*pool;
+	int			err;
+};
+
+static void *mnl_dump_worker_run(void *arg)
+{
+	struct mnl_dump_worker *worker = arg;
+
+	worker->err = mnl_dump_pool_run(worker->pool, worker->nf_sock,
+					worker->rx);
+
+	return NULL;
+}
+
+/* Worker sockets are opened on the first parallel dump and kept by the
+ * context. They must be in the network namespace of the context socket,
+ * which is the one of the thread that created the context.
+ */
+void mnl_dump_workers_init(struct nft_ctx *nft)
+{
+	struct stat sb;
+
+	if (stat("/proc/thread-self/ns/net", &sb) < 0)
+		return;
+
+	nft->netns.dev = sb.st_dev;
+	nft->netns.ino = sb.st_ino;
+}
+
+static bool mnl_dump_workers_netns(const struct nft_ctx *nft)
+{
+	struct stat sb;
+
+	if (!nft->netns.ino ||
+	    stat("/proc/thread-self/ns/net", &sb) < 0)
+		return false;
+
+	return sb.st_dev == nft->netns.dev && sb.st_ino == nft->netns.ino;
+}
+
+static void mnl_dump_worker_close(struct mnl_dump_worker *worker)
+{
+	mnl_socket_close(worker->nf_sock);
+	worker->nf_sock = NULL;
+	free(worker->rx);
+	worker->rx = NULL;
+}
+
+/* Returns the number of workers with an open socket, up to @num. */
+static unsigned int mnl_dump_workers_get(struct nft_ctx *nft, unsigned int num)
+{
+	struct mnl_dump_worker *worker;
+	unsigned int i;
+
+	/* from another namespace, sockets would dump a different ruleset. */
+	if (!mnl_dump_workers_netns(nft))
+		return 0;
+
+	if (num > nft->num_dump_workers) {
+		nft->dump_workers = xrealloc(nft->dump_workers,
+					     num * sizeof(*nft->dump_workers));
+		memset(&nft->dump_workers[nft->num_dump_workers], 0,
+		       (num - nft->num_dump_workers) *
+		       sizeof(*nft->dump_workers));
+		nft->num_dump_workers = num;
+	}
+
+	for (i = 0; i < num; i++) {
+		worker = &nft->dump_workers[i];
+		if (worker->nf_sock)
+			continue;
+
+		worker->nf_sock = __nft_mnl_socket_open();
+		if (!worker->nf_sock)
+			break;
+
+		worker->rx = mnl_recv_buf_alloc();
+	}
+
+	return i;
+}
+
+void mnl_dump_workers_free(struct nft_ctx *nft)
+{
+	unsigned int i;
+
+	for (i = 0; i < nft->num_dump_workers; i++) {
+		if (nft->dump_workers[i].nf_sock)
+			mnl_dump_worker_close(&nft->dump_workers[i]);
+	}
+	free(nft->dump_workers);
+	nft->dump_workers = NULL;
+	nft->num_dump_workers = 0;
+}
+
+/* The kernel builds the next chunk of a dump when userspace asks for it, so
+ * dumps make progress in parallel only if they are read from several threads.
+ * Each worker uses a socket of the context, see mnl_dump_workers_get(), the
+ * calling thread uses the context socket.
+ * Returns -1 and sets errno to EINTR if the ruleset changed while dumping,
+ * other errors are reported through the err field of each dump.
+ */
+int mnl_nft_dump_run(struct netlink_ctx *ctx, struct list_head *dumps,
+		     unsigned int max_workers)
+{
+	struct mnl_dump_pool pool = {
+		.lock	= PTHREAD_MUTEX_INITIALIZER,
+		.dumps	= dumps,
+		.next	= dumps->next,
+		.genid	= ctx->nft->nf_genid,
+	};
+	struct mnl_recv_buf *rx = nft_mnl_recv_buf(ctx->nft);
+	struct mnl_recv_stats stats = rx->stats, total;
+	struct mnl_dump_worker *workers;
+	unsigned int i, num_workers = 0;
+	struct mnl_dump *dump;
+
+	list_for_each_entry(dump, dumps, list) {
+		if (ctx->nft->debug_mask & NFT_DEBUG_MNL)
+			mnl_nlmsg_fprintf(ctx->nft->output.output_fp, dump->nlh,
+					  dump->nlh->nlmsg_len,
+					  sizeof(struct nfgenmsg));
+		dump->err = 0;
+		/* leave one dump for the calling thread. */
+		if (&dump->list != dumps->next && num_workers < max_workers)
+			num_workers++;
+	}
+
+	if (num_workers)
+		num_workers = mnl_dump_workers_get(ctx->nft, num_workers);
+
+	workers = ctx->nft->dump_workers;
+	for (i = 0; i < num_workers; i++) {
+		workers[i].pool = &pool;
+		workers[i].err = 0;
+		memset(&workers[i].rx->stats, 0, sizeof(workers[i].rx->stats));
+		if (pthread_create(&workers[i].thread, NULL,
+				   mnl_dump_worker_run, &workers[i]))
+			break;
+	}
+	num_workers = i;
+
+	mnl_dump_pool_run(&pool, ctx->nft->nf_sock, rx);
+
+	total = rx->stats;
+	for (i = 0; i < num_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total.syscalls += workers[i].rx->stats.syscalls;
+		total.msgs += workers[i].rx->stats.msgs;
+		total.bytes += workers[i].rx->stats.bytes;
+		/* a failed dump might have left messages behind. */
+		if (workers[i].err)
+			mnl_dump_worker_close(&workers[i]);
+	}
+
+	if (ctx->nft->debug_mask & NFT_DEBUG_MNL)
+		mnl_recv_stats_print(ctx->nft, &total, &stats);
+
+	list_for_each_entry(dump, dumps, list) {
+		if (dump->err == EINTR) {
+			errno = EINTR;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * events
  */
 #define NFTABLES_NLEVENT_BUFSIZ	(1 << 24)
 
+/* Events are received by a reader thread into a ring, so that the socket
+ * buffer keeps being drained while events are formatted. Output is flushed
+ * only when the ring is empty.
+ */
+#define NFTABLES_NLEVENT_RINGSIZ	(1 << 22)
+
+struct mnl_event_hdr {
+	uint32_t		len;
+	int			err;
+};
+
+struct mnl_event_ring {
+	pthread_mutex_t		lock;
+	pthread_cond_t		readable;
+	pthread_cond_t		writable;
+	struct mnl_socket	*nf_sock;
+	int			stop_fd[2];
+	bool			stop;
+	char			*data;
+	size_t			size;
+	size_t			head;
+	size_t			used;
+	char			*rxbuf;
+};
+
+static void mnl_event_ring_copy_in(struct mnl_event_ring *ring,
+				   const void *data, size_t len)
+{
+	size_t tail = (ring->head + ring->used) % ring->size;
+	size_t n = min(len, ring->size - tail);
+
+	memcpy(ring->data + tail, data, n);
+	memcpy(ring->data, (const char *)data + n, len - n);
+	ring->used += len;
+}
+
+static void mnl_event_ring_copy_out(struct mnl_event_ring *ring,
+				    void *data, size_t len)
+{
+	size_t n = min(len, ring->size - ring->head);
+
+	memcpy(data, ring->data + ring->head, n);
+	memcpy((char *)data + n, ring->data, len - n);
+	ring->head = (ring->head + len) % ring->size;
+	ring->used -= len;
+}
+
+/* Blocks while the ring is full, returns -1 if the listener is stopping. */
+static int mnl_event_ring_put(struct mnl_event_ring *ring, int err,
+			      const void *data, uint32_t len)
+{
+	struct mnl_event_hdr hdr = {
+		.len	= len,
+		.err	= err,
+	};
+	int ret = 0;
+
+	pthread_mutex_lock(&ring->lock);
+	while (!ring->stop && ring->size - ring->used < sizeof(hdr) + len)
+		pthread_cond_wait(&ring->writable, &ring->lock);
+
+	if (ring->stop) {
+		ret = -1;
+	} else {
+		mnl_event_ring_copy_in(ring, &hdr, sizeof(hdr));
+		mnl_event_ring_copy_in(ring, data, len);
+		pthread_cond_signal(&ring->readable);
+	}
+	pthread_mutex_unlock(&ring->lock);
+
+	return ret;
+}
+
+static void mnl_event_ring_get(struct mnl_event_ring *ring,
+			       struct output_ctx *octx,
+			       struct mnl_event_hdr *hdr, void *data)
+{
+	pthread_mutex_lock(&ring->lock);
+	if (!ring->used) {
+		pthread_mutex_unlock(&ring->lock);
+		nft_print_flush(octx);
+		pthread_mutex_lock(&ring->lock);
+		while (!ring->used)
+			pthread_cond_wait(&ring->readable, &ring->lock);
+	}
+	mnl_event_ring_copy_out(ring, hdr, sizeof(*hdr));
+	mnl_event_ring_copy_out(ring, data, hdr->len);
+	pthread_cond_signal(&ring->writable);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/* Unless stopped, the reader always queues an error before it bails out, so
+ * the listener never waits for events that do not come.
+ */
+static void *mnl_event_reader(void *arg)
+{
+	struct mnl_event_ring *ring = arg;
+	struct pollfd pfd[] = {
+		{
+			.fd	= mnl_socket_get_fd(ring->nf_sock),
+			.events	= POLLIN,
+		},
+		{
+			.fd	= ring->stop_fd[0],
+			.events	= POLLIN,
+		},
+	};
+	int ret;
+
+	while (1) {
+		ret = poll(pfd, array_size(pfd), -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			mnl_event_ring_put(ring, errno, NULL, 0);
+			break;
+		}
+		if (pfd[1].revents)
+			break;
+
+		ret = mnl_socket_recvfrom(ring->nf_sock, ring->rxbuf,
+					  NFT_NLMSG_MAXSIZE);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				if (mnl_event_ring_put(ring, ENOBUFS, NULL, 0) < 0)
+					break;
+				continue;
+			}
+			mnl_event_ring_put(ring, errno, NULL, 0);
+			break;
+		}
+
+		if (mnl_event_ring_put(ring, 0, ring->rxbuf, ret) < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static int mnl_event_run(const struct mnl_event_hdr *hdr, const void *buf,
+			 unsigned int debug_mask, struct output_ctx *octx,
+			 int (*cb)(const struct nlmsghdr *nlh, void *data),
+			 int (*lost_cb)(void *data), void *cb_data)
+{
+	if (hdr->err == ENOBUFS) {
+		if (lost_cb)
+			return lost_cb(cb_data);
+
+		nft_print(octx, "# ERROR: We lost some netlink events!\n");
+		return 1;
+	} else if (hdr->err) {
+		nft_print(octx, "# ERROR: %s\n", strerror(hdr->err));
+		return -1;
+	}
+
+	if (debug_mask & NFT_DEBUG_MNL) {
+		mnl_nlmsg_fprintf(octx->output_fp, buf, hdr->len,
+				  sizeof(struct nfgenmsg));
+	}
+	return mnl_cb_run(buf, hdr->len, 0, 0, cb, cb_data);
+}
+
+/* Fallback if the reader thread cannot be started. */
+static int mnl_nft_event_listener_sync(struct mnl_socket *nf_sock,
+				       unsigned int debug_mask,
+				       struct output_ctx *octx,
+				       int (*cb)(const struct nlmsghdr *nlh,
+						 void *data),
+				       int (*lost_cb)(void *data),
+				       void *cb_data)
+{
+	struct pollfd pfd = {
+		.fd	= mnl_socket_get_fd(nf_sock),
+		.events	= POLLIN,
+	};
+	struct mnl_event_hdr hdr;
+	char *buf;
+	int ret;
+
+	buf = xmalloc(NFT_NLMSG_MAXSIZE);
+	while (1) {
+		nft_print_flush(octx);
+
+		ret = poll(&pfd, 1, -1);
+		if (ret < 0)
+			break;
+
+		hdr.err = 0;
+		ret = mnl_socket_recvfrom(nf_sock, buf, NFT_NLMSG_MAXSIZE);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			hdr.err = errno;
+			ret = 0;
+		}
+		hdr.len = ret;
+
+		ret = mnl_event_run(&hdr, buf, debug_mask, octx, cb, lost_cb,
+				    cb_data);
+		if (ret <= 0)
+			break;
+	}
+	free(buf);
+
+	return ret;
+}
+
+/* Run @cb on every event received on @nf_sock. If events are lost because the
+ * socket buffer overruns, @lost_cb is called once the events received before
+ * are processed, it reports the loss in the output format in use.
+ */
 int mnl_nft_event_listener(struct mnl_socket *nf_sock, unsigned int debug_mask,
 			   struct output_ctx *octx,
 			   int (*cb)(const struct nlmsghdr *nlh, void *data),
+			   int (*lost_cb)(void *data),
 			   void *cb_data)
 {
 	/* Set netlink socket buffer size to 16 Mbytes to reduce chances of
 	 * message loss due to ENOBUFS.
 	 */
 	unsigned int bufsiz = NFTABLES_NLEVENT_BUFSIZ;
-	int fd = mnl_socket_get_fd(nf_sock);
-	char buf[NFT_NLMSG_MAXSIZE];
-	fd_set readfds;
+	struct mnl_event_ring ring = {
+		.lock		= PTHREAD_MUTEX_INITIALIZER,
+		.readable	= PTHREAD_COND_INITIALIZER,
+		.writable	= PTHREAD_COND_INITIALIZER,
+		.nf_sock	= nf_sock,
+		.size		= NFTABLES_NLEVENT_RINGSIZ,
+	};
+	struct mnl_event_hdr hdr;
+	pthread_t reader;
+	char *buf;
 	int ret;
 
 	ret = mnl_set_rcvbuffer(nf_sock, bufsiz);
@@ -2135,36 +2876,93 @@ int mnl_nft_event_listener(struct mnl_socket *nf_sock, unsigned int debug_mask,
 		nft_print(octx, "# Cannot set up netlink receive socket buffer size to %u bytes, falling back to %u bytes\n",
 			  NFTABLES_NLEVENT_BUFSIZ, bufsiz);
 
+	if (pipe(ring.stop_fd) < 0)
+		return mnl_nft_event_listener_sync(nf_sock, debug_mask, octx,
+						   cb, lost_cb, cb_data);
+
+	ring.data = xmalloc(ring.size);
+	ring.rxbuf = xmalloc(NFT_NLMSG_MAXSIZE);
+	buf = xmalloc(NFT_NLMSG_MAXSIZE);
+
+	if (pthread_create(&reader, NULL, mnl_event_reader, &ring)) {
+		ret = mnl_nft_event_listener_sync(nf_sock, debug_mask, octx,
+						  cb, lost_cb, cb_data);
+		goto out;
+	}
+
+	do {
+		mnl_event_ring_get(&ring, octx, &hdr, buf);
+		ret = mnl_event_run(&hdr, buf, debug_mask, octx, cb, lost_cb,
+				    cb_data);
+	} while (ret > 0);
+
+	pthread_mutex_lock(&ring.lock);
+	ring.stop = true;
+	pthread_cond_signal(&ring.writable);
+	pthread_mutex_unlock(&ring.lock);
+	if (write(ring.stop_fd[1], "", 1) < 0)
+		pthread_cancel(reader);
+	pthread_join(reader, NULL);
+out:
+	close(ring.stop_fd[0]);
+	close(ring.stop_fd[1]);
+	free(ring.data);
+	free(ring.rxbuf);
+	free(buf);
+
+	return ret;
+}
+
+/* Open a socket subscribed to ruleset notifications, this allows for keeping
+ * the cache in sync without dumping the ruleset again. Returns NULL if the
+ * subscription cannot be set up, then callers fall back to full dumps.
+ */
+struct mnl_socket *mnl_nft_event_socket_open(void)
+{
+	int group = NFNLGRP_NFTABLES;
+	struct mnl_socket *nf_sock;
+
+	nf_sock = mnl_socket_open(NETLINK_NETFILTER);
+	if (!nf_sock)
+		return NULL;
+
+	if (mnl_socket_bind(nf_sock, 0, MNL_SOCKET_AUTOPID) < 0 ||
+	    fcntl(mnl_socket_get_fd(nf_sock), F_SETFL, O_NONBLOCK) ||
+	    mnl_socket_setsockopt(nf_sock, NETLINK_ADD_MEMBERSHIP,
+				  &group, sizeof(int)) < 0) {
+		mnl_socket_close(nf_sock);
+		return NULL;
+	}
+	mnl_set_rcvbuffer(nf_sock, NFTABLES_NLEVENT_BUFSIZ);
+
+	return nf_sock;
+}
+
+/* Run the callback on every pending event, without blocking. Returns -1 if
+ * events were lost (errno is ENOBUFS) or if the callback reports an error.
+ */
+int mnl_nft_event_drain(struct mnl_socket *nf_sock,
+			int (*cb)(const struct nlmsghdr *nlh, void *data),
+			void *cb_data)
+{
+	char buf[NFT_NLMSG_MAXSIZE];
+	int ret;
+
 	while (1) {
-		FD_ZERO(&readfds);
-		FD_SET(fd, &readfds);
+		ret = mnl_socket_recvfrom(nf_sock, buf, sizeof(buf));
+		if (ret < 0) {
+			if (errno == EAGAIN)
+				return 0;
+			if (errno == EINTR)
+				continue;
 
-		ret = select(fd + 1, &readfds, NULL, NULL, NULL);
-		if (ret < 0)
 			return -1;
-
-		if (FD_ISSET(fd, &readfds)) {
-			ret = mnl_socket_recvfrom(nf_sock, buf, sizeof(buf));
-			if (ret < 0) {
-				if (errno == ENOBUFS) {
-					nft_print(octx, "# ERROR: We lost some netlink events!\n");
-					continue;
-				}
-				nft_print(octx, "# ERROR: %s\n",
-					  strerror(errno));
-				break;
-			}
 		}
 
-		if (debug_mask & NFT_DEBUG_MNL) {
-			mnl_nlmsg_fprintf(octx->output_fp, buf, sizeof(buf),
-					  sizeof(struct nfgenmsg));
-		}
 		ret = mnl_cb_run(buf, ret, 0, 0, cb, cb_data);
-		if (ret <= 0)
-			break;
+		if (ret < 0)
+			return -1;
 	}
-	return ret;
 }
 
 static struct basehook *basehook_alloc(void)
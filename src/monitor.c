@@ -127,6 +127,19 @@ struct nftnl_obj *netlink_obj_alloc(const struct nlmsghdr *nlh)
 	return nlo;
 }
 
+static struct nftnl_flowtable *netlink_flowtable_alloc(const struct nlmsghdr *nlh)
+{
+	struct nftnl_flowtable *nlf;
+
+	nlf = nftnl_flowtable_alloc();
+	if (nlf == NULL)
+		memory_allocation_error();
+	if (nftnl_flowtable_nlmsg_parse(nlh, nlf) < 0)
+		netlink_abi_error();
+
+	return nlf;
+}
+
 static uint32_t netlink_msg2nftnl_of(uint32_t type, uint16_t flags)
 {
 	switch (type) {
@@ -882,6 +895,561 @@ static void netlink_events_debug(uint16_t type, unsigned int debug_mask)
 	printf("netlink event: %s\n", nftnl_msgtype2str(type));
 }
 
+/*
+ * Incremental cache updates: apply ruleset notifications to the cache in
+ * place. Events that cannot be applied precisely flag the table as stale,
+ * the caller then fetches its content again from the kernel. A negative
+ * return value means the cache is out of sync and needs to be rebuilt.
+ */
+static struct table *netlink_events_sync_table(struct netlink_ctx *ctx,
+					       uint32_t family,
+					       const char *name)
+{
+	return table_cache_find(&ctx->nft->cache.table_cache, name, family);
+}
+
+static int netlink_events_sync_newtable(struct netlink_ctx *ctx,
+					const struct nlmsghdr *nlh)
+{
+	struct nftnl_table *nlt;
+	struct table *t, *old;
+
+	nlt = netlink_table_alloc(nlh);
+	t = netlink_delinearize_table(ctx, nlt);
+	nftnl_table_free(nlt);
+	if (!t)
+		return -1;
+
+	old = netlink_events_sync_table(ctx, t->handle.family,
+					t->handle.table.name);
+	if (old) {
+		/* table update, e.g. dormant flag toggle. */
+		old->flags = t->flags;
+		old->owner = t->owner;
+		table_free(t);
+		return 0;
+	}
+
+	table_cache_add(t, &ctx->nft->cache);
+	return 0;
+}
+
+static int netlink_events_sync_deltable(struct netlink_ctx *ctx,
+					const struct nlmsghdr *nlh)
+{
+	struct nftnl_table *nlt;
+	struct table *t;
+
+	nlt = netlink_table_alloc(nlh);
+	t = netlink_events_sync_table(ctx,
+				      nftnl_table_get_u32(nlt, NFTNL_TABLE_FAMILY),
+				      nftnl_table_get_str(nlt, NFTNL_TABLE_NAME));
+	nftnl_table_free(nlt);
+
+	if (t && !t->stale) {
+		table_cache_del(t);
+		table_free(t);
+	}
+	return 0;
+}
+
+static struct chain *netlink_events_sync_chain_find(const struct table *t,
+						    uint64_t handle)
+{
+	struct chain *chain;
+
+	list_for_each_entry(chain, &t->chain_cache.list, cache.list) {
+		if (chain->handle.handle.id == handle)
+			return chain;
+	}
+	list_for_each_entry(chain, &t->chain_bindings, cache.list) {
+		if (chain->handle.handle.id == handle)
+			return chain;
+	}
+	return NULL;
+}
+
+static int netlink_events_sync_newchain(struct netlink_ctx *ctx,
+					const struct nlmsghdr *nlh)
+{
+	struct nftnl_chain *nlc;
+	struct chain *c;
+	struct table *t;
+
+	nlc = netlink_chain_alloc(nlh);
+	c = netlink_delinearize_chain(ctx, nlc);
+	nftnl_chain_free(nlc);
+
+	t = netlink_events_sync_table(ctx, c->handle.family,
+				      c->handle.table.name);
+	if (!t) {
+		chain_free(c);
+		return -1;
+	}
+	if (t->stale)
+		goto out;
+
+	/* chain update or rename, notification might only carry the
+	 * updated attributes.
+	 */
+	if (netlink_events_sync_chain_find(t, c->handle.handle.id)) {
+		t->stale = true;
+		goto out;
+	}
+
+	if (c->flags & CHAIN_F_BINDING)
+		list_add_tail(&c->cache.list, &t->chain_bindings);
+	else
+		chain_cache_add(c, t);
+
+	return 0;
+out:
+	chain_free(c);
+	return 0;
+}
+
+static int netlink_events_sync_delchain(struct netlink_ctx *ctx,
+					const struct nlmsghdr *nlh)
+{
+	struct nftnl_chain *nlc;
+	const char *name;
+	struct chain *c;
+	struct table *t;
+
+	nlc = netlink_chain_alloc(nlh);
+	t = netlink_events_sync_table(ctx,
+				      nftnl_chain_get_u32(nlc, NFTNL_CHAIN_FAMILY),
+				      nftnl_chain_get_str(nlc, NFTNL_CHAIN_TABLE));
+	if (!t || t->stale)
+		goto out;
+
+	name = nftnl_chain_get_str(nlc, NFTNL_CHAIN_NAME);
+	c = chain_cache_find(t, name);
+	if (!c)
+		c = chain_binding_lookup(t, name);
+	if (!c)
+		goto out;
+
+	/* hook device removal from netdev chain, chain is still there. */
+	if (c->dev_array_len > 0) {
+		t->stale = true;
+		goto out;
+	}
+
+	if (c->flags & CHAIN_F_BINDING)
+		list_del(&c->cache.list);
+	else
+		chain_cache_del(c);
+	chain_free(c);
+out:
+	nftnl_chain_free(nlc);
+	return 0;
+}
+
+static int netlink_events_sync_newrule(struct netlink_ctx *ctx,
+				       const struct nlmsghdr *nlh)
+{
+	struct nft_cache *cache = &ctx->nft->cache;
+	struct nftnl_rule *nlr;
+	const char *chain_name;
+	struct chain *chain;
+	struct rule *r, *prev;
+	struct table *t;
+	int ret = 0;
+
+	nlr = netlink_rule_alloc(nlh);
+	t = netlink_events_sync_table(ctx,
+				      nftnl_rule_get_u32(nlr, NFTNL_RULE_FAMILY),
+				      nftnl_rule_get_str(nlr, NFTNL_RULE_TABLE));
+	if (!t) {
+		ret = -1;
+		goto out;
+	}
+	if (t->stale)
+		goto out;
+
+	chain_name = nftnl_rule_get_str(nlr, NFTNL_RULE_CHAIN);
+	chain = chain_cache_find(t, chain_name);
+	if (!chain)
+		chain = chain_binding_lookup(t, chain_name);
+	if (!chain) {
+		ret = -1;
+		goto out;
+	}
+
+	/* rule replacement, old and new rule order is not reliable. Rules
+	 * might also refer to anonymous sets that are not in the cache.
+	 */
+	if (nlh->nlmsg_flags & NLM_F_REPLACE ||
+	    !(cache->flags & NFT_CACHE_SET_BIT)) {
+		t->stale = true;
+		goto out;
+	}
+
+	r = netlink_delinearize_rule(ctx, nlr);
+	if (!r) {
+		ret = -1;
+		goto out;
+	}
+	nlr_for_each_set(nlr, rule_map_decompose_cb, NULL, cache);
+
+	/* position refers to the previous rule in the chain, if any. */
+	if (r->handle.position.id) {
+		prev = rule_lookup(chain, r->handle.position.id);
+		if (!prev) {
+			rule_free(r);
+			t->stale = true;
+			goto out;
+		}
+		chain_rule_add(chain, r, &prev->list);
+	} else if (nlh->nlmsg_flags & NLM_F_APPEND) {
+		chain_rule_add_tail(chain, r, &chain->rules);
+	} else {
+		chain_rule_add(chain, r, &chain->rules);
+	}
+out:
+	nftnl_rule_free(nlr);
+	return ret;
+}
+
+static int netlink_events_sync_delrule(struct netlink_ctx *ctx,
+				       const struct nlmsghdr *nlh)
+{
+	struct nftnl_rule *nlr;
+	const char *chain_name;
+	struct chain *chain;
+	struct table *t;
+	struct rule *r;
+
+	nlr = netlink_rule_alloc(nlh);
+	t = netlink_events_sync_table(ctx,
+				      nftnl_rule_get_u32(nlr, NFTNL_RULE_FAMILY),
+				      nftnl_rule_get_str(nlr, NFTNL_RULE_TABLE));
+	if (!t || t->stale)
+		goto out;
+
+	chain_name = nftnl_rule_get_str(nlr, NFTNL_RULE_CHAIN);
+	chain = chain_cache_find(t, chain_name);
+	if (!chain)
+		chain = chain_binding_lookup(t, chain_name);
+	if (!chain)
+		goto out;
+
+	r = rule_lookup(chain, nftnl_rule_get_u64(nlr, NFTNL_RULE_HANDLE));
+	if (r) {
+		chain_rule_del(chain, r);
+		rule_free(r);
+	}
+
+	/* there are no notification for anon-set deletion */
+	nlr_for_each_set(nlr, netlink_events_cache_delset_cb, NULL,
+			 &ctx->nft->cache);
+out:
+	nftnl_rule_free(nlr);
+	return 0;
+}
+
+static int netlink_events_sync_newset(struct netlink_ctx *ctx,
+				      const struct nlmsghdr *nlh)
+{
+	struct nftnl_set *nls;
+	struct set *s, *old;
+	struct table *t;
+	int ret = 0;
+
+	nls = netlink_set_alloc(nlh);
+	s = netlink_delinearize_set(ctx, nls);
+	nftnl_set_free(nls);
+	if (!s)
+		return -1;
+
+	t = netlink_events_sync_table(ctx, s->handle.family,
+				      s->handle.table.name);
+	if (!t) {
+		ret = -1;
+		goto out;
+	}
+	if (t->stale)
+		goto out;
+
+	old = set_cache_find(t, s->handle.set.name);
+	if (old) {
+		set_cache_del(old);
+		set_free(old);
+	}
+
+	/* elements of anonymous sets follow in this generation, they are
+	 * needed to delinearize the rule that refers to it. Elements of
+	 * named sets are fetched once all events have been applied.
+	 */
+	if (set_is_anonymous(s->flags))
+		s->init = set_expr_alloc(&netlink_location, s);
+	else
+		s->stale = true;
+
+	set_cache_add(s, t);
+	return 0;
+out:
+	set_free(s);
+	return ret;
+}
+
+static int netlink_events_sync_delset(struct netlink_ctx *ctx,
+				      const struct nlmsghdr *nlh)
+{
+	struct nftnl_set *nls;
+	struct table *t;
+	struct set *s;
+
+	nls = netlink_set_alloc(nlh);
+	t = netlink_events_sync_table(ctx,
+				      nftnl_set_get_u32(nls, NFTNL_SET_FAMILY),
+				      nftnl_set_get_str(nls, NFTNL_SET_TABLE));
+	if (!t || t->stale)
+		goto out;
+
+	s = set_cache_find(t, nftnl_set_get_str(nls, NFTNL_SET_NAME));
+	if (s) {
+		set_cache_del(s);
+		set_free(s);
+	}
+out:
+	nftnl_set_free(nls);
+	return 0;
+}
+
+static int netlink_events_sync_setelem(struct netlink_ctx *ctx,
+				       const struct nlmsghdr *nlh, int type)
+{
+	struct nftnl_set_elems_iter *nlsei;
+	struct nftnl_set_elem *nlse;
+	struct nftnl_set *nls;
+	struct table *t;
+	struct set *s;
+
+	nls = netlink_setelem_alloc(nlh);
+	t = netlink_events_sync_table(ctx,
+				      nftnl_set_get_u32(nls, NFTNL_SET_FAMILY),
+				      nftnl_set_get_str(nls, NFTNL_SET_TABLE));
+	if (!t || t->stale)
+		goto out;
+
+	s = set_cache_find(t, nftnl_set_get_str(nls, NFTNL_SET_NAME));
+	if (!s) {
+		if (type == NFT_MSG_NEWSETELEM)
+			t->stale = true;
+		goto out;
+	}
+
+	if (type == NFT_MSG_DELSETELEM ||
+	    !set_is_anonymous(s->flags) || !s->init) {
+		s->stale = true;
+		goto out;
+	}
+
+	nlsei = nftnl_set_elems_iter_create(nls);
+	if (nlsei == NULL)
+		memory_allocation_error();
+
+	nlse = nftnl_set_elems_iter_next(nlsei);
+	while (nlse != NULL) {
+		if (netlink_delinearize_setelem(nlse, s, &ctx->nft->cache) < 0) {
+			s->stale = true;
+			break;
+		}
+		nlse = nftnl_set_elems_iter_next(nlsei);
+	}
+	nftnl_set_elems_iter_destroy(nlsei);
+out:
+	nftnl_set_free(nls);
+	return 0;
+}
+
+static int netlink_events_sync_newobj(struct netlink_ctx *ctx,
+				      const struct nlmsghdr *nlh)
+{
+	struct nftnl_obj *nlo;
+	struct obj *obj, *old;
+	struct table *t;
+	int ret = 0;
+
+	nlo = netlink_obj_alloc(nlh);
+	obj = netlink_delinearize_obj(ctx, nlo);
+	nftnl_obj_free(nlo);
+	if (!obj)
+		return -1;
+
+	t = netlink_events_sync_table(ctx, obj->handle.family,
+				      obj->handle.table.name);
+	if (!t) {
+		ret = -1;
+		goto out;
+	}
+	if (t->stale)
+		goto out;
+
+	old = obj_cache_find(t, obj->handle.obj.name, obj->type);
+	if (old) {
+		obj_cache_del(old);
+		obj_free(old);
+	}
+	obj_cache_add(obj, t);
+	return 0;
+out:
+	obj_free(obj);
+	return ret;
+}
+
+static int netlink_events_sync_delobj(struct netlink_ctx *ctx,
+				      const struct nlmsghdr *nlh)
+{
+	struct nftnl_obj *nlo;
+	struct obj *obj;
+	struct table *t;
+
+	nlo = netlink_obj_alloc(nlh);
+	t = netlink_events_sync_table(ctx,
+				      nftnl_obj_get_u32(nlo, NFTNL_OBJ_FAMILY),
+				      nftnl_obj_get_str(nlo, NFTNL_OBJ_TABLE));
+	if (!t || t->stale)
+		goto out;
+
+	obj = obj_cache_find(t, nftnl_obj_get_str(nlo, NFTNL_OBJ_NAME),
+			     nftnl_obj_get_u32(nlo, NFTNL_OBJ_TYPE));
+	if (obj) {
+		obj_cache_del(obj);
+		obj_free(obj);
+	}
+out:
+	nftnl_obj_free(nlo);
+	return 0;
+}
+
+static int netlink_events_sync_flowtable(struct netlink_ctx *ctx,
+					 const struct nlmsghdr *nlh, int type)
+{
+	struct nftnl_flowtable *nlf;
+	struct flowtable *ft;
+	struct table *t;
+	int ret = 0;
+
+	nlf = netlink_flowtable_alloc(nlh);
+	t = netlink_events_sync_table(ctx,
+				      nftnl_flowtable_get_u32(nlf, NFTNL_FLOWTABLE_FAMILY),
+				      nftnl_flowtable_get_str(nlf, NFTNL_FLOWTABLE_TABLE));
+	if (!t) {
+		if (type == NFT_MSG_NEWFLOWTABLE)
+			ret = -1;
+		goto out;
+	}
+	if (t->stale)
+		goto out;
+
+	/* updates and deletions might only refer to a subset of devices. */
+	if (type == NFT_MSG_DELFLOWTABLE ||
+	    ft_cache_find(t, nftnl_flowtable_get_str(nlf, NFTNL_FLOWTABLE_NAME))) {
+		t->stale = true;
+		goto out;
+	}
+
+	ft = netlink_delinearize_flowtable(ctx, nlf);
+	if (!ft) {
+		ret = -1;
+		goto out;
+	}
+	ft_cache_add(ft, t);
+out:
+	nftnl_flowtable_free(nlf);
+	return ret;
+}
+
+int netlink_events_cache_sync(struct netlink_ctx *ctx,
+			      const struct nlmsghdr *nlh)
+{
+	uint16_t type = NFNL_MSG_TYPE(nlh->nlmsg_type);
+	unsigned int flags = ctx->nft->cache.flags;
+
+	netlink_events_debug(type, ctx->nft->debug_mask);
+
+	/* skip events for objects that are not in the cache. */
+	switch (type) {
+	case NFT_MSG_NEWCHAIN:
+	case NFT_MSG_DELCHAIN:
+		if (!(flags & NFT_CACHE_CHAIN_BIT))
+			return 0;
+		break;
+	case NFT_MSG_NEWRULE:
+	case NFT_MSG_DELRULE:
+		if (!(flags & NFT_CACHE_RULE_BIT))
+			return 0;
+		break;
+	case NFT_MSG_NEWSET:
+	case NFT_MSG_DELSET:
+	case NFT_MSG_NEWSETELEM:
+	case NFT_MSG_DELSETELEM:
+		if (!(flags & NFT_CACHE_SET_BIT))
+			return 0;
+		break;
+	case NFT_MSG_NEWOBJ:
+	case NFT_MSG_DELOBJ:
+		if (!(flags & NFT_CACHE_OBJECT_BIT))
+			return 0;
+		break;
+	case NFT_MSG_NEWFLOWTABLE:
+	case NFT_MSG_DELFLOWTABLE:
+		if (!(flags & NFT_CACHE_FLOWTABLE_BIT))
+			return 0;
+		break;
+	}
+
+	switch (type) {
+	case NFT_MSG_NEWTABLE:
+		return netlink_events_sync_newtable(ctx, nlh);
+	case NFT_MSG_DELTABLE:
+		return netlink_events_sync_deltable(ctx, nlh);
+	case NFT_MSG_NEWCHAIN:
+		return netlink_events_sync_newchain(ctx, nlh);
+	case NFT_MSG_DELCHAIN:
+		return netlink_events_sync_delchain(ctx, nlh);
+	case NFT_MSG_NEWRULE:
+		return netlink_events_sync_newrule(ctx, nlh);
+	case NFT_MSG_DELRULE:
+		return netlink_events_sync_delrule(ctx, nlh);
+	case NFT_MSG_NEWSET:
+		return netlink_events_sync_newset(ctx, nlh);
+	case NFT_MSG_DELSET:
+		return netlink_events_sync_delset(ctx, nlh);
+	case NFT_MSG_NEWSETELEM:
+	case NFT_MSG_DELSETELEM:
+		return netlink_events_sync_setelem(ctx, nlh, type);
+	case NFT_MSG_NEWOBJ:
+		return netlink_events_sync_newobj(ctx, nlh);
+	case NFT_MSG_DELOBJ:
+		return netlink_events_sync_delobj(ctx, nlh);
+	case NFT_MSG_NEWFLOWTABLE:
+	case NFT_MSG_DELFLOWTABLE:
+		return netlink_events_sync_flowtable(ctx, nlh, type);
+	}
+
+	return 0;
+}
+
+int netlink_events_genid(const struct nlmsghdr *nlh, uint32_t *genid)
+{
+	const struct nlattr *attr;
+
+	mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+		if (mnl_attr_get_type(attr) != NFTA_GEN_ID ||
+		    mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+			continue;
+
+		*genid = ntohl(mnl_attr_get_u32(attr));
+		return 0;
+	}
+
+	return -1;
+}
+
 static int netlink_events_newgen_cb(const struct nlmsghdr *nlh, int type,
 				    struct netlink_mon_handler *monh)
 {
@@ -922,6 +1490,89 @@ static int netlink_events_newgen_cb(const struct nlmsghdr *nlh, int type,
 	return MNL_CB_OK;
 }
 
+/* Events were lost, fetch the ruleset again. Events of the generation the
+ * cache is fetched at, and of older ones, might still be queued. They are
+ * printed, but not applied to the cache again.
+ */
+static int netlink_events_resync(void *data)
+{
+	struct netlink_mon_handler *monh = data;
+	struct nft_ctx *nft = monh->ctx->nft;
+	unsigned int flags = nft->cache.flags;
+	LIST_HEAD(msgs);
+
+	nft_cache_release(&nft->cache);
+	if (nft_cache_update(nft, flags, &msgs, NULL) < 0) {
+		erec_print_list(&nft->output, &msgs, nft->debug_mask);
+		return MNL_CB_ERROR;
+	}
+	if (monh->trace)
+		netlink_trace_cache_flush(monh->trace);
+
+	/* A trace only monitor receives no generation events, so there is
+	 * nothing to skip.
+	 */
+	monh->resync_genid = 0;
+	if (monh->monitor_flags & ~(1 << NFT_MSG_TRACE) &&
+	    nft->cache.genid != monh->genid)
+		monh->resync_genid = nft->cache.genid;
+
+	switch (monh->format) {
+	case NFTNL_OUTPUT_DEFAULT:
+		nft_mon_print(monh, "# resync at generation %u\n",
+			      nft->cache.genid);
+		break;
+	case NFTNL_OUTPUT_JSON:
+		monitor_print_resync_json(monh, nft->cache.genid);
+		nft_mon_print(monh, "\n");
+		break;
+	}
+
+	return MNL_CB_OK;
+}
+
+static int netlink_events_lost(void *data)
+{
+	struct netlink_mon_handler *monh = data;
+
+	switch (monh->format) {
+	case NFTNL_OUTPUT_DEFAULT:
+		nft_mon_print(monh, "# ERROR: We lost some netlink events!\n");
+		break;
+	case NFTNL_OUTPUT_JSON:
+		monitor_print_lost_json(monh);
+		nft_mon_print(monh, "\n");
+		break;
+	}
+
+	return netlink_events_resync(monh);
+}
+
+/* Returns true if the event is already in the cache after a resync. */
+static bool netlink_events_cache_skip(struct netlink_mon_handler *monh,
+				      const struct nlmsghdr *nlh, int type)
+{
+	uint32_t genid;
+
+	if (type != NFT_MSG_NEWGEN || netlink_events_genid(nlh, &genid) < 0)
+		return monh->resync_genid != 0;
+
+	monh->genid = genid;
+	if (!monh->resync_genid)
+		return false;
+
+	if (genid == monh->resync_genid) {
+		monh->resync_genid = 0;
+	} else if ((int32_t)(genid - monh->resync_genid) > 0) {
+		/* the end of the resync generation was lost too, events
+		 * since then belong to newer ones.
+		 */
+		netlink_events_resync(monh);
+	}
+
+	return true;
+}
+
 static int netlink_events_cb(const struct nlmsghdr *nlh, void *data)
 {
 	int ret = MNL_CB_OK;
@@ -929,7 +1580,11 @@ static int netlink_events_cb(const struct nlmsghdr *nlh, void *data)
 	struct netlink_mon_handler *monh = (struct netlink_mon_handler *)data;
 
 	netlink_events_debug(type, monh->ctx->nft->debug_mask);
-	netlink_events_cache_update(monh, nlh, type);
+	if (!netlink_events_cache_skip(monh, nlh, type))
+		netlink_events_cache_update(monh, nlh, type);
+	/* rules printed in trace events may have changed. */
+	if (monh->trace && type != NFT_MSG_TRACE)
+		netlink_trace_cache_flush(monh->trace);
 
 	if (!(monh->monitor_flags & (1 << type)))
 		return ret;
@@ -997,25 +1652,36 @@ int netlink_echo_callback(const struct nlmsghdr *nlh, void *data)
 	return netlink_events_cb(nlh, &echo_monh);
 }
 
-int netlink_monitor(struct netlink_mon_handler *monhandler,
-		    struct mnl_socket *nf_sock)
+/* Events are received on a socket of their own, so that the cache can be
+ * fetched again through the context socket if events are lost.
+ */
+int netlink_monitor(struct netlink_mon_handler *monhandler)
 {
-	int group;
+	struct mnl_socket *nf_sock;
+	int group, ret = -1;
+
+	nf_sock = mnl_nft_monitor_socket_open();
+	if (!nf_sock)
+		return -1;
 
 	if (monhandler->monitor_flags & (1 << NFT_MSG_TRACE)) {
 		group = NFNLGRP_NFTRACE;
 		if (mnl_socket_setsockopt(nf_sock, NETLINK_ADD_MEMBERSHIP,
 					  &group, sizeof(int)) < 0)
-			return -1;
+			goto out;
 	}
 	if (monhandler->monitor_flags & ~(1 << NFT_MSG_TRACE)) {
 		group = NFNLGRP_NFTABLES;
 		if (mnl_socket_setsockopt(nf_sock, NETLINK_ADD_MEMBERSHIP,
 					  &group, sizeof(int)) < 0)
-			return -1;
+			goto out;
 	}
 
-	return mnl_nft_event_listener(nf_sock, monhandler->ctx->nft->debug_mask,
-				      &monhandler->ctx->nft->output,
-				      netlink_events_cb, monhandler);
+	ret = mnl_nft_event_listener(nf_sock, monhandler->ctx->nft->debug_mask,
+				     &monhandler->ctx->nft->output,
+				     netlink_events_cb, netlink_events_lost,
+				     monhandler);
+out:
+	mnl_socket_close(nf_sock);
+	return ret;
 }
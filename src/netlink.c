@@ -1540,11 +1540,9 @@ static int list_setelements(struct nftnl_set *s, struct netlink_ctx *ctx)
 	return nftnl_set_elem_foreach(s, list_setelem_cb, ctx);
 }
 
-int netlink_list_setelems(struct netlink_ctx *ctx, const struct handle *h,
-			  struct set *set, bool reset)
+struct nftnl_set *netlink_setelems_alloc(const struct handle *h)
 {
 	struct nftnl_set *nls;
-	int err;
 
 	nls = nftnl_set_alloc();
 	if (nls == NULL)
@@ -1556,15 +1554,13 @@ int netlink_list_setelems(struct netlink_ctx *ctx, const struct handle *h,
 	if (h->handle.id)
 		nftnl_set_set_u64(nls, NFTNL_SET_HANDLE, h->handle.id);
 
-	err = mnl_nft_setelem_get(ctx, nls, reset);
-	if (err < 0) {
-		nftnl_set_free(nls);
-		if (errno == EINTR)
-			return -1;
-
-		return 0;
-	}
+	return nls;
+}
 
+/* Populate set->init from the elements dumped into @nls. */
+void netlink_setelems_init(struct netlink_ctx *ctx, struct set *set,
+			   struct nftnl_set *nls)
+{
 	ctx->set = set;
 	set->init = set_expr_alloc(&internal_location, set);
 	list_setelements(nls, ctx);
@@ -1576,8 +1572,88 @@ int netlink_list_setelems(struct netlink_ctx *ctx, const struct handle *h,
 	else
 		list_expr_sort(&ctx->set->init->expressions);
 
-	nftnl_set_free(nls);
 	ctx->set = NULL;
+}
+
+int netlink_list_setelems(struct netlink_ctx *ctx, const struct handle *h,
+			  struct set *set, bool reset)
+{
+	struct nftnl_set *nls;
+	int err;
+
+	nls = netlink_setelems_alloc(h);
+
+	err = mnl_nft_setelem_get(ctx, nls, reset);
+	if (err < 0) {
+		nftnl_set_free(nls);
+		if (errno == EINTR)
+			return -1;
+
+		return 0;
+	}
+
+	netlink_setelems_init(ctx, set, nls);
+	nftnl_set_free(nls);
+
+	return 0;
+}
+
+static void setelem_probe_add(const struct set *set, struct expr *init,
+			      const mpz_t value, uint32_t flags)
+{
+	struct expr *expr;
+
+	expr = constant_expr_alloc(&internal_location, set->key->dtype,
+				   set->key->byteorder, set->key->len, NULL);
+	mpz_set(expr->value, value);
+	expr = set_elem_expr_alloc(&internal_location, expr);
+	expr->flags = flags;
+
+	compound_expr_add(init, expr);
+}
+
+/* Fetch the interval that contains @value from the kernel and append it to
+ * @set->init, nothing is appended if @value is not in the set. This relies
+ * on the rbtree backend, which returns the start and the end element of
+ * the enclosing interval on lookups.
+ */
+int netlink_get_setelem_interval(struct netlink_ctx *ctx, struct set *set,
+				 const mpz_t value)
+{
+	struct nftnl_set *nls, *nls_out;
+	struct expr *init, *i, *next;
+	struct set *new_set;
+	mpz_t end;
+
+	init = list_expr_alloc(&internal_location);
+	setelem_probe_add(set, init, value, 0);
+
+	mpz_init_bitmask(end, set->key->len);
+	if (mpz_cmp(value, end)) {
+		mpz_add_ui(end, value, 1);
+		setelem_probe_add(set, init, end, EXPR_F_INTERVAL_END);
+	}
+	mpz_clear(end);
+
+	nls = netlink_setelems_alloc(&set->handle);
+	alloc_setelem_cache(init, nls);
+	netlink_dump_set(nls, ctx);
+
+	nls_out = mnl_nft_setelem_get_one(ctx, nls, false);
+	nftnl_set_free(nls);
+	expr_free(init);
+	if (!nls_out)
+		return errno == ENOENT ? 0 : -1;
+
+	new_set = set_clone(set);
+	netlink_setelems_init(ctx, new_set, nls_out);
+	nftnl_set_free(nls_out);
+
+	list_for_each_entry_safe(i, next, &new_set->init->expressions, list) {
+		compound_expr_remove(new_set->init, i);
+		compound_expr_add(set->init, i);
+	}
+	set_free(new_set);
 
 	return 0;
 }
@@ -1807,7 +1883,7 @@ int netlink_reset_rules(struct netlink_ctx *ctx, const struct cmd *cmd,
 		.list.chain		= h->chain.name,
 		.list.rule_handle	= h->handle.id,
 	};
-	struct rule *rule, *next, *crule, *cnext;
+	struct rule *rule, *next, *crule;
 	struct table *table;
 	struct chain *chain;
 	int ret;
@@ -1826,17 +1902,13 @@ int netlink_reset_rules(struct netlink_ctx *ctx, const struct cmd *cmd,
 			continue;
 
 		list_del(&rule->list);
-		list_for_each_entry_safe(crule, cnext, &chain->rules, list) {
-			if (crule->handle.handle.id != rule->handle.handle.id)
-				continue;
-
-			list_replace(&crule->list, &rule->list);
+		crule = rule_lookup(chain, rule->handle.handle.id);
+		if (crule) {
+			chain_rule_add(chain, rule, &crule->list);
+			chain_rule_del(chain, crule);
 			rule_free(crule);
-			rule = NULL;
-			break;
-		}
-		if (rule) {
-			list_add_tail(&rule->list, &chain->rules);
+		} else {
+			chain_rule_add_tail(chain, rule, &chain->rules);
 		}
 	}
 	list_for_each_entry_safe(rule, next, &ctx->list, list) {
@@ -1929,6 +2001,162 @@ int netlink_list_flowtables(struct netlink_ctx *ctx, const struct handle *h)
 	return err;
 }
 
+/* Decoding the packet headers of a trace event through payload expressions
+ * allocates and frees several expressions per header field. Which fields are
+ * printed, and how, only depends on the family, the header lengths and the
+ * values of the protocol fields though, so the statements built for the first
+ * event with a given layout are kept and only their values are updated from
+ * the raw headers of later events.
+ *
+ * The values are still printed through their datatypes rather than formatted
+ * straight from the raw headers, so output flags, symbol tables and the
+ * dependencies that are left out apply just like in rule listings. Once a
+ * layout is known, the headers of an event cost a hash, a compare of its
+ * protocol fields, one import per printed field and the printing itself, no
+ * expressions are built for them.
+ *
+ * Rules are printed once per handle and kept as text until the next ruleset
+ * event.
+ */
+#define TRACE_CACHE_HSIZE	256
+#define TRACE_CACHE_MAX_LAYOUTS	1024
+
+struct trace_layout {
+	uint32_t		family;
+	uint32_t		nfproto;
+	uint32_t		dev_type;
+	uint32_t		hlen[PROTO_BASE_TRANSPORT_HDR + 1];
+};
+
+/* value of a printed header field, at @offset bits into the header */
+struct trace_field {
+	struct expr		*value;
+	enum proto_bases	base;
+	unsigned int		offset;
+	bool			killed;
+};
+
+/* protocol field the layout was built for */
+struct trace_key {
+	enum proto_bases	base;
+	unsigned int		offset;
+	unsigned int		len;
+	uint32_t		value;
+};
+
+struct trace_plan {
+	struct trace_plan	*next;
+	uint32_t		hash;
+	struct trace_layout	layout;
+	bool			cacheable;
+	struct list_head	stmts;
+	struct trace_field	*fields;
+	unsigned int		num_fields;
+	unsigned int		fields_size;
+	struct trace_key	*keys;
+	unsigned int		num_keys;
+	unsigned int		keys_size;
+};
+
+struct trace_rule {
+	struct trace_rule	*next;
+	uint32_t		hash;
+	uint32_t		family;
+	uint64_t		handle;
+	char			*table;
+	char			*chain;
+	char			*text;
+};
+
+struct netlink_trace_cache {
+	struct trace_plan	*plans[TRACE_CACHE_HSIZE];
+	unsigned int		num_plans;
+	struct trace_rule	*rules[TRACE_CACHE_HSIZE];
+	unsigned int		num_rules;
+};
+
+struct netlink_trace_cache *netlink_trace_cache_alloc(void)
+{
+	return xzalloc(sizeof(struct netlink_trace_cache));
+}
+
+static void trace_plan_free(struct trace_plan *plan)
+{
+	struct stmt *stmt, *next;
+
+	list_for_each_entry_safe(stmt, next, &plan->stmts, list) {
+		list_del(&stmt->list);
+		stmt_free(stmt);
+	}
+	free(plan->fields);
+	free(plan->keys);
+	free(plan);
+}
+
+void netlink_trace_cache_flush(struct netlink_trace_cache *cache)
+{
+	struct trace_rule *rule, *next;
+	unsigned int i;
+
+	if (!cache->num_rules)
+		return;
+
+	for (i = 0; i < TRACE_CACHE_HSIZE; i++) {
+		for (rule = cache->rules[i]; rule; rule = next) {
+			next = rule->next;
+			free(rule->table);
+			free(rule->chain);
+			free(rule->text);
+			free(rule);
+		}
+		cache->rules[i] = NULL;
+	}
+	cache->num_rules = 0;
+}
+
+void netlink_trace_cache_free(struct netlink_trace_cache *cache)
+{
+	struct trace_plan *plan, *next;
+	unsigned int i;
+
+	if (!cache)
+		return;
+
+	netlink_trace_cache_flush(cache);
+	for (i = 0; i < TRACE_CACHE_HSIZE; i++) {
+		for (plan = cache->plans[i]; plan; plan = next) {
+			next = plan->next;
+			trace_plan_free(plan);
+		}
+	}
+	free(cache);
+}
+
+static uint32_t trace_hash(uint32_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ p[i]) * 16777619;
+
+	return hash;
+}
+
+/* @len bits at @offset bits into @hdr, @len is 32 at most. */
+static uint32_t trace_hdr_bits(const uint8_t *hdr, unsigned int offset,
+			       unsigned int len)
+{
+	unsigned int i, end = div_round_up(offset + len, BITS_PER_BYTE);
+	uint64_t val = 0;
+
+	for (i = offset / BITS_PER_BYTE; i < end; i++)
+		val = val << BITS_PER_BYTE | hdr[i];
+
+	val >>= end * BITS_PER_BYTE - offset - len;
+	return val & ((1ULL << len) - 1);
+}
+
 static void trace_print_hdr(const struct nftnl_trace *nlt,
 			    struct output_ctx *octx)
 {
@@ -2026,22 +2254,106 @@ static struct rule *trace_lookup_rule(const struct nftnl_trace *nlt,
 	return rule_lookup(chain, rule_handle);
 }
 
+static char *trace_rule_format(const struct rule *rule,
+			       const struct output_ctx *octx)
+{
+	struct output_ctx rctx = *octx;
+	size_t size;
+	char *text;
+
+	rctx.output_fp = open_memstream(&text, &size);
+	if (!rctx.output_fp)
+		return NULL;
+
+	rule_print(rule, &rctx);
+	if (fclose(rctx.output_fp)) {
+		free(text);
+		return NULL;
+	}
+
+	return text;
+}
+
+static const char *trace_rule_text(struct netlink_trace_cache *tcache,
+				   const struct nftnl_trace *nlt,
+				   uint64_t rule_handle,
+				   struct nft_cache *cache,
+				   const struct output_ctx *octx)
+{
+	const char *table, *chain;
+	struct trace_rule *tr;
+	struct rule *rule;
+	uint32_t family;
+	uint32_t hash;
+	char *text;
+
+	family = nftnl_trace_get_u32(nlt, NFTNL_TRACE_FAMILY);
+	table = nftnl_trace_get_str(nlt, NFTNL_TRACE_TABLE);
+	chain = nftnl_trace_get_str(nlt, NFTNL_TRACE_CHAIN);
+	if (!table || !chain)
+		return NULL;
+
+	hash = trace_hash(2166136261u, &family, sizeof(family));
+	hash = trace_hash(hash, &rule_handle, sizeof(rule_handle));
+	hash = trace_hash(hash, table, strlen(table));
+	hash = trace_hash(hash, chain, strlen(chain));
+
+	for (tr = tcache->rules[hash % TRACE_CACHE_HSIZE]; tr; tr = tr->next) {
+		if (tr->hash == hash &&
+		    tr->family == family &&
+		    tr->handle == rule_handle &&
+		    !strcmp(tr->table, table) &&
+		    !strcmp(tr->chain, chain))
+			return tr->text;
+	}
+
+	rule = trace_lookup_rule(nlt, rule_handle, cache);
+	if (!rule)
+		return NULL;
+
+	text = trace_rule_format(rule, octx);
+	if (!text)
+		return NULL;
+
+	tr = xzalloc(sizeof(*tr));
+	tr->hash = hash;
+	tr->family = family;
+	tr->handle = rule_handle;
+	tr->table = xstrdup(table);
+	tr->chain = xstrdup(chain);
+	tr->text = text;
+	tr->next = tcache->rules[hash % TRACE_CACHE_HSIZE];
+	tcache->rules[hash % TRACE_CACHE_HSIZE] = tr;
+	tcache->num_rules++;
+
+	return text;
+}
+
 static void trace_print_rule(const struct nftnl_trace *nlt,
-			      struct output_ctx *octx, struct nft_cache *cache)
+			      struct output_ctx *octx, struct nft_cache *cache,
+			      struct netlink_trace_cache *tcache)
 {
+	const char *text = NULL;
 	uint64_t rule_handle;
 	struct rule *rule;
 
 	rule_handle = nftnl_trace_get_u64(nlt, NFTNL_TRACE_RULE_HANDLE);
-	rule = trace_lookup_rule(nlt, rule_handle, cache);
+	if (tcache)
+		text = trace_rule_text(tcache, nlt, rule_handle, cache, octx);
 
 	trace_print_hdr(nlt, octx);
 
-	if (rule) {
-		nft_print(octx, "rule ");
-		rule_print(rule, octx);
+	if (text) {
+		nft_print(octx, "rule %s", text);
 	} else {
-		nft_print(octx, "unknown rule handle %" PRIu64, rule_handle);
+		rule = trace_lookup_rule(nlt, rule_handle, cache);
+		if (rule) {
+			nft_print(octx, "rule ");
+			rule_print(rule, octx);
+		} else {
+			nft_print(octx, "unknown rule handle %" PRIu64,
+				  rule_handle);
+		}
 	}
 
 	nft_print(octx, " (");
@@ -2049,16 +2361,88 @@ static void trace_print_rule(const struct nftnl_trace *nlt,
 	nft_print(octx, ")\n");
 }
 
+static void trace_plan_add_field(struct trace_plan *plan, struct expr *value,
+				 enum proto_bases base, unsigned int offset)
+{
+	if (plan->num_fields == plan->fields_size) {
+		plan->fields_size = plan->fields_size ? plan->fields_size * 2 : 16;
+		plan->fields = xrealloc(plan->fields, plan->fields_size *
+						      sizeof(*plan->fields));
+	}
+	plan->fields[plan->num_fields++] = (struct trace_field) {
+		.value	= value,
+		.base	= base,
+		.offset	= offset,
+	};
+}
+
+static void trace_plan_add_key(struct trace_plan *plan, const void *hdr,
+			       enum proto_bases base, unsigned int offset,
+			       unsigned int len)
+{
+	if (len > 32) {
+		plan->cacheable = false;
+		return;
+	}
+
+	if (plan->num_keys == plan->keys_size) {
+		plan->keys_size = plan->keys_size ? plan->keys_size * 2 : 4;
+		plan->keys = xrealloc(plan->keys, plan->keys_size *
+						  sizeof(*plan->keys));
+	}
+	plan->keys[plan->num_keys++] = (struct trace_key) {
+		.base	= base,
+		.offset	= offset,
+		.len	= len,
+		.value	= trace_hdr_bits(hdr, offset, len),
+	};
+}
+
+/* The statement of a field may be released as a redundant dependency, find
+ * its field while its value is still there.
+ */
+static void trace_dependency_kill(struct trace_plan *plan,
+				  struct payload_dep_ctx *pctx,
+				  struct expr *expr, unsigned int family)
+{
+	int field[PROTO_BASE_MAX + 1];
+	unsigned int base, i;
+	struct expr *value;
+
+	for (base = 0; base <= PROTO_BASE_MAX; base++) {
+		field[base] = -1;
+		if (!pctx->pdeps[base])
+			continue;
+
+		value = pctx->pdeps[base]->expr->right;
+		for (i = 0; i < plan->num_fields; i++) {
+			if (!plan->fields[i].killed &&
+			    plan->fields[i].value == value) {
+				field[base] = i;
+				break;
+			}
+		}
+	}
+
+	payload_dependency_kill(pctx, expr, family);
+
+	for (base = 0; base <= PROTO_BASE_MAX; base++) {
+		if (field[base] >= 0 && !pctx->pdeps[base])
+			plan->fields[field[base]].killed = true;
+	}
+}
+
 static void trace_gen_stmts(struct list_head *stmts,
 			    struct proto_ctx *ctx, struct payload_dep_ctx *pctx,
 			    const struct nftnl_trace *nlt, unsigned int attr,
-			    enum proto_bases base)
+			    enum proto_bases base, struct trace_plan *plan)
 {
 	struct list_head unordered = LIST_HEAD_INIT(unordered);
 	struct list_head list;
 	struct expr *rel, *lhs, *rhs, *tmp, *nexpr;
 	struct stmt *stmt;
 	const struct proto_desc *desc;
+	unsigned int offset;
 	const void *hdr;
 	uint32_t hlen;
 	unsigned int n;
@@ -2088,6 +2472,7 @@ restart:
 			goto restart;
 		}
 
+		offset = hlen * BITS_PER_BYTE - rhs->len;
 		tmp = constant_expr_splice(rhs, lhs->len);
 		expr_set_type(tmp, lhs->dtype, lhs->byteorder);
 		if (tmp->byteorder == BYTEORDER_HOST_ENDIAN)
@@ -2104,6 +2489,13 @@ restart:
 			continue;
 		}
 
+		/* Protocol fields select the following ones and which
+		 * dependencies are printed.
+		 */
+		trace_plan_add_field(plan, tmp, base, offset);
+		if (lhs->flags & EXPR_F_PROTOCOL)
+			trace_plan_add_key(plan, hdr, base, offset, lhs->len);
+
 		rel  = relational_expr_alloc(&lhs->location, OP_EQ, lhs, tmp);
 		stmt = expr_stmt_alloc(&rel->location, rel);
 		list_add_tail(&stmt->list, &unordered);
@@ -2136,7 +2528,7 @@ next:
 
 		/* Don't strip 'icmp type' from payload dump. */
 		if (pctx->icmp_type == 0)
-			payload_dependency_kill(pctx, lhs, ctx->family);
+			trace_dependency_kill(plan, pctx, lhs, ctx->family);
 		if (lhs->flags & EXPR_F_PROTOCOL)
 			payload_dependency_store(pctx, stmt, b);
 
@@ -2144,16 +2536,133 @@ next:
 	}
 }
 
+static void trace_layout_init(struct trace_layout *layout,
+			      const uint8_t **hdrs,
+			      const struct nftnl_trace *nlt)
+{
+	static const unsigned int attrs[] = {
+		[PROTO_BASE_LL_HDR]		= NFTNL_TRACE_LL_HEADER,
+		[PROTO_BASE_NETWORK_HDR]	= NFTNL_TRACE_NETWORK_HEADER,
+		[PROTO_BASE_TRANSPORT_HDR]	= NFTNL_TRACE_TRANSPORT_HEADER,
+	};
+	unsigned int base;
+
+	memset(layout, 0, sizeof(*layout));
+	layout->family = nftnl_trace_get_u32(nlt, NFTNL_TRACE_FAMILY);
+	layout->nfproto = UINT32_MAX;
+	if (nftnl_trace_is_set(nlt, NFTNL_TRACE_NFPROTO))
+		layout->nfproto = nftnl_trace_get_u32(nlt, NFTNL_TRACE_NFPROTO);
+	layout->dev_type = UINT32_MAX;
+	if (nftnl_trace_is_set(nlt, NFTNL_TRACE_IIFTYPE))
+		layout->dev_type = nftnl_trace_get_u16(nlt, NFTNL_TRACE_IIFTYPE);
+
+	for (base = PROTO_BASE_LL_HDR; base <= PROTO_BASE_TRANSPORT_HDR; base++) {
+		hdrs[base] = NULL;
+		if (nftnl_trace_is_set(nlt, attrs[base]))
+			hdrs[base] = nftnl_trace_get_data(nlt, attrs[base],
+							  &layout->hlen[base]);
+	}
+}
+
+static struct trace_plan *trace_plan_lookup(struct netlink_trace_cache *cache,
+					    const struct trace_layout *layout,
+					    uint32_t hash, const uint8_t **hdrs)
+{
+	const struct trace_key *key;
+	struct trace_plan *plan;
+	unsigned int i;
+
+	for (plan = cache->plans[hash % TRACE_CACHE_HSIZE]; plan;
+	     plan = plan->next) {
+		if (plan->hash != hash ||
+		    memcmp(&plan->layout, layout, sizeof(*layout)))
+			continue;
+
+		for (i = 0; i < plan->num_keys; i++) {
+			key = &plan->keys[i];
+			if (trace_hdr_bits(hdrs[key->base], key->offset,
+					   key->len) != key->value)
+				break;
+		}
+		if (i == plan->num_keys)
+			return plan;
+	}
+
+	return NULL;
+}
+
+/* Same as splicing the field off the raw header, see trace_gen_stmts(). */
+static void trace_field_update(const struct trace_field *field,
+			       const uint8_t *hdr)
+{
+	struct expr *value = field->value;
+	unsigned int start = field->offset / BITS_PER_BYTE;
+	unsigned int end = div_round_up(field->offset + value->len,
+					BITS_PER_BYTE);
+
+	mpz_import_data(value->value, hdr + start, BYTEORDER_BIG_ENDIAN,
+			end - start);
+	mpz_rshift_ui(value->value,
+		      end * BITS_PER_BYTE - field->offset - value->len);
+	mpz_tdiv_r_2exp(value->value, value->value, value->len);
+	if (value->byteorder == BYTEORDER_HOST_ENDIAN)
+		mpz_switch_byteorder(value->value, value->len / BITS_PER_BYTE);
+}
+
+static void trace_print_stmts(const struct list_head *stmts,
+			      struct output_ctx *octx)
+{
+	struct stmt *stmt;
+
+	list_for_each_entry(stmt, stmts, list) {
+		stmt_print(stmt, octx);
+		nft_print(octx, " ");
+	}
+	nft_print(octx, "\n");
+}
+
+/* Drop fields whose statement was removed as a redundant dependency, the
+ * others are sorted in the order their statements are printed.
+ */
+static void trace_plan_finalize(struct trace_plan *plan)
+{
+	struct trace_field *fields;
+	unsigned int i, num_fields = 0;
+	struct stmt *stmt;
+
+	if (!plan->num_fields)
+		return;
+
+	fields = xmalloc_array(plan->num_fields, sizeof(*fields));
+	list_for_each_entry(stmt, &plan->stmts, list) {
+		for (i = 0; i < plan->num_fields; i++) {
+			if (plan->fields[i].killed ||
+			    plan->fields[i].value != stmt->expr->right)
+				continue;
+
+			fields[num_fields++] = plan->fields[i];
+			break;
+		}
+	}
+	free(plan->fields);
+	plan->fields = fields;
+	plan->num_fields = num_fields;
+}
+
 static void trace_print_packet(const struct nftnl_trace *nlt,
-			        struct output_ctx *octx)
+			        struct output_ctx *octx,
+			        struct netlink_trace_cache *cache)
 {
-	struct list_head stmts = LIST_HEAD_INIT(stmts);
+	const uint8_t *hdrs[PROTO_BASE_TRANSPORT_HDR + 1];
 	const struct proto_desc *ll_desc;
 	struct payload_dep_ctx pctx = {};
+	struct trace_layout layout;
+	struct trace_plan *plan;
 	struct proto_ctx ctx;
 	uint16_t dev_type;
 	uint32_t nfproto;
-	struct stmt *stmt, *next;
+	unsigned int i;
+	uint32_t hash;
 
 	trace_print_hdr(nlt, octx);
 
@@ -2167,6 +2676,27 @@ static void trace_print_packet(const struct nftnl_trace *nlt,
 				 meta_expr_alloc(&netlink_location,
 						 NFT_META_OIF), octx);
 
+	trace_layout_init(&layout, hdrs, nlt);
+	hash = trace_hash(2166136261u, &layout, sizeof(layout));
+
+	if (cache) {
+		plan = trace_plan_lookup(cache, &layout, hash, hdrs);
+		if (plan) {
+			for (i = 0; i < plan->num_fields; i++)
+				trace_field_update(&plan->fields[i],
+						   hdrs[plan->fields[i].base]);
+
+			trace_print_stmts(&plan->stmts, octx);
+			return;
+		}
+	}
+
+	plan = xzalloc(sizeof(*plan));
+	plan->hash = hash;
+	plan->layout = layout;
+	plan->cacheable = cache && cache->num_plans < TRACE_CACHE_MAX_LAYOUTS;
+	init_list_head(&plan->stmts);
+
 	proto_ctx_init(&ctx, nftnl_trace_get_u32(nlt, NFTNL_TRACE_FAMILY), 0, false);
 	ll_desc = ctx.protocol[PROTO_BASE_LL_HDR].desc;
 	if ((ll_desc == &proto_inet || ll_desc  == &proto_netdev) &&
@@ -2184,19 +2714,24 @@ static void trace_print_packet(const struct nftnl_trace *nlt,
 				 proto_dev_desc(dev_type));
 	}
 
-	trace_gen_stmts(&stmts, &ctx, &pctx, nlt, NFTNL_TRACE_LL_HEADER,
-			PROTO_BASE_LL_HDR);
-	trace_gen_stmts(&stmts, &ctx, &pctx, nlt, NFTNL_TRACE_NETWORK_HEADER,
-			PROTO_BASE_NETWORK_HDR);
-	trace_gen_stmts(&stmts, &ctx, &pctx, nlt, NFTNL_TRACE_TRANSPORT_HEADER,
-			PROTO_BASE_TRANSPORT_HDR);
+	trace_gen_stmts(&plan->stmts, &ctx, &pctx, nlt, NFTNL_TRACE_LL_HEADER,
+			PROTO_BASE_LL_HDR, plan);
+	trace_gen_stmts(&plan->stmts, &ctx, &pctx, nlt, NFTNL_TRACE_NETWORK_HEADER,
+			PROTO_BASE_NETWORK_HDR, plan);
+	trace_gen_stmts(&plan->stmts, &ctx, &pctx, nlt, NFTNL_TRACE_TRANSPORT_HEADER,
+			PROTO_BASE_TRANSPORT_HDR, plan);
 
-	list_for_each_entry_safe(stmt, next, &stmts, list) {
-		stmt_print(stmt, octx);
-		nft_print(octx, " ");
-		stmt_free(stmt);
+	trace_print_stmts(&plan->stmts, octx);
+
+	if (!plan->cacheable) {
+		trace_plan_free(plan);
+		return;
 	}
-	nft_print(octx, "\n");
+
+	trace_plan_finalize(plan);
+	plan->next = cache->plans[hash % TRACE_CACHE_HSIZE];
+	cache->plans[hash % TRACE_CACHE_HSIZE] = plan;
+	cache->num_plans++;
 }
 
 int netlink_events_trace_cb(const struct nlmsghdr *nlh, int type,
@@ -2215,13 +2750,13 @@ int netlink_events_trace_cb(const struct nlmsghdr *nlh, int type,
 
 	if (nftnl_trace_is_set(nlt, NFTNL_TRACE_LL_HEADER) ||
 	    nftnl_trace_is_set(nlt, NFTNL_TRACE_NETWORK_HEADER))
-		trace_print_packet(nlt, &monh->ctx->nft->output);
+		trace_print_packet(nlt, &monh->ctx->nft->output, monh->trace);
 
 	switch (nftnl_trace_get_u32(nlt, NFTNL_TRACE_TYPE)) {
 	case NFT_TRACETYPE_RULE:
 		if (nftnl_trace_is_set(nlt, NFTNL_TRACE_RULE_HANDLE))
 			trace_print_rule(nlt, &monh->ctx->nft->output,
-					 &monh->ctx->nft->cache);
+					 &monh->ctx->nft->cache, monh->trace);
 		break;
 	case NFT_TRACETYPE_POLICY:
 		trace_print_hdr(nlt, &monh->ctx->nft->output);
@@ -5,6 +5,11 @@
 #include "nftutils.h"
 
 #include <netdb.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <cache.h>
+#include <utils.h>
 
 /* Buffer size used for getprotobynumber_r() and similar. The manual comments
  * that a buffer of 1024 should be sufficient "for most applications"(??), so
@@ -12,7 +17,252 @@
  * choose a smaller one. */
 #define NETDB_BUFSIZE 2048
 
-bool nft_getprotobynumber(int proto, char *out_name, size_t name_len)
+/* Per-context copy of the services and protocols databases. Looking up names
+ * through NSS re-reads /etc/services and /etc/protocols on every call, which
+ * dominates listing and parsing of large sets. The databases are enumerated
+ * once on first use and then indexed by name (including aliases) and by
+ * number. Names or numbers missing from the copy, and all of them if the
+ * enumeration yields nothing, e.g. because the configured NSS backend does not
+ * support it, are still looked up through the NSS calls below, the copy only
+ * makes lookups faster and never changes their result. Numbers NSS has no
+ * name for either are remembered, so listing a set of unnamed ports does not
+ * ask NSS again for each of them.
+ */
+#define NFT_NETDB_HSIZE		1024
+
+struct nft_netdb_entry {
+	struct nft_netdb_entry	*next;
+	struct nft_netdb_entry	*name_next;
+	struct nft_netdb_entry	*value_next;
+	uint16_t		value;
+	char			name[];
+};
+
+struct nft_netdb_table {
+	bool			loaded;
+	unsigned int		nelems;
+	struct nft_netdb_entry	*entries;
+	struct nft_netdb_entry	*name_hash[NFT_NETDB_HSIZE];
+	struct nft_netdb_entry	*value_hash[NFT_NETDB_HSIZE];
+	uint64_t		value_miss[(UINT16_MAX + 1) / 64];
+};
+
+struct nft_netdb {
+	struct nft_netdb_table	services;
+	struct nft_netdb_table	protocols;
+};
+
+static struct nft_netdb_entry *
+nft_netdb_lookup_name(const struct nft_netdb_table *t, const char *name)
+{
+	struct nft_netdb_entry *e;
+
+	for (e = t->name_hash[djb_hash(name) % NFT_NETDB_HSIZE]; e;
+	     e = e->name_next) {
+		if (!strcmp(e->name, name))
+			return e;
+	}
+	return NULL;
+}
+
+static struct nft_netdb_entry *
+nft_netdb_lookup_value(const struct nft_netdb_table *t, uint16_t value)
+{
+	struct nft_netdb_entry *e;
+
+	for (e = t->value_hash[value % NFT_NETDB_HSIZE]; e; e = e->value_next) {
+		if (e->value == value)
+			return e;
+	}
+	return NULL;
+}
+
+static bool nft_netdb_value_missing(const struct nft_netdb_table *t,
+				    uint16_t value)
+{
+	return t->value_miss[value / 64] & (1ULL << (value % 64));
+}
+
+static void nft_netdb_value_miss(struct nft_netdb_table *t, uint16_t value)
+{
+	t->value_miss[value / 64] |= 1ULL << (value % 64);
+}
+
+/* The first entry wins for both names and numbers, this is what
+ * getservbyname() and getservbyport() report for duplicate entries, e.g. the
+ * tcp and udp lines of the same service.
+ */
+static void nft_netdb_add(struct nft_netdb_table *t, const char *name,
+			  uint16_t value, bool primary)
+{
+	bool add_name, add_value;
+	struct nft_netdb_entry *e;
+	size_t len;
+
+	add_name = !nft_netdb_lookup_name(t, name);
+	add_value = primary && !nft_netdb_lookup_value(t, value);
+	if (!add_name && !add_value)
+		return;
+
+	len = strlen(name);
+	e = xmalloc(sizeof(*e) + len + 1);
+	memcpy(e->name, name, len + 1);
+	e->value = value;
+	e->name_next = NULL;
+	e->value_next = NULL;
+	e->next = t->entries;
+	t->entries = e;
+
+	if (add_name) {
+		struct nft_netdb_entry **bucket;
+
+		bucket = &t->name_hash[djb_hash(name) % NFT_NETDB_HSIZE];
+		e->name_next = *bucket;
+		*bucket = e;
+	}
+	if (add_value) {
+		e->value_next = t->value_hash[value % NFT_NETDB_HSIZE];
+		t->value_hash[value % NFT_NETDB_HSIZE] = e;
+	}
+	t->nelems++;
+}
+
+static void nft_netdb_add_all(struct nft_netdb_table *t, const char *name,
+			      char **aliases, uint16_t value)
+{
+	char **alias;
+
+	nft_netdb_add(t, name, value, true);
+	for (alias = aliases; alias && *alias; alias++)
+		nft_netdb_add(t, *alias, value, false);
+}
+
+/* setservent() and setprotoent() rewind a single cursor shared by the whole
+ * process, contexts loading their copy from different threads would each get
+ * part of the database only.
+ */
+static pthread_mutex_t nft_netdb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void nft_netdb_load_services(struct nft_netdb_table *t)
+{
+	const struct servent *result;
+
+#if HAVE_DECL_GETSERVENT_R
+	struct servent result_buf;
+	char buf[NETDB_BUFSIZE];
+
+	setservent(0);
+	while (getservent_r(&result_buf, buf, sizeof(buf),
+			    (struct servent **) &result) == 0 && result)
+		nft_netdb_add_all(t, result->s_name, result->s_aliases,
+				  ntohs(result->s_port));
+#else
+	setservent(0);
+	while ((result = getservent()) != NULL)
+		nft_netdb_add_all(t, result->s_name, result->s_aliases,
+				  ntohs(result->s_port));
+#endif
+	endservent();
+}
+
+static void nft_netdb_load_protocols(struct nft_netdb_table *t)
+{
+	const struct protoent *result;
+
+#if HAVE_DECL_GETPROTOENT_R
+	struct protoent result_buf;
+	char buf[NETDB_BUFSIZE];
+
+	setprotoent(0);
+	while (getprotoent_r(&result_buf, buf, sizeof(buf),
+			     (struct protoent **) &result) == 0 && result) {
+		if (result->p_proto < 0 || result->p_proto > UINT8_MAX)
+			continue;
+		nft_netdb_add_all(t, result->p_name, result->p_aliases,
+				  result->p_proto);
+	}
+#else
+	setprotoent(0);
+	while ((result = getprotoent()) != NULL) {
+		if (result->p_proto < 0 || result->p_proto > UINT8_MAX)
+			continue;
+		nft_netdb_add_all(t, result->p_name, result->p_aliases,
+				  result->p_proto);
+	}
+#endif
+	endprotoent();
+}
+
+static void nft_netdb_table_flush(struct nft_netdb_table *t)
+{
+	struct nft_netdb_entry *e, *next;
+
+	for (e = t->entries; e; e = next) {
+		next = e->next;
+		free(e);
+	}
+	memset(t, 0, sizeof(*t));
+}
+
+static struct nft_netdb_table *nft_netdb_services(struct nft_netdb *db)
+{
+	if (!db)
+		return NULL;
+
+	if (!db->services.loaded) {
+		pthread_mutex_lock(&nft_netdb_lock);
+		nft_netdb_load_services(&db->services);
+		pthread_mutex_unlock(&nft_netdb_lock);
+		db->services.loaded = true;
+	}
+	return db->services.nelems ? &db->services : NULL;
+}
+
+static struct nft_netdb_table *nft_netdb_protocols(struct nft_netdb *db)
+{
+	if (!db)
+		return NULL;
+
+	if (!db->protocols.loaded) {
+		pthread_mutex_lock(&nft_netdb_lock);
+		nft_netdb_load_protocols(&db->protocols);
+		pthread_mutex_unlock(&nft_netdb_lock);
+		db->protocols.loaded = true;
+	}
+	return db->protocols.nelems ? &db->protocols : NULL;
+}
+
+static bool nft_netdb_copy_name(const struct nft_netdb_entry *e,
+				char *out_name, size_t name_len)
+{
+	if (!e || strlen(e->name) >= name_len)
+		return false;
+
+	strcpy(out_name, e->name);
+	return true;
+}
+
+struct nft_netdb *nft_netdb_alloc(void)
+{
+	return xzalloc(sizeof(struct nft_netdb));
+}
+
+void nft_netdb_flush(struct nft_netdb *db)
+{
+	nft_netdb_table_flush(&db->services);
+	nft_netdb_table_flush(&db->protocols);
+}
+
+void nft_netdb_free(struct nft_netdb *db)
+{
+	if (!db)
+		return;
+
+	nft_netdb_flush(db);
+	free(db);
+}
+
+static bool __nft_getprotobynumber(int proto, char *out_name, size_t name_len)
 {
 	const struct protoent *result;
 
@@ -41,7 +291,7 @@ bool nft_getprotobynumber(int proto, char *out_name, size_t name_len)
 	return true;
 }
 
-int nft_getprotobyname(const char *name)
+static int __nft_getprotobyname(const char *name)
 {
 	const struct protoent *result;
 
@@ -69,7 +319,8 @@ int nft_getprotobyname(const char *name)
 	return (uint8_t) result->p_proto;
 }
 
-bool nft_getservbyport(int port, const char *proto, char *out_name, size_t name_len)
+static bool __nft_getservbyport(int port, const char *proto,
+				char *out_name, size_t name_len)
 {
 	const struct servent *result;
 
@@ -98,3 +349,83 @@ bool nft_getservbyport(int port, const char *proto, char *out_name, size_t name_
 	strcpy(out_name, result->s_name);
 	return true;
 }
+
+bool nft_getprotobynumber(struct nft_netdb *db, int proto,
+			  char *out_name, size_t name_len)
+{
+	struct nft_netdb_table *t = nft_netdb_protocols(db);
+	const struct nft_netdb_entry *e = NULL;
+
+	if (proto < 0 || proto > UINT8_MAX)
+		t = NULL;
+	if (t) {
+		if (nft_netdb_value_missing(t, proto))
+			return false;
+
+		e = nft_netdb_lookup_value(t, proto);
+	}
+	if (!e) {
+		if (__nft_getprotobynumber(proto, out_name, name_len))
+			return true;
+		if (t)
+			nft_netdb_value_miss(t, proto);
+		return false;
+	}
+
+	return nft_netdb_copy_name(e, out_name, name_len);
+}
+
+int nft_getprotobyname(struct nft_netdb *db, const char *name)
+{
+	const struct nft_netdb_table *t = nft_netdb_protocols(db);
+	const struct nft_netdb_entry *e = NULL;
+
+	if (t)
+		e = nft_netdb_lookup_name(t, name);
+	if (!e)
+		return __nft_getprotobyname(name);
+
+	return e->value;
+}
+
+bool nft_getservbyport(struct nft_netdb *db, int port, const char *proto,
+		       char *out_name, size_t name_len)
+{
+	struct nft_netdb_table *t = NULL;
+	const struct nft_netdb_entry *e = NULL;
+
+	/* The cache is protocol agnostic, just like getservbyport(port, NULL). */
+	if (!proto)
+		t = nft_netdb_services(db);
+	if (t) {
+		if (nft_netdb_value_missing(t, ntohs(port)))
+			return false;
+
+		e = nft_netdb_lookup_value(t, ntohs(port));
+	}
+	if (!e) {
+		if (__nft_getservbyport(port, proto, out_name, name_len))
+			return true;
+		if (t)
+			nft_netdb_value_miss(t, ntohs(port));
+		return false;
+	}
+
+	return nft_netdb_copy_name(e, out_name, name_len);
+}
+
+bool nft_getservbyname(struct nft_netdb *db, const char *name, uint16_t *port)
+{
+	const struct nft_netdb_table *t = nft_netdb_services(db);
+	const struct nft_netdb_entry *e;
+
+	if (!t)
+		return false;
+
+	e = nft_netdb_lookup_name(t, name);
+	if (!e)
+		return false;
+
+	*port = htons(e->value);
+	return true;
+}
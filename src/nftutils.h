@@ -3,18 +3,30 @@
 #define NFTUTILS_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+struct nft_netdb;
+
+struct nft_netdb *nft_netdb_alloc(void);
+void nft_netdb_flush(struct nft_netdb *db);
+void nft_netdb_free(struct nft_netdb *db);
 
 /* The maximum buffer size for (struct protoent).p_name. It is excessively large,
  * while still reasonably fitting on the stack. Arbitrarily chosen. */
 #define NFT_PROTONAME_MAXSIZE 1024
 
-bool nft_getprotobynumber(int number, char *out_name, size_t name_len);
-int nft_getprotobyname(const char *name);
+bool nft_getprotobynumber(struct nft_netdb *db, int number,
+			  char *out_name, size_t name_len);
+int nft_getprotobyname(struct nft_netdb *db, const char *name);
 
 /* The maximum buffer size for (struct servent).s_name. It is excessively large,
  * while still reasonably fitting on the stack. Arbitrarily chosen. */
 #define NFT_SERVNAME_MAXSIZE 1024
 
-bool nft_getservbyport(int port, const char *proto, char *out_name, size_t name_len);
+bool nft_getservbyport(struct nft_netdb *db, int port, const char *proto,
+		       char *out_name, size_t name_len);
+
+/* Only consults the cached services database, @port is in network byte order. */
+bool nft_getservbyname(struct nft_netdb *db, const char *name, uint16_t *port);
 
 #endif /* NFTUTILS_H */
@@ -23,13 +23,36 @@
 #include <erec.h>
 #include <linux/netfilter.h>
 
-#define MAX_STMTS	32
+#define STMT_HSIZE_MIN	64
+
+/* Row of the statement matrix, only the selectors that are present in the
+ * rule are stored, sorted by their index in the array of selectors.
+ */
+struct stmt_cell {
+	uint32_t	k;
+	struct stmt	*stmt;
+};
+
+struct stmt_row {
+	struct stmt_cell	*cells;
+	uint32_t		num_cells;
+	uint32_t		hash;
+};
 
 struct optimize_ctx {
-	struct stmt *stmt[MAX_STMTS];
+	struct stmt **stmt;
 	uint32_t num_stmts;
+	uint32_t stmt_size;
 
-	struct stmt ***stmt_matrix;
+	/* selectors hash table, buckets and chains store index + 1 */
+	uint32_t *stmt_hash;
+	uint32_t *stmt_next;
+	uint32_t hsize;
+	uint32_t num_hashed;
+	int unsupported;
+	int verdict;
+
+	struct stmt_row *stmt_matrix;
 	struct rule **rule;
 	uint32_t num_rules;
 };
@@ -336,36 +359,161 @@ static bool stmt_verdict_eq(const struct stmt *stmt_a, const struct stmt *stmt_b
 	return false;
 }
 
-static bool stmt_type_find(struct optimize_ctx *ctx, const struct stmt *stmt)
+static uint32_t stmt_hash_mix(uint32_t hash, uint32_t val)
 {
-	bool unsupported_exists = false;
-	uint32_t i;
+	return (hash ^ val) * 16777619;
+}
 
-	for (i = 0; i < ctx->num_stmts; i++) {
-		if (ctx->stmt[i]->ops->type == STMT_INVALID)
-			unsupported_exists = true;
+static uint32_t stmt_hash_ptr(uint32_t hash, const void *ptr)
+{
+	return stmt_hash_mix(hash, (uint32_t)(uintptr_t)ptr);
+}
 
-		if (__stmt_type_eq(stmt, ctx->stmt[i], false))
-			return true;
+/* Selectors that are equal according to __expr_cmp() must hash the same,
+ * only a subset of the compared fields is used here.
+ */
+static uint32_t expr_selector_hash(const struct expr *expr, uint32_t hash)
+{
+	hash = stmt_hash_mix(hash, expr->etype);
+
+	switch (expr->etype) {
+	case EXPR_PAYLOAD:
+		hash = stmt_hash_mix(hash, expr->payload.offset);
+		hash = stmt_hash_ptr(hash, expr->payload.desc);
+		hash = stmt_hash_ptr(hash, expr->payload.tmpl);
+		break;
+	case EXPR_EXTHDR:
+		hash = stmt_hash_ptr(hash, expr->exthdr.tmpl);
+		break;
+	case EXPR_META:
+		hash = stmt_hash_mix(hash, expr->meta.key);
+		break;
+	case EXPR_CT:
+		hash = stmt_hash_mix(hash, expr->ct.key);
+		hash = stmt_hash_mix(hash, expr->ct.direction);
+		break;
+	case EXPR_RT:
+		hash = stmt_hash_mix(hash, expr->rt.key);
+		break;
+	case EXPR_SOCKET:
+		hash = stmt_hash_mix(hash, expr->socket.key);
+		break;
+	case EXPR_XFRM:
+		hash = stmt_hash_mix(hash, expr->xfrm.key);
+		break;
+	case EXPR_BINOP:
+		return expr_selector_hash(expr->left, hash);
+	default:
+		break;
 	}
 
+	return hash;
+}
+
+/* Hash on the fields that __stmt_type_eq() compares when not performing a
+ * full comparison.
+ */
+static uint32_t stmt_selector_hash(const struct stmt *stmt)
+{
+	uint32_t hash = stmt_hash_mix(2166136261u, stmt->ops->type);
+
 	switch (stmt->ops->type) {
 	case STMT_EXPRESSION:
-	case STMT_VERDICT:
-	case STMT_COUNTER:
-	case STMT_NOTRACK:
+		hash = stmt_hash_mix(hash, stmt->expr->op);
+		return expr_selector_hash(stmt->expr->left, hash);
 	case STMT_LOG:
-	case STMT_NAT:
+		hash = stmt_hash_mix(hash, stmt->log.group);
+		hash = stmt_hash_mix(hash, stmt->log.level);
+		break;
 	case STMT_REJECT:
+		hash = stmt_hash_mix(hash, stmt->reject.family);
+		hash = stmt_hash_mix(hash, stmt->reject.type);
+		break;
+	case STMT_NAT:
+		hash = stmt_hash_mix(hash, stmt->nat.type);
+		hash = stmt_hash_mix(hash, stmt->nat.family);
+		hash = stmt_hash_mix(hash, stmt->nat.flags);
 		break;
 	default:
-		/* add unsupported statement only once to statement matrix. */
-		if (unsupported_exists)
-			return true;
 		break;
 	}
 
-	return false;
+	return hash;
+}
+
+static int stmt_selector_find(const struct optimize_ctx *ctx,
+			      const struct stmt *stmt, uint32_t hash)
+{
+	uint32_t i;
+
+	if (!ctx->hsize)
+		return -1;
+
+	for (i = ctx->stmt_hash[hash & (ctx->hsize - 1)]; i;
+	     i = ctx->stmt_next[i - 1]) {
+		if (__stmt_type_eq(stmt, ctx->stmt[i - 1], false))
+			return i - 1;
+	}
+
+	return -1;
+}
+
+static void stmt_selector_hash_resize(struct optimize_ctx *ctx)
+{
+	uint32_t hsize = ctx->hsize ? ctx->hsize * 2 : STMT_HSIZE_MIN;
+	uint32_t i, h;
+
+	free(ctx->stmt_hash);
+	ctx->stmt_hash = xzalloc_array(hsize, sizeof(*ctx->stmt_hash));
+	ctx->hsize = hsize;
+
+	for (i = 0; i < ctx->num_stmts; i++) {
+		if (ctx->stmt[i]->ops->type == STMT_INVALID)
+			continue;
+
+		h = stmt_selector_hash(ctx->stmt[i]) & (hsize - 1);
+		ctx->stmt_next[i] = ctx->stmt_hash[h];
+		ctx->stmt_hash[h] = i + 1;
+	}
+}
+
+static void stmt_selector_add(struct optimize_ctx *ctx, struct stmt *clone,
+			      uint32_t hash)
+{
+	uint32_t k = ctx->num_stmts;
+
+	if (ctx->num_stmts == ctx->stmt_size) {
+		ctx->stmt_size = ctx->stmt_size ? ctx->stmt_size * 2 : 16;
+		ctx->stmt = xrealloc(ctx->stmt,
+				     ctx->stmt_size * sizeof(*ctx->stmt));
+		ctx->stmt_next = xrealloc(ctx->stmt_next,
+					  ctx->stmt_size * sizeof(*ctx->stmt_next));
+	}
+	ctx->stmt[ctx->num_stmts++] = clone;
+	ctx->stmt_next[k] = 0;
+
+	switch (clone->ops->type) {
+	case STMT_INVALID:
+		/* unsupported statements share one single column. */
+		ctx->unsupported = k;
+		return;
+	case STMT_VERDICT:
+		if (ctx->verdict < 0)
+			ctx->verdict = k;
+		break;
+	default:
+		break;
+	}
+
+	if (ctx->num_hashed >= ctx->hsize) {
+		ctx->num_hashed++;
+		stmt_selector_hash_resize(ctx);
+		return;
+	}
+
+	ctx->stmt_next[k] = ctx->stmt_hash[hash & (ctx->hsize - 1)];
+	ctx->stmt_hash[hash & (ctx->hsize - 1)] = k + 1;
+	ctx->num_hashed++;
 }
 
 static struct stmt_ops unsupported_stmt_ops = {
@@ -373,12 +521,14 @@ static struct stmt_ops unsupported_stmt_ops = {
 	.name	= "unsupported",
 };
 
-static int rule_collect_stmts(struct optimize_ctx *ctx, struct rule *rule)
+static void rule_collect_stmts(struct optimize_ctx *ctx, struct rule *rule)
 {
 	struct stmt *stmt, *clone;
+	uint32_t hash;
 
 	list_for_each_entry(stmt, &rule->stmts, list) {
-		if (stmt_type_find(ctx, stmt))
+		hash = stmt_selector_hash(stmt);
+		if (stmt_selector_find(ctx, stmt, hash) >= 0)
 			continue;
 
 		/* No refcounter available in statement objects, clone it to
@@ -439,36 +589,53 @@ static int rule_collect_stmts(struct optimize_ctx *ctx, struct rule *rule)
 			break;
 		}
 
-		ctx->stmt[ctx->num_stmts++] = clone;
-		if (ctx->num_stmts >= MAX_STMTS)
-			return -1;
-	}
+		/* add unsupported statement only once to statement matrix. */
+		if (clone->ops->type == STMT_INVALID && ctx->unsupported >= 0) {
+			stmt_free(clone);
+			continue;
+		}
 
-	return 0;
+		stmt_selector_add(ctx, clone, hash);
+	}
 }
 
-static int unsupported_in_stmt_matrix(const struct optimize_ctx *ctx)
+static struct stmt *stmt_matrix_get(const struct optimize_ctx *ctx,
+				    uint32_t i, uint32_t k)
 {
-	uint32_t i;
-
-	for (i = 0; i < ctx->num_stmts; i++) {
-		if (ctx->stmt[i]->ops->type == STMT_INVALID)
-			return i;
+	const struct stmt_row *row = &ctx->stmt_matrix[i];
+	uint32_t lo = 0, hi = row->num_cells, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (row->cells[mid].k == k)
+			return row->cells[mid].stmt;
+		if (row->cells[mid].k < k)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	/* this should not happen. */
-	return -1;
+
+	return NULL;
 }
 
-static int cmd_stmt_find_in_stmt_matrix(struct optimize_ctx *ctx, struct stmt *stmt)
+static void stmt_row_set(struct stmt_row *row, uint32_t k, struct stmt *stmt)
 {
-	uint32_t i;
+	uint32_t j = row->num_cells;
 
-	for (i = 0; i < ctx->num_stmts; i++) {
-		if (__stmt_type_eq(stmt, ctx->stmt[i], false))
-			return i;
+	while (j > 0 && row->cells[j - 1].k > k)
+		j--;
+
+	/* same selector shows up twice in this rule, last one wins. */
+	if (j > 0 && row->cells[j - 1].k == k) {
+		row->cells[j - 1].stmt = stmt;
+		return;
 	}
 
-	return -1;
+	memmove(&row->cells[j + 1], &row->cells[j],
+		(row->num_cells - j) * sizeof(*row->cells));
+	row->cells[j].k = k;
+	row->cells[j].stmt = stmt;
+	row->num_cells++;
 }
 
 static struct stmt unsupported_stmt = {
@@ -478,34 +645,39 @@ static struct stmt unsupported_stmt = {
 static void rule_build_stmt_matrix_stmts(struct optimize_ctx *ctx,
 					 struct rule *rule, uint32_t *i)
 {
+	struct stmt_row *row = &ctx->stmt_matrix[*i];
+	uint32_t j, num_stmts = 0;
 	struct stmt *stmt;
 	int k;
 
+	list_for_each_entry(stmt, &rule->stmts, list)
+		num_stmts++;
+
+	if (num_stmts)
+		row->cells = xmalloc_array(num_stmts, sizeof(*row->cells));
+
 	list_for_each_entry(stmt, &rule->stmts, list) {
-		k = cmd_stmt_find_in_stmt_matrix(ctx, stmt);
+		k = stmt_selector_find(ctx, stmt, stmt_selector_hash(stmt));
 		if (k < 0) {
-			k = unsupported_in_stmt_matrix(ctx);
+			k = ctx->unsupported;
 			assert(k >= 0);
-			ctx->stmt_matrix[*i][k] = &unsupported_stmt;
+			stmt_row_set(row, k, &unsupported_stmt);
 			continue;
 		}
-		ctx->stmt_matrix[*i][k] = stmt;
+		stmt_row_set(row, k, stmt);
 	}
+
+	/* rules with different selectors cannot be merged. */
+	row->hash = 2166136261u;
+	for (j = 0; j < row->num_cells; j++)
+		row->hash = stmt_hash_mix(row->hash, row->cells[j].k);
+
 	ctx->rule[(*i)++] = rule;
 }
 
 static int stmt_verdict_find(const struct optimize_ctx *ctx)
 {
-	uint32_t i;
-
-	for (i = 0; i < ctx->num_stmts; i++) {
-		if (ctx->stmt[i]->ops->type != STMT_VERDICT)
-			continue;
-
-		return i;
-	}
-
-	return -1;
+	return ctx->verdict;
 }
 
 struct merge {
@@ -513,7 +685,7 @@ struct merge {
 	uint32_t	rule_from;
 	uint32_t	num_rules;
 	/* statements to be merged (index relative to statement matrix) */
-	uint32_t	stmt[MAX_STMTS];
+	uint32_t	*stmt;
 	uint32_t	num_stmts;
 };
 
@@ -534,7 +706,7 @@ static void merge_expr_stmts(const struct optimize_ctx *ctx,
 	compound_expr_add(set, elem);
 
 	for (i = from + 1; i <= to; i++) {
-		stmt_b = ctx->stmt_matrix[i][merge->stmt[0]];
+		stmt_b = stmt_matrix_get(ctx, i, merge->stmt[0]);
 		expr_b = stmt_b->expr->right;
 		elem = set_elem_expr_alloc(&internal_location, expr_get(expr_b));
 		compound_expr_add(set, elem);
@@ -565,7 +737,7 @@ static void merge_verdict_stmts(const struct optimize_ctx *ctx,
 	uint32_t i;
 
 	for (i = from + 1; i <= to; i++) {
-		stmt_b = ctx->stmt_matrix[i][merge->stmt[0]];
+		stmt_b = stmt_matrix_get(ctx, i, merge->stmt[0]);
 		switch (stmt_b->ops->type) {
 		case STMT_VERDICT:
 			switch (stmt_b->expr->etype) {
@@ -586,7 +758,7 @@ static void merge_verdict_stmts(const struct optimize_ctx *ctx,
 static void merge_stmts(const struct optimize_ctx *ctx,
 			uint32_t from, uint32_t to, const struct merge *merge)
 {
-	struct stmt *stmt_a = ctx->stmt_matrix[from][merge->stmt[0]];
+	struct stmt *stmt_a = stmt_matrix_get(ctx, from, merge->stmt[0]);
 
 	switch (stmt_a->ops->type) {
 	case STMT_EXPRESSION:
@@ -613,7 +785,7 @@ static void __merge_concat(const struct optimize_ctx *ctx, uint32_t i,
 
 	for (k = 0; k < merge->num_stmts; k++) {
 		list_for_each_entry_safe(concat, next, concat_list, list) {
-			stmt_a = ctx->stmt_matrix[i][merge->stmt[k]];
+			stmt_a = stmt_matrix_get(ctx, i, merge->stmt[k]);
 			switch (stmt_a->expr->right->etype) {
 			case EXPR_SET:
 				list_for_each_entry(expr, &stmt_a->expr->right->expressions, list) {
@@ -664,12 +836,12 @@ static void merge_concat_stmts(const struct optimize_ctx *ctx,
 	struct expr *concat, *set;
 	uint32_t i, k;
 
-	stmt = ctx->stmt_matrix[from][merge->stmt[0]];
+	stmt = stmt_matrix_get(ctx, from, merge->stmt[0]);
 	/* build concatenation of selectors, eg. ifname . ip daddr . tcp dport */
 	concat = concat_expr_alloc(&internal_location);
 
 	for (k = 0; k < merge->num_stmts; k++) {
-		stmt_a = ctx->stmt_matrix[from][merge->stmt[k]];
+		stmt_a = stmt_matrix_get(ctx, from, merge->stmt[k]);
 		compound_expr_add(concat, expr_get(stmt_a->expr->left));
 	}
 	expr_free(stmt->expr->left);
@@ -686,7 +858,7 @@ static void merge_concat_stmts(const struct optimize_ctx *ctx,
 	stmt->expr->right = set;
 
 	for (k = 1; k < merge->num_stmts; k++) {
-		stmt_a = ctx->stmt_matrix[from][merge->stmt[k]];
+		stmt_a = stmt_matrix_get(ctx, from, merge->stmt[k]);
 		list_del(&stmt_a->list);
 		stmt_free(stmt_a);
 	}
@@ -748,15 +920,13 @@ static void build_verdict_map(struct expr *expr, struct stmt *verdict,
 
 static void remove_counter(const struct optimize_ctx *ctx, uint32_t from)
 {
+	const struct stmt_row *row = &ctx->stmt_matrix[from];
 	struct stmt *stmt;
 	uint32_t i;
 
 	/* remove counter statement */
-	for (i = 0; i < ctx->num_stmts; i++) {
-		stmt = ctx->stmt_matrix[from][i];
-		if (!stmt)
-			continue;
-
+	for (i = 0; i < row->num_cells; i++) {
+		stmt = row->cells[i].stmt;
 		if (stmt->ops->type == STMT_COUNTER) {
 			list_del(&stmt->list);
 			stmt_free(stmt);
@@ -766,15 +936,13 @@ static void remove_counter(const struct optimize_ctx *ctx, uint32_t from)
 
 static struct stmt *zap_counter(const struct optimize_ctx *ctx, uint32_t from)
 {
+	const struct stmt_row *row = &ctx->stmt_matrix[from];
 	struct stmt *stmt;
 	uint32_t i;
 
 	/* remove counter statement */
-	for (i = 0; i < ctx->num_stmts; i++) {
-		stmt = ctx->stmt_matrix[from][i];
-		if (!stmt)
-			continue;
-
+	for (i = 0; i < row->num_cells; i++) {
+		stmt = row->cells[i].stmt;
 		if (stmt->ops->type == STMT_COUNTER) {
 			list_del(&stmt->list);
 			return stmt;
@@ -788,7 +956,7 @@ static void merge_stmts_vmap(const struct optimize_ctx *ctx,
 			     uint32_t from, uint32_t to,
 			     const struct merge *merge)
 {
-	struct stmt *stmt_a = ctx->stmt_matrix[from][merge->stmt[0]];
+	struct stmt *stmt_a = stmt_matrix_get(ctx, from, merge->stmt[0]);
 	struct stmt *stmt_b, *verdict_a, *verdict_b, *stmt;
 	struct expr *expr_a, *expr_b, *expr, *left, *set;
 	struct stmt *counter;
@@ -802,14 +970,14 @@ static void merge_stmts_vmap(const struct optimize_ctx *ctx,
 	set->set_flags |= NFT_SET_ANONYMOUS;
 
 	expr_a = stmt_a->expr->right;
-	verdict_a = ctx->stmt_matrix[from][k];
+	verdict_a = stmt_matrix_get(ctx, from, k);
 	counter = zap_counter(ctx, from);
 	build_verdict_map(expr_a, verdict_a, set, counter);
 
 	for (i = from + 1; i <= to; i++) {
-		stmt_b = ctx->stmt_matrix[i][merge->stmt[0]];
+		stmt_b = stmt_matrix_get(ctx, i, merge->stmt[0]);
 		expr_b = stmt_b->expr->right;
-		verdict_b = ctx->stmt_matrix[i][k];
+		verdict_b = stmt_matrix_get(ctx, i, k);
 		counter = zap_counter(ctx, i);
 		build_verdict_map(expr_b, verdict_b, set, counter);
 	}
@@ -855,7 +1023,7 @@ static void merge_concat_stmts_vmap(const struct optimize_ctx *ctx,
 				    uint32_t from, uint32_t to,
 				    const struct merge *merge)
 {
-	struct stmt *orig_stmt = ctx->stmt_matrix[from][merge->stmt[0]];
+	struct stmt *orig_stmt = stmt_matrix_get(ctx, from, merge->stmt[0]);
 	struct stmt *stmt, *stmt_a, *verdict;
 	struct expr *concat_a, *expr, *set;
 	uint32_t i;
@@ -867,7 +1035,7 @@ static void merge_concat_stmts_vmap(const struct optimize_ctx *ctx,
 	/* build concatenation of selectors, eg. ifname . ip daddr . tcp dport */
 	concat_a = concat_expr_alloc(&internal_location);
 	for (i = 0; i < merge->num_stmts; i++) {
-		stmt_a = ctx->stmt_matrix[from][merge->stmt[i]];
+		stmt_a = stmt_matrix_get(ctx, from, merge->stmt[i]);
 		compound_expr_add(concat_a, expr_get(stmt_a->expr->left));
 	}
 
@@ -876,7 +1044,7 @@ static void merge_concat_stmts_vmap(const struct optimize_ctx *ctx,
 	set->set_flags |= NFT_SET_ANONYMOUS;
 
 	for (i = from; i <= to; i++) {
-		verdict = ctx->stmt_matrix[i][k];
+		verdict = stmt_matrix_get(ctx, i, k);
 		__merge_concat_stmts_vmap(ctx, i, merge, set, verdict);
 	}
 
@@ -888,12 +1056,12 @@ static void merge_concat_stmts_vmap(const struct optimize_ctx *ctx,
 	stmt_free(orig_stmt);
 
 	for (i = 1; i < merge->num_stmts; i++) {
-		stmt_a = ctx->stmt_matrix[from][merge->stmt[i]];
+		stmt_a = stmt_matrix_get(ctx, from, merge->stmt[i]);
 		list_del(&stmt_a->list);
 		stmt_free(stmt_a);
 	}
 
-	verdict = ctx->stmt_matrix[from][k];
+	verdict = stmt_matrix_get(ctx, from, k);
 	list_del(&verdict->list);
 	stmt_free(verdict);
 }
@@ -910,8 +1078,8 @@ static bool stmt_verdict_cmp(const struct optimize_ctx *ctx,
 		return true;
 
 	for (i = from; i + 1 <= to; i++) {
-		stmt_a = ctx->stmt_matrix[i][k];
-		stmt_b = ctx->stmt_matrix[i + 1][k];
+		stmt_a = stmt_matrix_get(ctx, i, k);
+		stmt_b = stmt_matrix_get(ctx, i + 1, k);
 		if (!stmt_a && !stmt_b)
 			continue;
 		if (!stmt_a || !stmt_b)
@@ -926,14 +1094,12 @@ static bool stmt_verdict_cmp(const struct optimize_ctx *ctx,
 static int stmt_nat_type(const struct optimize_ctx *ctx, int from,
 			 enum nft_nat_etypes *nat_type)
 {
+	const struct stmt_row *row = &ctx->stmt_matrix[from];
 	uint32_t j;
 
-	for (j = 0; j < ctx->num_stmts; j++) {
-		if (!ctx->stmt_matrix[from][j])
-			continue;
-
-		if (ctx->stmt_matrix[from][j]->ops->type == STMT_NAT) {
-			*nat_type = ctx->stmt_matrix[from][j]->nat.type;
+	for (j = 0; j < row->num_cells; j++) {
+		if (row->cells[j].stmt->ops->type == STMT_NAT) {
+			*nat_type = row->cells[j].stmt->nat.type;
 			return 0;
 		}
 	}
@@ -1001,10 +1167,10 @@ static void merge_nat(const struct optimize_ctx *ctx,
 	set->set_flags |= NFT_SET_ANONYMOUS;
 
 	for (i = from; i <= to; i++) {
-		stmt = ctx->stmt_matrix[i][merge->stmt[0]];
+		stmt = stmt_matrix_get(ctx, i, merge->stmt[0]);
 		expr = stmt->expr->right;
 
-		nat_stmt = ctx->stmt_matrix[i][k];
+		nat_stmt = stmt_matrix_get(ctx, i, k);
 		nat_expr = stmt_nat_expr(nat_stmt);
 
 		elem = set_elem_expr_alloc(&internal_location, expr_get(expr));
@@ -1012,7 +1178,7 @@ static void merge_nat(const struct optimize_ctx *ctx,
 		compound_expr_add(set, mapping);
 	}
 
-	stmt = ctx->stmt_matrix[from][merge->stmt[0]];
+	stmt = stmt_matrix_get(ctx, from, merge->stmt[0]);
 	left = expr_get(stmt->expr->left);
 	if (left->etype == EXPR_PAYLOAD) {
 		if (left->payload.desc == &proto_ip)
@@ -1022,7 +1188,7 @@ static void merge_nat(const struct optimize_ctx *ctx,
 	}
 	expr = map_expr_alloc(&internal_location, left, set);
 
-	nat_stmt = ctx->stmt_matrix[from][k];
+	nat_stmt = stmt_matrix_get(ctx, from, k);
 	if (nat_stmt->nat.family == NFPROTO_UNSPEC)
 		nat_stmt->nat.family = family;
 
@@ -1056,12 +1222,12 @@ static void merge_concat_nat(const struct optimize_ctx *ctx,
 
 		concat = concat_expr_alloc(&internal_location);
 		for (j = 0; j < merge->num_stmts; j++) {
-			stmt = ctx->stmt_matrix[i][merge->stmt[j]];
+			stmt = stmt_matrix_get(ctx, i, merge->stmt[j]);
 			expr = stmt->expr->right;
 			compound_expr_add(concat, expr_get(expr));
 		}
 
-		nat_stmt = ctx->stmt_matrix[i][k];
+		nat_stmt = stmt_matrix_get(ctx, i, k);
 		nat_expr = stmt_nat_expr(nat_stmt);
 
 		elem = set_elem_expr_alloc(&internal_location, concat);
@@ -1071,7 +1237,7 @@ static void merge_concat_nat(const struct optimize_ctx *ctx,
 
 	concat = concat_expr_alloc(&internal_location);
 	for (j = 0; j < merge->num_stmts; j++) {
-		stmt = ctx->stmt_matrix[from][merge->stmt[j]];
+		stmt = stmt_matrix_get(ctx, from, merge->stmt[j]);
 		left = stmt->expr->left;
 		if (left->etype == EXPR_PAYLOAD) {
 			if (left->payload.desc == &proto_ip)
@@ -1083,7 +1249,7 @@ static void merge_concat_nat(const struct optimize_ctx *ctx,
 	}
 	expr = map_expr_alloc(&internal_location, concat, set);
 
-	nat_stmt = ctx->stmt_matrix[from][k];
+	nat_stmt = stmt_matrix_get(ctx, from, k);
 	if (nat_stmt->nat.family == NFPROTO_UNSPEC)
 		nat_stmt->nat.family = family;
 
@@ -1092,7 +1258,7 @@ static void merge_concat_nat(const struct optimize_ctx *ctx,
 
 	remove_counter(ctx, from);
 	for (j = 0; j < merge->num_stmts; j++) {
-		stmt = ctx->stmt_matrix[from][merge->stmt[j]];
+		stmt = stmt_matrix_get(ctx, from, merge->stmt[j]);
 		list_del(&stmt->list);
 		stmt_free(stmt);
 	}
@@ -1113,6 +1279,8 @@ static void rule_optimize_print(struct output_ctx *octx,
 		*strchrnul(line, '\n') = '\0';
 		break;
 	case INDESC_STDIN:
+		if (loc->line_offset == LOCATION_OFFSET_MAX)
+			break;
 		line = indesc->data;
 		line += loc->line_offset;
 		*strchrnul(line, '\n') = '\0';
@@ -1144,10 +1312,8 @@ static uint32_t merge_stmt_type(const struct optimize_ctx *ctx,
 	uint32_t i, j;
 
 	for (i = from; i <= to; i++) {
-		for (j = 0; j < ctx->num_stmts; j++) {
-			stmt = ctx->stmt_matrix[i][j];
-			if (!stmt)
-				continue;
+		for (j = 0; j < ctx->stmt_matrix[i].num_cells; j++) {
+			stmt = ctx->stmt_matrix[i].cells[j].stmt;
 			if (stmt->ops->type == STMT_NAT) {
 				if ((stmt->nat.type == NFT_NAT_REDIR &&
 				     !stmt->nat.proto) ||
@@ -1262,13 +1428,22 @@ static bool stmt_is_mergeable(const struct stmt *stmt)
 
 static bool rules_eq(const struct optimize_ctx *ctx, int i, int j)
 {
+	const struct stmt_row *row_a = &ctx->stmt_matrix[i];
+	const struct stmt_row *row_b = &ctx->stmt_matrix[j];
 	uint32_t k, mergeable = 0;
 
-	for (k = 0; k < ctx->num_stmts; k++) {
-		if (stmt_is_mergeable(ctx->stmt_matrix[i][k]))
+	if (row_a->hash != row_b->hash ||
+	    row_a->num_cells != row_b->num_cells)
+		return false;
+
+	for (k = 0; k < row_a->num_cells; k++) {
+		if (row_a->cells[k].k != row_b->cells[k].k)
+			return false;
+
+		if (stmt_is_mergeable(row_a->cells[k].stmt))
 			mergeable++;
 
-		if (!stmt_type_eq(ctx->stmt_matrix[i][k], ctx->stmt_matrix[j][k]))
+		if (!stmt_type_eq(row_a->cells[k].stmt, row_b->cells[k].stmt))
 			return false;
 	}
 
@@ -1280,29 +1455,26 @@ static bool rules_eq(const struct optimize_ctx *ctx, int i, int j)
 
 static int chain_optimize(struct nft_ctx *nft, struct list_head *rules)
 {
+	const struct stmt_row *row;
 	struct optimize_ctx *ctx;
 	uint32_t num_merges = 0;
 	struct merge *merge;
 	uint32_t i, j, m, k;
+	struct stmt *stmt;
 	struct rule *rule;
-	int ret;
 
 	ctx = xzalloc(sizeof(*ctx));
+	ctx->unsupported = -1;
+	ctx->verdict = -1;
 
 	/* Step 1: collect statements in rules */
 	list_for_each_entry(rule, rules, list) {
-		ret = rule_collect_stmts(ctx, rule);
-		if (ret < 0)
-			goto err;
-
+		rule_collect_stmts(ctx, rule);
 		ctx->num_rules++;
 	}
 
 	ctx->rule = xzalloc(sizeof(*ctx->rule) * ctx->num_rules);
 	ctx->stmt_matrix = xzalloc(sizeof(*ctx->stmt_matrix) * ctx->num_rules);
-	for (i = 0; i < ctx->num_rules; i++)
-		ctx->stmt_matrix[i] = xzalloc_array(MAX_STMTS,
-						    sizeof(**ctx->stmt_matrix));
 
 	merge = xzalloc(sizeof(*merge) * ctx->num_rules);
 
@@ -1337,17 +1509,21 @@ static int chain_optimize(struct nft_ctx *nft, struct list_head *rules)
 	/* Step 4: Infer how to merge the candidate rules */
 	for (k = 0; k < num_merges; k++) {
 		i = merge[k].rule_from;
+		row = &ctx->stmt_matrix[i];
 
-		for (m = 0; m < ctx->num_stmts; m++) {
-			if (!ctx->stmt_matrix[i][m])
-				continue;
-			switch (ctx->stmt_matrix[i][m]->ops->type) {
+		/* rules_eq() ensures there is at least one mergeable cell. */
+		merge[k].stmt = xmalloc_array(row->num_cells,
+					      sizeof(*merge[k].stmt));
+
+		for (m = 0; m < row->num_cells; m++) {
+			stmt = row->cells[m].stmt;
+			switch (stmt->ops->type) {
 			case STMT_EXPRESSION:
-				merge[k].stmt[merge[k].num_stmts++] = m;
+				merge[k].stmt[merge[k].num_stmts++] = row->cells[m].k;
 				break;
 			case STMT_VERDICT:
-				if (ctx->stmt_matrix[i][m]->expr->etype == EXPR_MAP)
-					merge[k].stmt[merge[k].num_stmts++] = m;
+				if (stmt->expr->etype == EXPR_MAP)
+					merge[k].stmt[merge[k].num_stmts++] = row->cells[m].k;
 				break;
 			default:
 				break;
@@ -1356,21 +1532,25 @@ static int chain_optimize(struct nft_ctx *nft, struct list_head *rules)
 
 		j = merge[k].num_rules - 1;
 		merge_rules(ctx, i, i + j, &merge[k], &nft->output);
+		free(merge[k].stmt);
 	}
-	ret = 0;
+
 	for (i = 0; i < ctx->num_rules; i++)
-		free(ctx->stmt_matrix[i]);
+		free(ctx->stmt_matrix[i].cells);
 
 	free(ctx->stmt_matrix);
 	free(merge);
-err:
+
 	for (i = 0; i < ctx->num_stmts; i++)
 		stmt_free(ctx->stmt[i]);
 
+	free(ctx->stmt);
+	free(ctx->stmt_next);
+	free(ctx->stmt_hash);
 	free(ctx->rule);
 	free(ctx);
 
-	return ret;
+	return 0;
 }
 
 static int cmd_optimize(struct nft_ctx *nft, struct cmd *cmd)
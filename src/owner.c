@@ -134,6 +134,9 @@ static char *name_by_portid(uint32_t portid, unsigned long inode)
 	return prog;
 }
 
+/* Returns the name of the program that owns @portid, to be released by the
+ * caller.
+ */
 char *get_progname(uint32_t portid)
 {
 	FILE *fp = fopen("/proc/net/netlink", "r");
@@ -157,23 +160,9 @@ char *get_progname(uint32_t portid)
 			break;
 
 		if (ret == 3 && portid_check == portid && prot == NETLINK_NETFILTER) {
-			static uint32_t last_portid;
-			static uint32_t last_inode;
-			static char *last_program;
-			char *prog;
-
 			fclose(fp);
 
-			if (last_portid == portid && last_inode == inode)
-				return last_program;
-
-			prog = name_by_portid(portid, inode);
-
-			free(last_program);
-			last_program = prog;
-			last_portid = portid;
-			last_inode = inode;
-			return prog;
+			return name_by_portid(portid, inode);
 		}
 	}
 
@@ -35,6 +35,7 @@
 #include <libnftnl/udata.h>
 
 #include <rule.h>
+#include <cmd.h>
 #include <statement.h>
 #include <expression.h>
 #include <headers.h>
@@ -101,7 +102,6 @@ static void location_update(struct location *loc, struct location *rhs, int n)
 {
 	if (n) {
 		loc->indesc       = rhs[n].indesc;
-		loc->token_offset = rhs[1].token_offset;
 		loc->line_offset  = rhs[1].line_offset;
 		loc->first_line   = rhs[1].first_line;
 		loc->first_column = rhs[1].first_column;
@@ -109,7 +109,6 @@ static void location_update(struct location *loc, struct location *rhs, int n)
 		loc->last_column  = rhs[n].last_column;
 	} else {
 		loc->indesc       = rhs[0].indesc;
-		loc->token_offset = rhs[0].token_offset;
 		loc->line_offset  = rhs[0].line_offset;
 		loc->first_line   = loc->last_line   = rhs[0].last_line;
 		loc->first_column = loc->last_column = rhs[0].last_column;
@@ -1012,7 +1011,7 @@ input			:	/* empty */
 			{
 				if ($2 != NULL) {
 					$2->location = @2;
-					list_add_tail(&$2->list, state->cmds);
+					nft_cmd_append(nft, state->cmds, $2);
 				}
 			}
 			;
@@ -1147,7 +1146,7 @@ line			:	common_block			{ $$ = NULL; }
 				 */
 				if ($1 != NULL) {
 					$1->location = @1;
-					list_add_tail(&$1->list, state->cmds);
+					nft_cmd_append(nft, state->cmds, $1);
 				}
 				$$ = NULL;
 				YYACCEPT;
@@ -1217,9 +1216,14 @@ add_cmd			:	TABLE		table_spec
 				handle_merge(&$3->handle, &$2);
 				$$ = cmd_alloc(CMD_ADD, CMD_OBJ_SET, &$2, &@$, $5);
 			}
-			|	ELEMENT		set_spec	set_block_expr
+			|	ELEMENT		set_spec
+			{
+				nft_stream_elems_begin(nft, CMD_ADD, &$2, &@2);
+			}
+						set_block_expr
 			{
-				$$ = cmd_alloc(CMD_ADD, CMD_OBJ_ELEMENTS, &$2, &@$, $3);
+				nft_stream_elems_end(nft);
+				$$ = cmd_alloc(CMD_ADD, CMD_OBJ_ELEMENTS, &$2, &@$, $4);
 			}
 			|	FLOWTABLE	flowtable_spec	flowtable_block_alloc
 						'{'	flowtable_block	'}'
@@ -1334,9 +1338,14 @@ create_cmd		:	TABLE		table_spec
 				handle_merge(&$3->handle, &$2);
 				$$ = cmd_alloc(CMD_CREATE, CMD_OBJ_SET, &$2, &@$, $5);
 			}
-			|	ELEMENT		set_spec	set_block_expr
+			|	ELEMENT		set_spec
+			{
+				nft_stream_elems_begin(nft, CMD_CREATE, &$2, &@2);
+			}
+						set_block_expr
 			{
-				$$ = cmd_alloc(CMD_CREATE, CMD_OBJ_ELEMENTS, &$2, &@$, $3);
+				nft_stream_elems_end(nft);
+				$$ = cmd_alloc(CMD_CREATE, CMD_OBJ_ELEMENTS, &$2, &@$, $4);
 			}
 			|	FLOWTABLE	flowtable_spec	flowtable_block_alloc
 						'{'	flowtable_block	'}'
@@ -4479,6 +4488,7 @@ set_list_expr		:	set_list_member_expr
 			|	set_list_expr		COMMA	set_list_member_expr
 			{
 				compound_expr_add($1, $3);
+				nft_stream_elems(nft, state->cmds, $1);
 				$$ = $1;
 			}
 			|	set_list_expr		COMMA	opt_newline
@@ -18,6 +18,7 @@
 #include <netlink.h>
 #include <parser.h>
 #include <rule.h>
+#include <cmd.h>
 #include <sctp_chunk.h>
 #include <socket.h>
 
@@ -63,9 +64,8 @@ struct json_ctx {
 #define is_DTYPE(ctx)	(ctx->flags & CTX_F_DTYPE)
 #define is_SET_RHS(ctx)	(ctx->flags & CTX_F_SET_RHS)
 
-static char *ctx_flags_to_string(struct json_ctx *ctx)
+static char *ctx_flags_to_string(struct json_ctx *ctx, char *buf)
 {
-	static char buf[1024];
 	const char *sep = "";
 
 	buf[0] = '\0';
@@ -113,12 +113,38 @@ static struct stmt *json_parse_stmt(struct json_ctx *ctx, json_t *root);
 /* parsing helpers */
 
 const struct location *int_loc = &internal_location;
-static struct input_descriptor json_indesc;
+
+struct json_cmd_assoc {
+	struct json_cmd_assoc *next;
+	struct hlist_node hnode;
+	const struct cmd *cmd;
+	json_t *json;
+};
+
+#define CMD_ASSOC_HSIZE		512
+
+/* Parser state kept in the context between runs: error records refer to the
+ * input descriptor after parsing returns, echo output needs the command to
+ * JSON object mapping until the netlink replies are processed.
+ */
+struct json_parse_state {
+	struct input_descriptor	indesc;
+	struct hlist_head	cmd_assoc_hash[CMD_ASSOC_HSIZE];
+	struct json_cmd_assoc	*cmd_assoc_list;
+};
+
+static struct json_parse_state *json_parse_state_get(struct nft_ctx *nft)
+{
+	if (!nft->json_state)
+		nft->json_state = xzalloc(sizeof(struct json_parse_state));
+
+	return nft->json_state;
+}
 
 static void json_lib_error(struct json_ctx *ctx, json_error_t *err)
 {
 	struct location loc = {
-		.indesc = &json_indesc,
+		.indesc = &ctx->nft->json_state->indesc,
 		.line_offset = err->position - err->column,
 		.first_line = err->line,
 		.last_line = err->line,
@@ -1627,8 +1653,10 @@ static struct expr *json_parse_expr(struct json_ctx *ctx, json_t *root)
 			continue;
 
 		if ((cb_tbl[i].flags & ctx->flags) != ctx->flags) {
+			char flags[64];
+
 			json_error(ctx, "Expression type %s not allowed in context (%s).",
-				   type, ctx_flags_to_string(ctx));
+				   type, ctx_flags_to_string(ctx, flags));
 			return NULL;
 		}
 
@@ -4201,65 +4229,56 @@ static int json_verify_metainfo(struct json_ctx *ctx, json_t *root)
 	return 0;
 }
 
-struct json_cmd_assoc {
-	struct json_cmd_assoc *next;
-	struct hlist_node hnode;
-	const struct cmd *cmd;
-	json_t *json;
-};
-
-#define CMD_ASSOC_HSIZE		512
-static struct hlist_head json_cmd_assoc_hash[CMD_ASSOC_HSIZE];
-static struct json_cmd_assoc *json_cmd_assoc_list;
-
-static void json_cmd_assoc_free(void)
+static void json_cmd_assoc_free(struct json_parse_state *state)
 {
 	struct json_cmd_assoc *cur;
 	struct hlist_node *pos, *n;
 	int i;
 
-	while (json_cmd_assoc_list) {
-		cur = json_cmd_assoc_list->next;
-		free(json_cmd_assoc_list);
-		json_cmd_assoc_list = cur;
+	while (state->cmd_assoc_list) {
+		cur = state->cmd_assoc_list->next;
+		free(state->cmd_assoc_list);
+		state->cmd_assoc_list = cur;
 	}
 
 	for (i = 0; i < CMD_ASSOC_HSIZE; i++) {
 		hlist_for_each_entry_safe(cur, pos, n,
-					  &json_cmd_assoc_hash[i], hnode) {
+					  &state->cmd_assoc_hash[i], hnode) {
 			hlist_del(&cur->hnode);
 			free(cur);
 		}
 	}
 }
 
-static void json_cmd_assoc_add(json_t *json, const struct cmd *cmd)
+static void json_cmd_assoc_add(struct json_parse_state *state,
+			       json_t *json, const struct cmd *cmd)
 {
 	struct json_cmd_assoc *new = xzalloc(sizeof *new);
 
 	new->json	= json;
 	new->cmd	= cmd;
-	new->next	= json_cmd_assoc_list;
+	new->next	= state->cmd_assoc_list;
 
-	json_cmd_assoc_list = new;
+	state->cmd_assoc_list = new;
 }
 
-static json_t *seqnum_to_json(const uint32_t seqnum)
+static json_t *seqnum_to_json(struct json_parse_state *state,
+			      const uint32_t seqnum)
 {
 	struct json_cmd_assoc *cur;
 	struct hlist_node *n;
 	int key;
 
-	while (json_cmd_assoc_list) {
-		cur = json_cmd_assoc_list;
-		json_cmd_assoc_list = cur->next;
+	while (state->cmd_assoc_list) {
+		cur = state->cmd_assoc_list;
+		state->cmd_assoc_list = cur->next;
 
 		key = cur->cmd->seqnum % CMD_ASSOC_HSIZE;
-		hlist_add_head(&cur->hnode, &json_cmd_assoc_hash[key]);
+		hlist_add_head(&cur->hnode, &state->cmd_assoc_hash[key]);
 	}
 
 	key = seqnum % CMD_ASSOC_HSIZE;
-	hlist_for_each_entry(cur, n, &json_cmd_assoc_hash[key], hnode) {
+	hlist_for_each_entry(cur, n, &state->cmd_assoc_hash[key], hnode) {
 		if (cur->cmd->seqnum == seqnum)
 			return cur->json;
 	}
@@ -4267,6 +4286,45 @@ static json_t *seqnum_to_json(const uint32_t seqnum)
 	return NULL;
 }
 
+static int json_parse_cmd_elem(struct json_ctx *ctx, json_t *value,
+			       size_t index)
+{
+	/* this is more or less from parser_bison.y:716 */
+	LIST_HEAD(list);
+	struct cmd *cmd;
+	json_t *tmp;
+
+	if (!json_is_object(value)) {
+		json_error(ctx, "Unexpected command array element of type %s, expected object.", json_typename(value));
+		return -1;
+	}
+
+	tmp = json_object_get(value, "metainfo");
+	if (tmp) {
+		if (json_verify_metainfo(ctx, tmp)) {
+			json_error(ctx, "Metainfo verification failed.");
+			return -1;
+		}
+		return 0;
+	}
+
+	cmd = json_parse_cmd(ctx, value);
+
+	if (!cmd) {
+		json_error(ctx, "Parsing command array at index %zd failed.", index);
+		return -1;
+	}
+
+	list_add_tail(&cmd->list, &list);
+
+	list_splice_tail(&list, ctx->cmds);
+
+	if (nft_output_echo(&ctx->nft->output))
+		json_cmd_assoc_add(ctx->nft->json_state, value, cmd);
+
+	return 0;
+}
+
 static int __json_parse(struct json_ctx *ctx)
 {
 	json_t *tmp, *value;
@@ -4282,41 +4340,195 @@ static int __json_parse(struct json_ctx *ctx)
 	}
 
 	json_array_foreach(tmp, index, value) {
-		/* this is more or less from parser_bison.y:716 */
-		LIST_HEAD(list);
-		struct cmd *cmd;
-		json_t *tmp2;
-
-		if (!json_is_object(value)) {
-			json_error(ctx, "Unexpected command array element of type %s, expected object.", json_typename(value));
+		if (json_parse_cmd_elem(ctx, value, index) < 0)
 			return -1;
-		}
+	}
 
-		tmp2 = json_object_get(value, "metainfo");
-		if (tmp2) {
-			if (json_verify_metainfo(ctx, tmp2)) {
-				json_error(ctx, "Metainfo verification failed.");
-				return -1;
-			}
-			continue;
-		}
+	return 0;
+}
 
-		cmd = json_parse_cmd(ctx, value);
+/* Incremental reader for the common {"nftables": [ ... ]} layout, only one
+ * element of the command array is decoded at a time and released as soon as
+ * it has been translated. When running a file, the command is evaluated and
+ * added to the batch right away, see nft_stream_cmds(). Echo mode needs the
+ * whole tree to report handles back, it still goes through json_load*().
+ */
+struct json_stream {
+	FILE		*fp;
+	const char	*buf;
+	size_t		len;
+	size_t		pos;
+};
 
-		if (!cmd) {
-			json_error(ctx, "Parsing command array at index %zd failed.", index);
-			return -1;
-		}
+enum {
+	JSON_STREAM_OK		= 0,
+	JSON_STREAM_ERR		= -1,
+	/* not JSON, as json_load*() failing */
+	JSON_STREAM_INVAL	= -2,
+	/* perhaps valid JSON, but not the layout handled here, or an element
+	 * that can not be decoded on its own: let the whole document loader
+	 * report it.
+	 */
+	JSON_STREAM_FALLBACK	= -3,
+};
+
+static int json_stream_getc(struct json_stream *s)
+{
+	if (s->fp)
+		return fgetc(s->fp);
 
-		list_add_tail(&cmd->list, &list);
+	return s->pos < s->len ? (unsigned char)s->buf[s->pos++] : EOF;
+}
 
-		list_splice_tail(&list, ctx->cmds);
+static void json_stream_ungetc(struct json_stream *s, int c)
+{
+	if (c == EOF)
+		return;
 
-		if (nft_output_echo(&ctx->nft->output))
-			json_cmd_assoc_add(value, cmd);
+	if (s->fp)
+		ungetc(c, s->fp);
+	else
+		s->pos--;
+}
+
+static int json_stream_skip_ws(struct json_stream *s)
+{
+	int c;
+
+	do {
+		c = json_stream_getc(s);
+	} while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+
+	return c;
+}
+
+static json_t *json_stream_load(struct json_stream *s)
+{
+	json_error_t err;
+	json_t *value;
+
+	if (s->fp)
+		return json_loadf(s->fp, JSON_DISABLE_EOF_CHECK, &err);
+
+	value = json_loadb(s->buf + s->pos, s->len - s->pos,
+			   JSON_DISABLE_EOF_CHECK, &err);
+	if (value)
+		s->pos += err.position;
+
+	return value;
+}
+
+static int json_stream_header(struct json_stream *s)
+{
+	char key[sizeof("nftables")];
+	unsigned int i;
+	int c;
+
+	c = json_stream_skip_ws(s);
+	if (c != '{')
+		return c == '[' ? JSON_STREAM_FALLBACK : JSON_STREAM_INVAL;
+	if (json_stream_skip_ws(s) != '"')
+		return JSON_STREAM_FALLBACK;
+
+	for (i = 0; i < sizeof(key); i++) {
+		c = json_stream_getc(s);
+		if (c == '"')
+			break;
+		if (c == EOF || c == '\\')
+			return JSON_STREAM_FALLBACK;
+		key[i] = c;
 	}
+	if (i == sizeof(key) || i != strlen("nftables") ||
+	    strncmp(key, "nftables", i))
+		return JSON_STREAM_FALLBACK;
 
-	return 0;
+	if (json_stream_skip_ws(s) != ':' ||
+	    json_stream_skip_ws(s) != '[')
+		return JSON_STREAM_FALLBACK;
+
+	return JSON_STREAM_OK;
+}
+
+static int json_stream_parse(struct json_ctx *ctx, struct json_stream *s)
+{
+	size_t index = 0;
+	json_t *value;
+	int c, ret;
+
+	ret = json_stream_header(s);
+	if (ret < 0)
+		return ret;
+
+	c = json_stream_skip_ws(s);
+	if (c == ']')
+		goto out;
+
+	while (1) {
+		json_stream_ungetc(s, c);
+
+		value = json_stream_load(s);
+		if (!value)
+			return JSON_STREAM_FALLBACK;
+
+		ret = json_parse_cmd_elem(ctx, value, index++);
+		json_decref(value);
+		if (ret < 0)
+			return JSON_STREAM_ERR;
+
+		/* evaluate it and add it to the batch of a file right away. */
+		nft_stream_cmds(ctx->nft, ctx->cmds);
+
+		c = json_stream_skip_ws(s);
+		if (c == ']')
+			break;
+		if (c != ',')
+			return JSON_STREAM_FALLBACK;
+
+		c = json_stream_skip_ws(s);
+	}
+out:
+	if (json_stream_skip_ws(s) != '}' ||
+	    json_stream_skip_ws(s) != EOF)
+		return JSON_STREAM_FALLBACK;
+
+	return JSON_STREAM_OK;
+}
+
+static int json_parse_streamed(struct json_ctx *ctx, struct json_stream *s)
+{
+	struct list_head *cmds = ctx->cmds;
+	struct cmd *cmd, *next;
+	LIST_HEAD(list);
+	int ret;
+
+	ctx->cmds = &list;
+	ret = json_stream_parse(ctx, s);
+	ctx->cmds = cmds;
+
+	switch (ret) {
+	case JSON_STREAM_OK:
+		list_splice_tail(&list, cmds);
+		return 0;
+	case JSON_STREAM_ERR:
+		list_splice_tail(&list, cmds);
+		return -1;
+	default:
+		break;
+	}
+
+	/* Nothing has been reported yet, behave as if the whole document
+	 * had been rejected by the JSON loader. Commands might be in the
+	 * batch already, the file is run again then.
+	 */
+	if (nft_stream_started(ctx->nft))
+		nft_stream_cancel(ctx->nft);
+
+	list_for_each_entry_safe(cmd, next, &list, list) {
+		list_del(&cmd->list);
+		cmd_free(cmd);
+	}
+
+	return ret == JSON_STREAM_INVAL ? -EINVAL : 1;
 }
 
 int nft_parse_json_buffer(struct nft_ctx *nft, const char *buf,
@@ -4327,12 +4539,26 @@ int nft_parse_json_buffer(struct nft_ctx *nft, const char *buf,
 		.msgs = msgs,
 		.cmds = cmds,
 	};
+	struct json_stream s = {
+		.buf = buf,
+		.len = strlen(buf),
+	};
+	struct json_parse_state *state = json_parse_state_get(nft);
 	int ret;
 
-	json_indesc.type = INDESC_BUFFER;
-	json_indesc.data = buf;
+	/* drop leftovers from a previous run that failed before echo */
+	json_cmd_assoc_free(state);
+	state->indesc.type = INDESC_BUFFER;
+	state->indesc.data = buf;
 
 	parser_init(nft, nft->state, msgs, cmds, nft->top_scope);
+
+	if (!nft_output_echo(&nft->output)) {
+		ret = json_parse_streamed(&ctx, &s);
+		if (ret <= 0)
+			return ret;
+	}
+
 	nft->json_root = json_loads(buf, 0, NULL);
 	if (!nft->json_root)
 		return -EINVAL;
@@ -4354,20 +4580,35 @@ int nft_parse_json_filename(struct nft_ctx *nft, const char *filename,
 		.msgs = msgs,
 		.cmds = cmds,
 	};
+	struct json_parse_state *state = json_parse_state_get(nft);
+	struct json_stream s = {};
 	json_error_t err;
 	int ret;
 
 	if (nft->stdin_buf) {
-		json_indesc.type = INDESC_STDIN;
-		json_indesc.name = "/dev/stdin";
+		state->indesc.type = INDESC_STDIN;
+		state->indesc.name = "/dev/stdin";
 
 		return nft_parse_json_buffer(nft, nft->stdin_buf, msgs, cmds);
 	}
 
-	json_indesc.type = INDESC_FILE;
-	json_indesc.name = filename;
+	json_cmd_assoc_free(state);
+	state->indesc.type = INDESC_FILE;
+	state->indesc.name = filename;
 
 	parser_init(nft, nft->state, msgs, cmds, nft->top_scope);
+
+	if (!nft_output_echo(&nft->output)) {
+		s.fp = fopen(filename, "r");
+		if (!s.fp)
+			return -EINVAL;
+
+		ret = json_parse_streamed(&ctx, &s);
+		fclose(s.fp);
+		if (ret <= 0)
+			return ret;
+	}
+
 	nft->json_root = json_load_file(filename, 0, &err);
 	if (!nft->json_root)
 		return -EINVAL;
@@ -4445,7 +4686,7 @@ int json_events_cb(const struct nlmsghdr *nlh, struct netlink_mon_handler *monh)
 	if (!handle)
 		return MNL_CB_OK;
 
-	json = seqnum_to_json(nlh->nlmsg_seq);
+	json = seqnum_to_json(monh->ctx->nft->json_state, nlh->nlmsg_seq);
 	if (!json) {
 		json_echo_error(monh, "No JSON command found with seqnum %lu\n",
 				nlh->nlmsg_seq);
@@ -4488,8 +4729,17 @@ void json_print_echo(struct nft_ctx *ctx)
 		fflush(ctx->output.output_fp);
 	} else {
 		json_dumpf(ctx->json_root, ctx->output.output_fp, JSON_PRESERVE_ORDER);
-		json_cmd_assoc_free();
+		json_cmd_assoc_free(ctx->json_state);
 		json_decref(ctx->json_root);
 		ctx->json_root = NULL;
 	}
 }
+
+void json_parse_state_free(struct nft_ctx *ctx)
+{
+	if (!ctx->json_state)
+		return;
+
+	json_cmd_assoc_free(ctx->json_state);
+	free(ctx->json_state);
+}
@@ -20,7 +20,6 @@ int nft_print(struct output_ctx *octx, const char *fmt, ...)
 	va_start(arg, fmt);
 	ret = vfprintf(octx->output_fp, fmt, arg);
 	va_end(arg);
-	fflush(octx->output_fp);
 
 	return ret;
 }
@@ -33,7 +32,14 @@ int nft_gmp_print(struct output_ctx *octx, const char *fmt, ...)
 	va_start(arg, fmt);
 	ret = gmp_vfprintf(octx->output_fp, fmt, arg);
 	va_end(arg);
-	fflush(octx->output_fp);
 
 	return ret;
 }
+
+/* Output is buffered by stdio, flush it whenever the user might be waiting
+ * for it: at the end of a command and before blocking on monitor events.
+ */
+void nft_print_flush(struct output_ctx *octx)
+{
+	fflush(octx->output_fp);
+}
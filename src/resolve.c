@@ -0,0 +1,377 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <nft.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <resolve.h>
+#include <utils.h>
+
+/* Per run cache of hostname and reverse address lookups.
+ *
+ * Lookups are queued while walking a set, then resolved concurrently by
+ * a few worker threads, each of them calling the blocking getaddrinfo() or
+ * getnameinfo(). Results, including failures, stay cached until the end of
+ * the run so that every name or address is looked up only once.
+ */
+#define NFT_DNS_WORKERS		8
+#define NFT_DNS_HSIZE_MIN	256
+
+enum nft_dns_type {
+	NFT_DNS_FORWARD,
+	NFT_DNS_REVERSE,
+};
+
+union nft_dns_addr {
+	struct in_addr		in;
+	struct in6_addr		in6;
+};
+
+struct nft_dns_entry {
+	struct nft_dns_entry	*next;
+	uint32_t		hash;
+	enum nft_dns_type	type;
+	int			family;
+	bool			resolved;
+	int			err;
+	unsigned int		naddrs;
+	union nft_dns_addr	addr;
+	/* forward: the hostname to resolve, reverse: the result if any */
+	char			*name;
+};
+
+struct nft_dns_cache {
+	struct nft_dns_entry	**hash;
+	unsigned int		hsize;
+	unsigned int		nelems;
+	struct nft_dns_entry	**pending;
+	unsigned int		num_pending;
+	unsigned int		pending_size;
+};
+
+static size_t nft_dns_addr_len(int family)
+{
+	return family == AF_INET ? sizeof(struct in_addr) :
+				   sizeof(struct in6_addr);
+}
+
+static uint32_t nft_dns_hash(enum nft_dns_type type, int family,
+			     const void *key, size_t len)
+{
+	const unsigned char *p = key;
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	hash = (hash ^ type) * 16777619;
+	hash = (hash ^ family) * 16777619;
+	for (i = 0; i < len; i++)
+		hash = (hash ^ p[i]) * 16777619;
+
+	return hash;
+}
+
+static struct nft_dns_entry *nft_dns_find(const struct nft_dns_cache *dns,
+					  enum nft_dns_type type, int family,
+					  const void *key, uint32_t hash)
+{
+	struct nft_dns_entry *e;
+
+	if (!dns->hsize)
+		return NULL;
+
+	for (e = dns->hash[hash & (dns->hsize - 1)]; e; e = e->next) {
+		if (e->hash != hash || e->type != type || e->family != family)
+			continue;
+
+		if (type == NFT_DNS_FORWARD && !strcmp(e->name, key))
+			return e;
+		if (type == NFT_DNS_REVERSE &&
+		    !memcmp(&e->addr, key, nft_dns_addr_len(family)))
+			return e;
+	}
+	return NULL;
+}
+
+static void nft_dns_hash_resize(struct nft_dns_cache *dns)
+{
+	unsigned int hsize = dns->hsize ? dns->hsize * 2 : NFT_DNS_HSIZE_MIN;
+	struct nft_dns_entry **hash, *e, *next;
+	unsigned int i;
+
+	hash = xzalloc_array(hsize, sizeof(*hash));
+	for (i = 0; i < dns->hsize; i++) {
+		for (e = dns->hash[i]; e; e = next) {
+			next = e->next;
+			e->next = hash[e->hash & (hsize - 1)];
+			hash[e->hash & (hsize - 1)] = e;
+		}
+	}
+	free(dns->hash);
+	dns->hash = hash;
+	dns->hsize = hsize;
+}
+
+static struct nft_dns_entry *nft_dns_add(struct nft_dns_cache *dns,
+					 enum nft_dns_type type, int family,
+					 const void *key, uint32_t hash)
+{
+	struct nft_dns_entry *e;
+
+	if (dns->nelems >= dns->hsize)
+		nft_dns_hash_resize(dns);
+
+	e = xzalloc(sizeof(*e));
+	e->hash = hash;
+	e->type = type;
+	e->family = family;
+	if (type == NFT_DNS_FORWARD)
+		e->name = xstrdup(key);
+	else
+		memcpy(&e->addr, key, nft_dns_addr_len(family));
+
+	e->next = dns->hash[hash & (dns->hsize - 1)];
+	dns->hash[hash & (dns->hsize - 1)] = e;
+	dns->nelems++;
+
+	return e;
+}
+
+static void nft_dns_resolve_name(struct nft_dns_entry *e)
+{
+	struct addrinfo *ai, *i, hints = { .ai_family = e->family,
+					   .ai_socktype = SOCK_DGRAM };
+
+	e->err = getaddrinfo(e->name, NULL, &hints, &ai);
+	if (e->err != 0)
+		return;
+
+	for (i = ai; i; i = i->ai_next)
+		e->naddrs++;
+
+	if (e->family == AF_INET)
+		e->addr.in = ((struct sockaddr_in *)(void *)ai->ai_addr)->sin_addr;
+	else
+		e->addr.in6 = ((struct sockaddr_in6 *)(void *)ai->ai_addr)->sin6_addr;
+
+	freeaddrinfo(ai);
+}
+
+static void nft_dns_resolve_addr(struct nft_dns_entry *e)
+{
+	struct sockaddr_in6 sin6 = { .sin6_family = AF_INET6 };
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	char buf[NI_MAXHOST];
+
+	if (e->family == AF_INET) {
+		sin.sin_addr = e->addr.in;
+		e->err = getnameinfo((struct sockaddr *)&sin, sizeof(sin),
+				     buf, sizeof(buf), NULL, 0, 0);
+	} else {
+		sin6.sin6_addr = e->addr.in6;
+		e->err = getnameinfo((struct sockaddr *)&sin6, sizeof(sin6),
+				     buf, sizeof(buf), NULL, 0, 0);
+	}
+	if (e->err != 0)
+		return;
+
+	/* This may run in a worker thread, don't bail out via xstrdup(). */
+	e->name = strdup(buf);
+	if (!e->name)
+		e->err = EAI_MEMORY;
+}
+
+static void nft_dns_resolve(struct nft_dns_entry *e)
+{
+	if (e->type == NFT_DNS_FORWARD)
+		nft_dns_resolve_name(e);
+	else
+		nft_dns_resolve_addr(e);
+}
+
+static void nft_dns_queue(struct nft_dns_cache *dns, enum nft_dns_type type,
+			  int family, const void *key, size_t len)
+{
+	uint32_t hash = nft_dns_hash(type, family, key, len);
+	struct nft_dns_entry *e;
+
+	if (nft_dns_find(dns, type, family, key, hash))
+		return;
+
+	e = nft_dns_add(dns, type, family, key, hash);
+
+	if (dns->num_pending == dns->pending_size) {
+		dns->pending_size = dns->pending_size ? dns->pending_size * 2 : 64;
+		dns->pending = xrealloc(dns->pending, dns->pending_size *
+						      sizeof(*dns->pending));
+	}
+	dns->pending[dns->num_pending++] = e;
+}
+
+void nft_dns_queue_name(struct nft_dns_cache *dns, int family,
+			const char *name)
+{
+	union nft_dns_addr addr;
+
+	/* Literal addresses are not worth a thread. */
+	if (inet_pton(family, name, &addr) == 1)
+		return;
+
+	nft_dns_queue(dns, NFT_DNS_FORWARD, family, name, strlen(name));
+}
+
+void nft_dns_queue_addr(struct nft_dns_cache *dns, int family,
+			const void *addr)
+{
+	nft_dns_queue(dns, NFT_DNS_REVERSE, family, addr,
+		      nft_dns_addr_len(family));
+}
+
+struct nft_dns_pool {
+	pthread_mutex_t		lock;
+	struct nft_dns_entry	**jobs;
+	unsigned int		num_jobs;
+	unsigned int		next;
+};
+
+static void *nft_dns_worker(void *arg)
+{
+	struct nft_dns_pool *pool = arg;
+	struct nft_dns_entry *e;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		e = pool->next < pool->num_jobs ? pool->jobs[pool->next++] : NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (!e)
+			break;
+
+		nft_dns_resolve(e);
+	}
+
+	return NULL;
+}
+
+void nft_dns_run(struct nft_dns_cache *dns)
+{
+	struct nft_dns_pool pool = {
+		.lock		= PTHREAD_MUTEX_INITIALIZER,
+		.jobs		= dns->pending,
+		.num_jobs	= dns->num_pending,
+	};
+	pthread_t workers[NFT_DNS_WORKERS];
+	unsigned int i, num_workers = 0;
+
+	if (!dns->num_pending)
+		return;
+
+	/* Workers only write to the entry they picked from the pool, the
+	 * cache itself is not touched until all of them are joined.
+	 */
+	for (i = 1; i < NFT_DNS_WORKERS && i < pool.num_jobs; i++) {
+		if (pthread_create(&workers[num_workers], NULL,
+				   nft_dns_worker, &pool))
+			break;
+		num_workers++;
+	}
+	nft_dns_worker(&pool);
+
+	for (i = 0; i < num_workers; i++)
+		pthread_join(workers[i], NULL);
+
+	for (i = 0; i < dns->num_pending; i++)
+		dns->pending[i]->resolved = true;
+
+	dns->num_pending = 0;
+}
+
+static struct nft_dns_entry *nft_dns_lookup(struct nft_dns_cache *dns,
+					    enum nft_dns_type type, int family,
+					    const void *key, size_t len)
+{
+	uint32_t hash = nft_dns_hash(type, family, key, len);
+	struct nft_dns_entry *e;
+
+	e = nft_dns_find(dns, type, family, key, hash);
+	if (!e)
+		e = nft_dns_add(dns, type, family, key, hash);
+
+	/* Still queued, resolve the whole batch rather than just this one. */
+	if (!e->resolved && dns->num_pending)
+		nft_dns_run(dns);
+
+	if (!e->resolved) {
+		nft_dns_resolve(e);
+		e->resolved = true;
+	}
+
+	return e;
+}
+
+int nft_dns_getaddr(struct nft_dns_cache *dns, int family, const char *name,
+		    void *addr, unsigned int *naddrs)
+{
+	const struct nft_dns_entry *e;
+
+	/* Literal addresses are not cached, there might be millions of them. */
+	if (inet_pton(family, name, addr) == 1) {
+		*naddrs = 1;
+		return 0;
+	}
+
+	e = nft_dns_lookup(dns, NFT_DNS_FORWARD, family, name, strlen(name));
+	if (e->err != 0)
+		return e->err;
+
+	memcpy(addr, &e->addr, nft_dns_addr_len(family));
+	*naddrs = e->naddrs;
+
+	return 0;
+}
+
+const char *nft_dns_getname(struct nft_dns_cache *dns, int family,
+			    const void *addr)
+{
+	const struct nft_dns_entry *e;
+
+	e = nft_dns_lookup(dns, NFT_DNS_REVERSE, family, addr,
+			   nft_dns_addr_len(family));
+
+	return e->err == 0 ? e->name : NULL;
+}
+
+struct nft_dns_cache *nft_dns_cache_alloc(void)
+{
+	return xzalloc(sizeof(struct nft_dns_cache));
+}
+
+void nft_dns_cache_flush(struct nft_dns_cache *dns)
+{
+	struct nft_dns_entry *e, *next;
+	unsigned int i;
+
+	for (i = 0; i < dns->hsize; i++) {
+		for (e = dns->hash[i]; e; e = next) {
+			next = e->next;
+			free(e->name);
+			free(e);
+		}
+	}
+	free(dns->hash);
+	free(dns->pending);
+	memset(dns, 0, sizeof(*dns));
+}
+
+void nft_dns_cache_free(struct nft_dns_cache *dns)
+{
+	if (!dns)
+		return;
+
+	nft_dns_cache_flush(dns);
+	free(dns);
+}
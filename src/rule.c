@@ -139,7 +139,7 @@ void handle_merge(struct handle *dst, const struct handle *src)
 		dst->index = src->index;
 }
 
-/* internal ID to uniquely identify a set in the batch */
+/* internal ID to uniquely identify a set in the batch, shared by all contexts */
 static uint32_t set_id;
 
 struct set *set_alloc(const struct location *loc)
@@ -150,7 +150,7 @@ struct set *set_alloc(const struct location *loc)
 
 	set = xzalloc(sizeof(*set));
 	set->refcnt = 1;
-	set->handle.set_id = ++set_id;
+	set->handle.set_id = __atomic_add_fetch(&set_id, 1, __ATOMIC_RELAXED);
 	set->location = *loc;
 
 	init_list_head(&set->stmt_list);
@@ -179,9 +179,12 @@ struct set *set_clone(const struct set *set)
 	return new_set;
 }
 
+/* Rules referring to the same set may be delinearized concurrently, see
+ * rule_cache_delinearize().
+ */
 struct set *set_get(struct set *set)
 {
-	set->refcnt++;
+	__atomic_add_fetch(&set->refcnt, 1, __ATOMIC_RELAXED);
 	return set;
 }
 
@@ -189,10 +192,11 @@ void set_free(struct set *set)
 {
 	struct stmt *stmt, *next;
 
-	if (--set->refcnt > 0)
+	if (__atomic_sub_fetch(&set->refcnt, 1, __ATOMIC_ACQ_REL) > 0)
 		return;
 
 	expr_free(set->init);
+	interval_runs_free(set->runs);
 	if (set->comment)
 		free_const(set->comment);
 	handle_free(&set->handle);
@@ -500,25 +504,308 @@ void rule_print(const struct rule *rule, struct output_ctx *octx)
 		nft_print(octx, " # handle %" PRIu64, rule->handle.handle.id);
 }
 
-struct rule *rule_lookup(const struct chain *chain, uint64_t handle)
+/*
+ * Rule index: rules are hashed by handle and kept in a treap ordered by
+ * their position in the chain, each node stores the size of its subtree so
+ * that positions are found in logarithmic time. The index is built on the
+ * first lookup, chain_rule_add() and chain_rule_del() keep it up to date.
+ */
+struct rule_index {
+	struct rule_node	*root;
+	struct hlist_head	*hash;
+	uint32_t		hsize;
+	uint32_t		hcount;
+	uint32_t		seed;
+};
+
+#define RULE_INDEX_HSIZE_MIN	64
+
+static uint32_t rule_node_size(const struct rule_node *node)
+{
+	return node ? node->size : 0;
+}
+
+static void rule_node_update(struct rule_node *node)
+{
+	node->size = rule_node_size(node->child[0]) +
+		     rule_node_size(node->child[1]) + 1;
+}
+
+/* Rotate @node above its parent. */
+static void rule_node_rotate(struct rule_index *index, struct rule_node *node)
+{
+	struct rule_node *parent = node->parent;
+	int dir = parent->child[1] == node;
+	struct rule_node *inner = node->child[!dir];
+
+	node->parent = parent->parent;
+	if (!node->parent)
+		index->root = node;
+	else
+		node->parent->child[node->parent->child[1] == parent] = node;
+
+	parent->child[dir] = inner;
+	if (inner)
+		inner->parent = parent;
+
+	node->child[!dir] = parent;
+	parent->parent = node;
+
+	rule_node_update(parent);
+	rule_node_update(node);
+}
+
+static uint32_t rule_index_prio(struct rule_index *index)
+{
+	/* xorshift32, priorities only need to look random. */
+	index->seed ^= index->seed << 13;
+	index->seed ^= index->seed >> 17;
+	index->seed ^= index->seed << 5;
+
+	return index->seed;
+}
+
+/* Link @node so that it becomes the @pos-th node, starting from 1. */
+static void rule_node_insert(struct rule_index *index, struct rule_node *node,
+			     uint32_t pos)
+{
+	struct rule_node **link = &index->root, *parent = NULL;
+	uint32_t left;
+
+	while (*link) {
+		parent = *link;
+		parent->size++;
+		left = rule_node_size(parent->child[0]);
+		if (pos <= left + 1) {
+			link = &parent->child[0];
+		} else {
+			pos -= left + 1;
+			link = &parent->child[1];
+		}
+	}
+
+	node->child[0] = node->child[1] = NULL;
+	node->parent = parent;
+	node->size = 1;
+	node->prio = rule_index_prio(index);
+	*link = node;
+
+	while (node->parent && node->parent->prio < node->prio)
+		rule_node_rotate(index, node);
+}
+
+static void rule_node_remove(struct rule_index *index, struct rule_node *node)
+{
+	struct rule_node *child, *parent;
+
+	/* rotate @node down until it is a leaf. */
+	while (node->child[0] || node->child[1]) {
+		if (!node->child[0])
+			child = node->child[1];
+		else if (!node->child[1])
+			child = node->child[0];
+		else if (node->child[0]->prio > node->child[1]->prio)
+			child = node->child[0];
+		else
+			child = node->child[1];
+
+		rule_node_rotate(index, child);
+	}
+
+	parent = node->parent;
+	if (!parent)
+		index->root = NULL;
+	else
+		parent->child[parent->child[1] == node] = NULL;
+
+	for (; parent; parent = parent->parent)
+		parent->size--;
+}
+
+static uint32_t rule_node_pos(const struct rule_node *node)
+{
+	uint32_t pos = rule_node_size(node->child[0]) + 1;
+
+	for (; node->parent; node = node->parent) {
+		if (node->parent->child[1] == node)
+			pos += rule_node_size(node->parent->child[0]) + 1;
+	}
+
+	return pos;
+}
+
+static struct hlist_head *rule_index_bucket(const struct rule_index *index,
+					    uint64_t handle)
 {
+	return &index->hash[handle & (index->hsize - 1)];
+}
+
+static void rule_index_hash_resize(struct rule_index *index, uint32_t hsize)
+{
+	struct hlist_head *hash = index->hash;
+	uint32_t i, old_hsize = index->hsize;
+	struct hlist_node *pos, *next;
 	struct rule *rule;
 
-	list_for_each_entry(rule, &chain->rules, list) {
-		if (rule->handle.handle.id == handle)
-			return rule;
+	index->hash = xzalloc_array(hsize, sizeof(struct hlist_head));
+	index->hsize = hsize;
+
+	for (i = 0; i < old_hsize; i++) {
+		hlist_for_each_safe(pos, next, &hash[i]) {
+			rule = hlist_entry(pos, struct rule, hnode);
+			hlist_add_head(&rule->hnode,
+				       rule_index_bucket(index,
+							 rule->handle.handle.id));
+		}
 	}
-	return NULL;
+	free(hash);
+}
+
+static void rule_index_add(struct rule_index *index, struct rule *rule,
+			   uint32_t pos)
+{
+	rule_node_insert(index, &rule->node, pos);
+
+	/* rules that are not in the kernel yet have no handle. */
+	if (!rule->handle.handle.id)
+		return;
+
+	if (++index->hcount > index->hsize)
+		rule_index_hash_resize(index, index->hsize * 2);
+
+	hlist_add_head(&rule->hnode,
+		       rule_index_bucket(index, rule->handle.handle.id));
+}
+
+static void rule_index_del(struct rule_index *index, struct rule *rule)
+{
+	rule_node_remove(index, &rule->node);
+
+	if (hlist_unhashed(&rule->hnode))
+		return;
+
+	hlist_del_init(&rule->hnode);
+	index->hcount--;
 }
 
-struct rule *rule_lookup_by_index(const struct chain *chain, uint64_t index)
+static struct rule_index *chain_rule_index(struct chain *chain)
 {
+	struct rule_index *index;
 	struct rule *rule;
+	uint32_t pos = 0;
 
-	list_for_each_entry(rule, &chain->rules, list) {
-		if (!--index)
-			return rule;
+	if (chain->rule_index)
+		return chain->rule_index;
+
+	index = xzalloc(sizeof(*index));
+	index->seed = 2463534242;
+	rule_index_hash_resize(index, RULE_INDEX_HSIZE_MIN);
+
+	list_for_each_entry(rule, &chain->rules, list)
+		rule_index_add(index, rule, ++pos);
+
+	chain->rule_index = index;
+
+	return index;
+}
+
+static void chain_rule_index_free(struct chain *chain)
+{
+	struct rule_index *index = chain->rule_index;
+	struct rule *rule;
+
+	if (!index)
+		return;
+
+	list_for_each_entry(rule, &chain->rules, list)
+		init_hlist_node(&rule->hnode);
+
+	free(index->hash);
+	free(index);
+	chain->rule_index = NULL;
+}
+
+/* Position of a rule that is linked to @chain->rules already. */
+static uint32_t chain_rule_pos(const struct chain *chain,
+			       const struct rule *rule)
+{
+	const struct rule *prev;
+
+	if (rule->list.prev == &chain->rules)
+		return 1;
+
+	prev = list_entry(rule->list.prev, struct rule, list);
+
+	return rule_node_pos(&prev->node) + 1;
+}
+
+/* Same as list_add(&rule->list, head), @head is either @chain->rules or the
+ * list node of one of its rules.
+ */
+void chain_rule_add(struct chain *chain, struct rule *rule,
+		    struct list_head *head)
+{
+	list_add(&rule->list, head);
+	if (chain->rule_index)
+		rule_index_add(chain->rule_index, rule,
+			       chain_rule_pos(chain, rule));
+}
+
+/* Same as list_add_tail(&rule->list, head), see chain_rule_add(). */
+void chain_rule_add_tail(struct chain *chain, struct rule *rule,
+			 struct list_head *head)
+{
+	list_add_tail(&rule->list, head);
+	if (chain->rule_index)
+		rule_index_add(chain->rule_index, rule,
+			       chain_rule_pos(chain, rule));
+}
+
+void chain_rule_del(struct chain *chain, struct rule *rule)
+{
+	if (chain->rule_index)
+		rule_index_del(chain->rule_index, rule);
+	list_del(&rule->list);
+}
+
+struct rule *rule_lookup(struct chain *chain, uint64_t handle)
+{
+	struct rule_index *index = chain_rule_index(chain);
+	struct rule *rule, *found = NULL;
+	struct hlist_node *pos;
+
+	/* a new rule that refers to an existing one by handle carries that
+	 * handle too, return the first one in the chain.
+	 */
+	hlist_for_each(pos, rule_index_bucket(index, handle)) {
+		rule = hlist_entry(pos, struct rule, hnode);
+		if (rule->handle.handle.id != handle)
+			continue;
+		if (!found ||
+		    rule_node_pos(&rule->node) < rule_node_pos(&found->node))
+			found = rule;
+	}
+
+	return found;
+}
+
+struct rule *rule_lookup_by_index(struct chain *chain, uint64_t index)
+{
+	struct rule_node *node = chain_rule_index(chain)->root;
+	uint32_t left;
+
+	while (node) {
+		left = rule_node_size(node->child[0]);
+		if (index <= left) {
+			node = node->child[0];
+		} else if (index == left + 1) {
+			return container_of(node, struct rule, node);
+		} else {
+			index -= left + 1;
+			node = node->child[1];
+		}
 	}
+
 	return NULL;
 }
 
@@ -550,7 +837,7 @@ struct scope *scope_init(struct scope *scope, const struct scope *parent)
 	return scope;
 }
 
-void scope_release(const struct scope *scope)
+void scope_release(struct scope *scope)
 {
 	struct symbol *sym, *next;
 
@@ -561,6 +848,10 @@ void scope_release(const struct scope *scope)
 		expr_free(sym->expr);
 		free(sym);
 	}
+	free(scope->hash);
+	scope->hash = NULL;
+	scope->hsize = 0;
+	scope->nsymbols = 0;
 }
 
 void scope_free(struct scope *scope)
@@ -569,16 +860,50 @@ void scope_free(struct scope *scope)
 	free(scope);
 }
 
+#define SCOPE_HSIZE_MIN		64
+
+static struct hlist_head *scope_bucket(const struct scope *scope,
+				       uint32_t hash)
+{
+	return &scope->hash[hash & (scope->hsize - 1)];
+}
+
+static void scope_hash_resize(struct scope *scope, uint32_t hsize)
+{
+	struct symbol *sym;
+
+	free(scope->hash);
+	scope->hash = xzalloc_array(hsize, sizeof(struct hlist_head));
+	scope->hsize = hsize;
+
+	/* rehash in reverse list order, newer symbols must come first. */
+	list_for_each_entry_reverse(sym, &scope->symbols, list) {
+		if (hlist_unhashed(&sym->hnode))
+			continue;
+
+		hlist_add_head(&sym->hnode, scope_bucket(scope, sym->hash));
+	}
+}
+
 void symbol_bind(struct scope *scope, const char *identifier, struct expr *expr)
 {
 	struct symbol *sym;
 
 	sym = xzalloc(sizeof(*sym));
 	sym->identifier = xstrdup(identifier);
+	sym->hash = djb_hash(identifier);
 	sym->expr = expr;
 	sym->refcnt = 1;
 
 	list_add(&sym->list, &scope->symbols);
+
+	if (!scope->hash)
+		scope_hash_resize(scope, SCOPE_HSIZE_MIN);
+	else if (scope->nsymbols >= scope->hsize)
+		scope_hash_resize(scope, scope->hsize * 2);
+
+	hlist_add_head(&sym->hnode, scope_bucket(scope, sym->hash));
+	scope->nsymbols++;
 }
 
 struct symbol *symbol_get(const struct scope *scope, const char *identifier)
@@ -603,33 +928,53 @@ static void symbol_put(struct symbol *sym)
 	}
 }
 
-static void symbol_remove(struct symbol *sym)
+static void symbol_remove(struct scope *scope, struct symbol *sym)
 {
 	list_del(&sym->list);
+	hlist_del_init(&sym->hnode);
+	scope->nsymbols--;
 	symbol_put(sym);
 }
 
-int symbol_unbind(const struct scope *scope, const char *identifier)
+static struct symbol *scope_symbol_lookup(const struct scope *scope,
+					  const char *identifier,
+					  uint32_t hash)
 {
-	struct symbol *sym, *next;
+	struct hlist_node *pos;
+	struct symbol *sym;
 
-	list_for_each_entry_safe(sym, next, &scope->symbols, list) {
-		if (!strcmp(sym->identifier, identifier))
-			symbol_remove(sym);
+	if (!scope->hash)
+		return NULL;
+
+	hlist_for_each(pos, scope_bucket(scope, hash)) {
+		sym = hlist_entry(pos, struct symbol, hnode);
+		if (sym->hash == hash && !strcmp(sym->identifier, identifier))
+			return sym;
 	}
+	return NULL;
+}
+
+int symbol_unbind(struct scope *scope, const char *identifier)
+{
+	uint32_t hash = djb_hash(identifier);
+	struct symbol *sym;
+
+	while ((sym = scope_symbol_lookup(scope, identifier, hash)))
+		symbol_remove(scope, sym);
 
 	return 0;
 }
 
 struct symbol *symbol_lookup(const struct scope *scope, const char *identifier)
 {
+	uint32_t hash = djb_hash(identifier);
 	struct symbol *sym;
 
 	while (scope != NULL) {
-		list_for_each_entry(sym, &scope->symbols, list) {
-			if (!strcmp(sym->identifier, identifier))
-				return sym;
-		}
+		sym = scope_symbol_lookup(scope, identifier, hash);
+		if (sym)
+			return sym;
+
 		scope = scope->parent;
 	}
 	return NULL;
@@ -695,7 +1040,9 @@ const char *chain_hookname_lookup(const char *name)
 	return NULL;
 }
 
-/* internal ID to uniquely identify a set in the batch */
+/* internal ID to uniquely identify a chain in the batch, shared by all
+ * contexts
+ */
 static uint32_t chain_id;
 
 struct chain *chain_alloc(void)
@@ -705,7 +1052,8 @@ struct chain *chain_alloc(void)
 	chain = xzalloc(sizeof(*chain));
 	chain->location = internal_location;
 	chain->refcnt = 1;
-	chain->handle.chain_id = ++chain_id;
+	chain->handle.chain_id = __atomic_add_fetch(&chain_id, 1,
+						    __ATOMIC_RELAXED);
 	init_list_head(&chain->rules);
 	init_list_head(&chain->scope.symbols);
 
@@ -726,6 +1074,7 @@ void chain_free(struct chain *chain)
 
 	if (--chain->refcnt > 0)
 		return;
+	chain_rule_index_free(chain);
 	list_for_each_entry_safe(rule, next, &chain->rules, list)
 		rule_free(rule);
 	handle_free(&chain->handle);
@@ -1280,8 +1629,12 @@ static void table_print(const struct table *table, struct output_ctx *octx)
 		nft_print(octx, " #");
 	if (nft_output_handle(octx))
 		nft_print(octx, " handle %" PRIu64, table->handle.handle.id);
-	if (table->flags & TABLE_F_OWNER)
-		nft_print(octx, " progname %s", get_progname(table->owner));
+	if (table->flags & TABLE_F_OWNER) {
+		char *progname = get_progname(table->owner);
+
+		nft_print(octx, " progname %s", progname);
+		free(progname);
+	}
 
 	nft_print(octx, "\n");
 	table_print_flags(table, &delim, octx);
@@ -1329,9 +1682,6 @@ struct cmd *cmd_alloc(enum cmd_ops op, enum cmd_obj obj,
 	cmd->handle   = *h;
 	cmd->location = *loc;
 	cmd->data     = data;
-	cmd->attr     = xzalloc_array(NFT_NLATTR_LOC_MAX,
-				      sizeof(struct nlerr_loc));
-	cmd->attr_array_len = NFT_NLATTR_LOC_MAX;
 	init_list_head(&cmd->collapse_list);
 
 	return cmd;
@@ -1423,6 +1773,7 @@ void cmd_free(struct cmd *cmd)
 		}
 	}
 	free(cmd->attr);
+	free(cmd->elem_loc);
 	free_const(cmd->arg);
 	free(cmd);
 }
@@ -1699,7 +2050,7 @@ static void print_proto_name_proto(uint8_t l4, struct output_ctx *octx)
 {
 	char name[NFT_PROTONAME_MAXSIZE];
 
-	if (nft_getprotobynumber(l4, name, sizeof(name)))
+	if (nft_getprotobynumber(octx->tbl.netdb, l4, name, sizeof(name)))
 		nft_print(octx, "%s", name);
 	else
 		nft_print(octx, "%d", l4);
@@ -2568,11 +2919,17 @@ static int do_command_monitor(struct netlink_ctx *ctx, struct cmd *cmd)
 		.cache		= &ctx->nft->cache,
 		.debug_mask	= ctx->nft->debug_mask,
 	};
+	int ret;
 
 	if (nft_output_json(&ctx->nft->output))
 		monhandler.format = NFTNL_OUTPUT_JSON;
+	if (monhandler.monitor_flags & (1 << NFT_MSG_TRACE))
+		monhandler.trace = netlink_trace_cache_alloc();
+
+	ret = netlink_monitor(&monhandler);
+	netlink_trace_cache_free(monhandler.trace);
 
-	return netlink_monitor(&monhandler, ctx->nft->nf_sock);
+	return ret;
 }
 
 static int do_command_describe(struct netlink_ctx *ctx, struct cmd *cmd,
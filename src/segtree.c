@@ -297,23 +297,26 @@ static int expr_value_cmp(const void *p1, const void *p2)
  */
 static int range_mask_len(const mpz_t start, const mpz_t end, unsigned int len)
 {
-	mpz_t tmp_start, tmp_end;
+	unsigned long host_bits;
+	mpz_t tmp;
 	int ret;
 
-	mpz_init_set(tmp_start, start);
-	mpz_init_set(tmp_end, end);
-
-	while (mpz_cmp(tmp_start, tmp_end) <= 0 &&
-		!mpz_tstbit(tmp_start, 0) && mpz_tstbit(tmp_end, 0) &&
-		len--) {
-		mpz_fdiv_q_2exp(tmp_start, tmp_start, 1);
-		mpz_fdiv_q_2exp(tmp_end, tmp_end, 1);
-	}
+	if (mpz_cmp(start, end) > 0)
+		return -1;
 
-	ret = !mpz_cmp(tmp_start, tmp_end) ? (int)len : -1;
+	/* number of trailing zero bits in start that are ones in end. */
+	host_bits = min(mpz_scan1(start, 0), mpz_scan0(end, 0));
+	if (host_bits > len)
+		return -1;
 
-	mpz_clear(tmp_start);
-	mpz_clear(tmp_end);
+	/* remaining bits must be the same in start and end. */
+	mpz_init(tmp);
+	mpz_xor(tmp, start, end);
+	if (!mpz_sgn(tmp) || mpz_sizeinbase(tmp, 2) <= host_bits)
+		ret = len - host_bits;
+	else
+		ret = -1;
+	mpz_clear(tmp);
 
 	return ret;
 }
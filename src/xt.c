@@ -10,6 +10,7 @@
 #include <nft.h>
 
 #include <time.h>
+#include <pthread.h>
 #include <net/if.h>
 #include <getopt.h>
 #include <ctype.h>	/* for isspace */
@@ -222,7 +223,8 @@ void netlink_parse_match(struct netlink_parse_ctx *ctx,
 	stmt->xt.info = xmalloc(mt_len);
 	memcpy(stmt->xt.info, mtinfo, mt_len);
 
-	ctx->table->has_xt_stmts = true;
+	/* rules of the same table may be parsed by several threads. */
+	__atomic_store_n(&ctx->table->has_xt_stmts, true, __ATOMIC_RELAXED);
 	rule_stmt_append(ctx->rule, stmt);
 }
 
@@ -246,7 +248,7 @@ void netlink_parse_target(struct netlink_parse_ctx *ctx,
 	stmt->xt.info = xmalloc(tg_len);
 	memcpy(stmt->xt.info, tginfo, tg_len);
 
-	ctx->table->has_xt_stmts = true;
+	__atomic_store_n(&ctx->table->has_xt_stmts, true, __ATOMIC_RELAXED);
 	rule_stmt_append(ctx->rule, stmt);
 }
 
@@ -358,20 +360,21 @@ static struct xtables_globals xt_nft_globals = {
 	.compat_rev		= nft_xt_compatible_revision,
 };
 
+static void __xt_init(void)
+{
+	/* Default to IPv4, but this changes in runtime */
+	xtables_init_all(&xt_nft_globals, NFPROTO_IPV4);
+}
+
 void xt_init(void)
 {
-	static bool init_once;
-
-	if (!init_once) {
-		/* libxtables is full of global variables and cannot be used
-		 * concurrently by multiple threads. Hence, it's fine that the
-		 * "init_once" guard is not thread-safe either.
-		 * Don't link against xtables if you want thread safety.
-		 */
-		init_once = true;
-
-		/* Default to IPv4, but this changes in runtime */
-		xtables_init_all(&xt_nft_globals, NFPROTO_IPV4);
-	}
+	static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+	/* libxtables is full of global variables and cannot be used
+	 * concurrently by multiple threads, but contexts may still be
+	 * created from several threads. Translation of xt statements is not
+	 * thread-safe, don't link against xtables if you need that.
+	 */
+	pthread_once(&init_once, __xt_init);
 }
 #endif
@@ -0,0 +1,61 @@
+/*
+ * Run the commands read from the standard input, one per line, through one
+ * libnftables context within a session, so the cache is kept across them.
+ * Lines starting with '!' are run by the shell instead, e.g. to modify the
+ * ruleset from another process between two commands.
+ *
+ * Usage: nft-session < commands
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <nftables/libnftables.h>
+
+int main(int argc, char *argv[])
+{
+	struct nft_ctx *nft;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int ret = EXIT_SUCCESS;
+
+	nft = nft_ctx_new(NFT_CTX_DEFAULT);
+	if (!nft) {
+		perror("cannot allocate nft context");
+		return EXIT_FAILURE;
+	}
+
+	if (nft_ctx_session_begin(nft) < 0) {
+		fprintf(stderr, "cannot begin session\n");
+		nft_ctx_free(nft);
+		return EXIT_FAILURE;
+	}
+
+	while ((len = getline(&line, &size, stdin)) > 0) {
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+
+		if (line[0] == '\0')
+			continue;
+
+		fflush(stdout);
+		if (line[0] == '!') {
+			if (system(line + 1) != 0) {
+				fprintf(stderr, "'%s' failed\n", line + 1);
+				ret = EXIT_FAILURE;
+				break;
+			}
+			continue;
+		}
+
+		/* failing commands are part of the test, see their output. */
+		nft_run_cmd_from_buffer(nft, line);
+	}
+	fflush(stdout);
+
+	free(line);
+	nft_ctx_session_end(nft);
+	nft_ctx_free(nft);
+
+	return ret;
+}
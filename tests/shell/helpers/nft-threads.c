@@ -0,0 +1,201 @@
+/*
+ * Run several libnftables contexts concurrently, one per thread, each of them
+ * managing its own table. Every loop also lists the table through a fresh
+ * context, so that the services and protocols databases are loaded
+ * concurrently.
+ *
+ * Usage: nft-threads [-j]
+ *
+ *   -j	also add a rule through JSON input with echo output
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <nftables/libnftables.h>
+
+#define THREADS	16
+#define LOOPS	50
+
+static bool have_json;
+
+struct thread {
+	pthread_t	id;
+	unsigned int	num;
+	bool		failed;
+};
+
+static int run(struct nft_ctx *nft, unsigned int num, const char *what,
+	       const char *buf)
+{
+	if (nft_run_cmd_from_buffer(nft, buf) == 0)
+		return 0;
+
+	fprintf(stderr, "thread %u: %s failed\n%s%s", num, what,
+		nft_ctx_get_output_buffer(nft), nft_ctx_get_error_buffer(nft));
+	return -1;
+}
+
+static int check(struct nft_ctx *nft, unsigned int num, const char *what,
+		 const char *needle)
+{
+	const char *output = nft_ctx_get_output_buffer(nft);
+
+	if (strstr(output, needle))
+		return 0;
+
+	fprintf(stderr, "thread %u: %s: '%s' not found in\n%s", num, what,
+		needle, output);
+	return -1;
+}
+
+static struct nft_ctx *ctx_alloc(unsigned int flags)
+{
+	struct nft_ctx *nft;
+
+	nft = nft_ctx_new(NFT_CTX_DEFAULT);
+	if (!nft)
+		return NULL;
+
+	nft_ctx_output_set_flags(nft, flags);
+	if (nft_ctx_buffer_output(nft) || nft_ctx_buffer_error(nft)) {
+		nft_ctx_free(nft);
+		return NULL;
+	}
+
+	return nft;
+}
+
+static int run_loop(struct nft_ctx *nft, unsigned int num, unsigned int n)
+{
+	struct nft_ctx *netdb;
+	char buf[1024];
+	int ret;
+
+	snprintf(buf, sizeof(buf),
+		 "table ip t%u {\n"
+		 "	set s {\n"
+		 "		type ipv4_addr\n"
+		 "		flags interval\n"
+		 "	}\n"
+		 "	chain c {\n"
+		 "		iifname \"lo\" ip saddr @s counter accept\n"
+		 "		meta l4proto gre counter accept\n"
+		 "		tcp dport ssh counter accept\n"
+		 "		iif \"lo\" jump other\n"
+		 "	}\n"
+		 "	chain other {\n"
+		 "	}\n"
+		 "}\n", num);
+	if (run(nft, num, "load", buf))
+		return -1;
+
+	snprintf(buf, sizeof(buf), "add element ip t%u s { 10.%u.%u.0/24 }",
+		 num, num, n);
+	if (run(nft, num, "add element", buf))
+		return -1;
+
+	snprintf(buf, sizeof(buf), "list table ip t%u", num);
+	if (run(nft, num, "list", buf))
+		return -1;
+
+	snprintf(buf, sizeof(buf), "10.%u.%u.0/24", num, n);
+	if (check(nft, num, "list", buf))
+		return -1;
+
+	netdb = ctx_alloc(NFT_CTX_OUTPUT_SERVICE);
+	if (!netdb)
+		return -1;
+
+	snprintf(buf, sizeof(buf), "list table ip t%u", num);
+	ret = run(netdb, num, "list names", buf);
+	if (!ret)
+		ret = check(netdb, num, "list names", "meta l4proto gre");
+	if (!ret)
+		ret = check(netdb, num, "list names", "tcp dport ssh");
+	nft_ctx_free(netdb);
+	if (ret)
+		return -1;
+
+	if (have_json) {
+		nft_ctx_output_set_flags(nft, NFT_CTX_OUTPUT_JSON |
+					      NFT_CTX_OUTPUT_ECHO);
+		snprintf(buf, sizeof(buf),
+			 "{\"nftables\": [{\"add\": {\"rule\": {"
+			 "\"family\": \"ip\", \"table\": \"t%u\", "
+			 "\"chain\": \"other\", "
+			 "\"expr\": [{\"accept\": null}]}}}]}", num);
+		ret = run(nft, num, "json echo", buf);
+		nft_ctx_output_set_flags(nft, 0);
+		if (ret)
+			return -1;
+
+		snprintf(buf, sizeof(buf), "\"table\": \"t%u\"", num);
+		if (check(nft, num, "json echo", buf) ||
+		    check(nft, num, "json echo", "\"handle\""))
+			return -1;
+	}
+
+	snprintf(buf, sizeof(buf), "delete table ip t%u", num);
+	return run(nft, num, "delete", buf);
+}
+
+static void *thread_run(void *arg)
+{
+	struct thread *t = arg;
+	struct nft_ctx *nft;
+	unsigned int n;
+
+	nft = ctx_alloc(0);
+	if (!nft) {
+		t->failed = true;
+		return NULL;
+	}
+
+	for (n = 0; n < LOOPS; n++) {
+		if (run_loop(nft, t->num, n)) {
+			t->failed = true;
+			break;
+		}
+	}
+	nft_ctx_free(nft);
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread threads[THREADS] = {};
+	bool failed = false;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j")) != -1) {
+		switch (opt) {
+		case 'j':
+			have_json = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-j]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		threads[i].num = i;
+		if (pthread_create(&threads[i].id, NULL, thread_run,
+				   &threads[i])) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+	}
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(threads[i].id, NULL);
+		if (threads[i].failed)
+			failed = true;
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}